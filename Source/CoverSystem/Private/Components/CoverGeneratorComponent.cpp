@@ -8,7 +8,8 @@ UCoverGeneratorComponent::UCoverGeneratorComponent()
 {
 	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
 	// off to improve performance if you don't need them.
-	PrimaryComponentTick.bCanEverTick = false;
+	PrimaryComponentTick.bCanEverTick = true;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
 }
 
 // Called when the game starts
@@ -21,6 +22,9 @@ void UCoverGeneratorComponent::BeginPlay()
 	GetOwner()->GetActorBounds(false, origin, extent);
 	OwnerBounds = FBoxCenterAndExtent(origin, extent).GetBox();
 
+	// only tick for following the owner around
+	SetComponentTickEnabled(bFollowOwnerMovement);
+
 	// generate cover points NEAR begin play, if requested
 	// have to wait for the navmesh to finish generation, first
 	if (bGenerateOnBeginPlay)
@@ -51,40 +55,51 @@ void UCoverGeneratorComponent::OnComponentDestroyed(bool bDestroyingHierarchy)
 void UCoverGeneratorComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	if (!bCoverGenerated)
+		return;
+
+	const FTransform ownerTransform = GetOwner()->GetActorTransform();
+	if (FVector::DistSquared(ownerTransform.GetLocation(), LastCoverTransform.GetLocation()) > FMath::Square(CoverMoveTolerance)
+		|| !ownerTransform.GetRotation().Equals(LastCoverTransform.GetRotation()))
+		UpdateCoverPoints();
 }
 
 void UCoverGeneratorComponent::GenerateCoverPoints()
 {
-#if DEBUG_RENDERING
-	if (UCoverSubsystem* CoverSystem = GetWorld()->GetSubsystem<UCoverSubsystem>())
-	{
-		bDebugDraw = CoverSystem->bDebugDraw;
-	}
-	else
+	bCoverGenerated = true;
+	LastCoverTransform = GetOwner()->GetActorTransform();
+
+	// spawn the cover generator task; it records its debug shapes for the cover system to draw, so it runs in the background even when debug drawing
+	(new FAutoDeleteAsyncTask<FActorCoverPointGeneratorTask>(
+		GetOwner(),
+		GetWorld(),
+		BoundingBoxExpansion,
+		ScanGridUnit,
+		SmallestAgentHeight,
+		bGeneratePerStaticMesh,
+		bScanColumns
+	))->StartBackgroundTask();
+}
+
+void UCoverGeneratorComponent::UpdateCoverPoints()
+{
+	UCoverSubsystem* CoverSystem = GetWorld()->GetSubsystem<UCoverSubsystem>();
+	if (!CoverSystem)
+		return;
+
+	if (CoverSystem->MoveCoverPointsOfObject(GetOwner(), MaxCoverMoveDistance))
 	{
+		LastCoverTransform = GetOwner()->GetActorTransform();
 		return;
 	}
-#endif
-
-	// spawn the cover generator task
-#if DEBUG_RENDERING
-	if (bDebugDraw)
-		(new FAutoDeleteAsyncTask<FActorCoverPointGeneratorTask>(
-			GetOwner(),
-			GetWorld(),
-			BoundingBoxExpansion,
-			ScanGridUnit,
-			SmallestAgentHeight,
-			bGeneratePerStaticMesh
-			))->StartSynchronousTask();
-	else
-#endif
-		(new FAutoDeleteAsyncTask<FActorCoverPointGeneratorTask>(
-			GetOwner(),
-			GetWorld(),
-			BoundingBoxExpansion,
-			ScanGridUnit,
-			SmallestAgentHeight,
-			bGeneratePerStaticMesh
-		))->StartBackgroundTask();
+
+	// too soon to regenerate again, the next tick will try once more
+	const float time = GetWorld()->GetTimeSeconds();
+	if (time - LastCoverRescanTime < MinCoverRescanInterval)
+		return;
+
+	LastCoverRescanTime = time;
+	CoverSystem->RemoveCoverPointsOfObject(GetOwner());
+	GenerateCoverPoints();
 }
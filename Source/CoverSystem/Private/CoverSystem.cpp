@@ -1,12 +1,19 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "CoverSystem.h"
+#include "Debug/CoverAllocationCounter.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Parse.h"
 
 #define LOCTEXT_NAMESPACE "FCoverSystemModule"
 
 void FCoverSystemModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
+
+	// counts the heap allocations of the cover generators per tile, see FCoverAllocationCounter
+	if (FParse::Param(FCommandLine::Get(), TEXT("CoverAllocationCounter")))
+		FCoverAllocationCounter::Install();
 }
 
 void FCoverSystemModule::ShutdownModule()
@@ -36,15 +36,28 @@ void AChangeNotifyingRecastNavMesh::OnNavMeshTilesUpdated(const TArray<uint32>&
 	Super::OnNavMeshTilesUpdated(ChangedTiles);
 
 	TSet<uint32> updatedTiles;
-	for (uint32 changedTile : ChangedTiles)
+	TArray<FBox> dirtyAreas;
 	{
-		updatedTiles.Add(changedTile);
-		UpdatedTilesIntervalBuffer.Add(changedTile);
-		UpdatedTilesUntilFinishedBuffer.Add(changedTile);
+		FScopeLock TileUpdateLock(&TileUpdateLockObject);
+		for (uint32 changedTile : ChangedTiles)
+		{
+			updatedTiles.Add(changedTile);
+			UpdatedTilesIntervalBuffer.Add(changedTile);
+			UpdatedTilesUntilFinishedBuffer.Add(changedTile);
+
+			// pass on the dirty areas that have led to the tile's update
+			const FBox tileBounds = GetNavMeshTileBounds(changedTile);
+			for (const FBox& dirtyArea : PendingDirtyAreas)
+				if (dirtyArea.Intersect(tileBounds))
+				{
+					dirtyAreas.AddUnique(dirtyArea);
+					DirtyAreasIntervalBuffer.AddUnique(dirtyArea);
+				}
+		}
 	}
 
 	// fire the immediate delegate
-	NavmeshTilesUpdatedImmediateDelegate.Broadcast(updatedTiles);
+	NavmeshTilesUpdatedImmediateDelegate.Broadcast(updatedTiles, dirtyAreas);
 }
 
 void AChangeNotifyingRecastNavMesh::ProcessQueuedTiles()
@@ -53,9 +66,21 @@ void AChangeNotifyingRecastNavMesh::ProcessQueuedTiles()
 	if (UpdatedTilesIntervalBuffer.Num() > 0)
 	{
 		UE_LOG(OurNavMesh, Log, TEXT("OnNavMeshTilesUpdated - tile count: %d"), UpdatedTilesIntervalBuffer.Num());
-		NavmeshTilesUpdatedBufferedDelegate.Broadcast(UpdatedTilesIntervalBuffer);
+		NavmeshTilesUpdatedBufferedDelegate.Broadcast(UpdatedTilesIntervalBuffer, DirtyAreasIntervalBuffer);
 		UpdatedTilesIntervalBuffer.Empty();
+		DirtyAreasIntervalBuffer.Empty();
+	}
+}
+
+void AChangeNotifyingRecastNavMesh::RebuildDirtyAreas(const TArray<FNavigationDirtyArea>& DirtyAreas)
+{
+	{
+		FScopeLock TileUpdateLock(&TileUpdateLockObject);
+		for (const FNavigationDirtyArea& dirtyArea : DirtyAreas)
+			PendingDirtyAreas.AddUnique(dirtyArea.Bounds);
 	}
+
+	Super::RebuildDirtyAreas(DirtyAreas);
 }
 
 void AChangeNotifyingRecastNavMesh::OnNavmeshGenerationFinishedHandler(ANavigationData* NavData)
@@ -63,4 +88,7 @@ void AChangeNotifyingRecastNavMesh::OnNavmeshGenerationFinishedHandler(ANavigati
 	FScopeLock TileUpdateLock(&TileUpdateLockObject);
 	NavmeshTilesUpdatedUntilFinishedDelegate.Broadcast(UpdatedTilesUntilFinishedBuffer);
 	UpdatedTilesUntilFinishedBuffer.Empty();
+
+	// every dirty tile has been rebuilt by now
+	PendingDirtyAreas.Empty();
 }
@@ -0,0 +1,544 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "CoverSystem/CoverCollisionSnapshot.h"
+#include "CoverSystem/CoverSubsystem.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Components/ShapeComponent.h"
+#include "Components/BrushComponent.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(CoverCollisionSnapshot, Log, All);
+DEFINE_LOG_CATEGORY(CoverCollisionSnapshot)
+
+// Trace tag of the capture's overlap query, named once rather than per capture.
+static const FName CaptureCollisionSnapshotTraceTag(TEXT("CoverGenerator_CaptureCollisionSnapshot"));
+
+// Returns true if the ray from Start along StartToEnd enters the convex before reaching its end. Time is relative to StartToEnd.
+static bool IntersectConvex(float& OutTime, FVector& OutNormal, bool& bOutStartInside, TArrayView<const FPlane> Planes, const FVector& Start, const FVector& StartToEnd)
+{
+	float enterTime = 0.0f;
+	float exitTime = 1.0f;
+	bOutStartInside = true;
+	for (const FPlane& plane : Planes)
+	{
+		const float distance = plane.PlaneDot(Start);
+		const float approach = FVector::DotProduct(plane, StartToEnd);
+		if (distance > 0.0f)
+			bOutStartInside = false;
+
+		// parallel to the plane: either always outside of it or never
+		if (FMath::IsNearlyZero(approach))
+		{
+			if (distance > 0.0f)
+				return false;
+
+			continue;
+		}
+
+		const float time = -distance / approach;
+		if (approach < 0.0f)
+		{
+			if (time > enterTime)
+			{
+				enterTime = time;
+				OutNormal = plane;
+			}
+		}
+		else
+		{
+			exitTime = FMath::Min(exitTime, time);
+		}
+
+		if (enterTime > exitTime)
+			return false;
+	}
+
+	OutTime = bOutStartInside ? 0.0f : enterTime;
+	if (bOutStartInside)
+		OutNormal = -StartToEnd.GetSafeNormal();
+
+	return true;
+}
+
+static bool IntersectSphere(float& OutTime, FVector& OutNormal, bool& bOutStartInside, const FVector& Center, float Radius, const FVector& Start, const FVector& StartToEnd)
+{
+	const FVector centerToStart = Start - Center;
+	const float c = centerToStart.SizeSquared() - FMath::Square(Radius);
+	bOutStartInside = c <= 0.0f;
+	if (bOutStartInside)
+	{
+		OutTime = 0.0f;
+		OutNormal = -StartToEnd.GetSafeNormal();
+		return true;
+	}
+
+	const float a = StartToEnd.SizeSquared();
+	const float b = FVector::DotProduct(centerToStart, StartToEnd);
+	const float discriminant = b * b - a * c;
+	if (a < KINDA_SMALL_NUMBER || discriminant < 0.0f)
+		return false;
+
+	OutTime = (-b - FMath::Sqrt(discriminant)) / a;
+	if (OutTime < 0.0f || OutTime > 1.0f)
+		return false;
+
+	OutNormal = (Start + StartToEnd * OutTime - Center).GetSafeNormal();
+	return true;
+}
+
+static bool IntersectCapsule(float& OutTime, FVector& OutNormal, bool& bOutStartInside, const FVector& SegmentStart, const FVector& SegmentEnd, float Radius, const FVector& Start, const FVector& StartToEnd)
+{
+	bOutStartInside = FMath::PointDistToSegmentSquared(Start, SegmentStart, SegmentEnd) <= FMath::Square(Radius);
+	if (bOutStartInside)
+	{
+		OutTime = 0.0f;
+		OutNormal = -StartToEnd.GetSafeNormal();
+		return true;
+	}
+
+	// the capsule is made up of its two hemispheres and the cylinder between them, the nearest of the three is the hit
+	bool bHit = false;
+	float time;
+	FVector normal;
+	bool bStartInside;
+	OutTime = MAX_FLT;
+	for (const FVector& sphereCenter : { SegmentStart, SegmentEnd })
+		if (IntersectSphere(time, normal, bStartInside, sphereCenter, Radius, Start, StartToEnd) && time < OutTime)
+		{
+			OutTime = time;
+			OutNormal = normal;
+			bHit = true;
+		}
+
+	// ray vs. cylinder, see Ericson: Real-Time Collision Detection, 5.3.7
+	const FVector d = SegmentEnd - SegmentStart;
+	const FVector m = Start - SegmentStart;
+	const float dd = FVector::DotProduct(d, d);
+	const float md = FVector::DotProduct(m, d);
+	const float nd = FVector::DotProduct(StartToEnd, d);
+	const float a = dd * StartToEnd.SizeSquared() - nd * nd;
+	if (!FMath::IsNearlyZero(a))
+	{
+		const float b = dd * FVector::DotProduct(m, StartToEnd) - nd * md;
+		const float c = dd * (m.SizeSquared() - FMath::Square(Radius)) - md * md;
+		const float discriminant = b * b - a * c;
+		if (discriminant >= 0.0f)
+		{
+			time = (-b - FMath::Sqrt(discriminant)) / a;
+			const float axisTime = md + time * nd;
+			if (time >= 0.0f && time <= 1.0f && axisTime >= 0.0f && axisTime <= dd && time < OutTime)
+			{
+				const FVector hitLocation = Start + StartToEnd * time;
+				OutTime = time;
+				OutNormal = (hitLocation - FMath::ClosestPointOnSegment(hitLocation, SegmentStart, SegmentEnd)).GetSafeNormal();
+				bHit = true;
+			}
+		}
+	}
+
+	return bHit;
+}
+
+FCoverCollisionSnapshot::FCoverCollisionSnapshot(UWorld* _World, ECollisionChannel _Channel, bool _bVerify)
+	: World(_World),
+	Channel(_Channel),
+	bVerify(_bVerify)
+{}
+
+void FCoverCollisionSnapshot::Capture(const FBox& Area)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CaptureCollisionSnapshot);
+
+	FCollisionQueryParams collQueryParams;
+	collQueryParams.TraceTag = CaptureCollisionSnapshotTraceTag;
+
+	// the buffers of the previous capture are reused
+	Reset();
+
+	TArray<FOverlapResult>& overlaps = Overlaps;
+	overlaps.Reset();
+	World->OverlapMultiByChannel(overlaps, Area.GetCenter(), FQuat::Identity, Channel, FCollisionShape::MakeBox(Area.GetExtent()), collQueryParams);
+
+	// the instances of instanced static meshes each have a body of their own, with the instance's transform
+	TSet<TPair<UPrimitiveComponent*, int32>>& bodies = CapturedBodies;
+	for (const FOverlapResult& overlap : overlaps)
+	{
+		UPrimitiveComponent* component = overlap.GetComponent();
+		if (!overlap.bBlockingHit || !component)
+			continue;
+
+		UInstancedStaticMeshComponent* instancedMesh = Cast<UInstancedStaticMeshComponent>(component);
+		const int32 item = instancedMesh ? overlap.ItemIndex : INDEX_NONE;
+		bool bAlreadyCaptured;
+		bodies.Add(TPair<UPrimitiveComponent*, int32>(component, item), &bAlreadyCaptured);
+		if (bAlreadyCaptured)
+			continue;
+
+		FTransform transform = component->GetComponentTransform();
+		FBox bounds = component->Bounds.GetBox();
+		if (instancedMesh)
+		{
+			if (!instancedMesh->GetStaticMesh() || !instancedMesh->GetInstanceTransform(item, transform, true))
+			{
+				FallbackBounds.Add(bounds);
+				continue;
+			}
+
+			bounds = instancedMesh->GetStaticMesh()->GetBounds().GetBox().TransformBy(transform);
+		}
+
+		if (!AddComponentShapes(component, transform, item))
+			FallbackBounds.Add(bounds);
+	}
+
+	INC_DWORD_STAT_BY(STAT_CoverSnapshotShapeCount, Shapes.Num());
+	BuildHierarchy();
+}
+
+bool FCoverCollisionSnapshot::CaptureComponent(UPrimitiveComponent* Component, int32 Item, const FTransform& ComponentTransform, const FBox& Area, float GroundZ)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CaptureCollisionSnapshot);
+
+	Reset();
+
+	// a component that the channel's traces go through has nothing to capture, as far as they're concerned
+	if (!Component || !Component->IsQueryCollisionEnabled() || Component->GetCollisionResponseToChannel(Channel) != ECR_Block)
+		return false;
+
+	if (!AddComponentShapes(Component, ComponentTransform, Item))
+		return false;
+
+	// the ground is a box like any other, just without a component or an actor
+	FCoverCollisionShape& ground = Shapes.AddDefaulted_GetRef();
+	ground.Type = ECoverCollisionShapeType::Convex;
+	ground.Bounds = FBox(FVector(Area.Min.X, Area.Min.Y, GroundZ - GroundThickness), FVector(Area.Max.X, Area.Max.Y, GroundZ));
+	ground.PlaneStart = Planes.Num();
+	Planes.Add(FPlane(FVector::ForwardVector, ground.Bounds.Max.X));
+	Planes.Add(FPlane(-FVector::ForwardVector, -ground.Bounds.Min.X));
+	Planes.Add(FPlane(FVector::RightVector, ground.Bounds.Max.Y));
+	Planes.Add(FPlane(-FVector::RightVector, -ground.Bounds.Min.Y));
+	Planes.Add(FPlane(FVector::UpVector, ground.Bounds.Max.Z));
+	Planes.Add(FPlane(-FVector::UpVector, -ground.Bounds.Min.Z));
+	ground.PlaneCount = Planes.Num() - ground.PlaneStart;
+
+	INC_DWORD_STAT_BY(STAT_CoverSnapshotShapeCount, Shapes.Num());
+	BuildHierarchy();
+	return true;
+}
+
+void FCoverCollisionSnapshot::Reset()
+{
+	Shapes.Reset();
+	Planes.Reset();
+	Nodes.Reset();
+	FallbackBounds.Reset();
+	CapturedBodies.Reset();
+}
+
+void FCoverCollisionSnapshot::BuildHierarchy()
+{
+	if (Shapes.Num() > 0)
+	{
+		Nodes.AddDefaulted();
+		BuildNode(0, 0, Shapes.Num());
+	}
+}
+
+bool FCoverCollisionSnapshot::AddComponentShapes(UPrimitiveComponent* Component, const FTransform& ComponentTransform, int32 Item)
+{
+	// only these have all of their collision in the one body setup, at the component's transform; e.g. skeletal meshes have a body per bone, each with a transform of its own
+	if (!Component->IsA<UStaticMeshComponent>() && !Component->IsA<UShapeComponent>() && !Component->IsA<UBrushComponent>())
+		return false;
+
+	// without simple collision, the scene traces against the triangle mesh or the heightfield
+	UBodySetup* bodySetup = Component->GetBodySetup();
+	if (!bodySetup || bodySetup->GetCollisionTraceFlag() == CTF_UseComplexAsSimple)
+		return false;
+
+	const FKAggregateGeom& aggGeom = bodySetup->AggGeom;
+	if (aggGeom.GetElementCount() == 0 || aggGeom.TaperedCapsuleElems.Num() > 0)
+		return false;
+
+	const FTransform unscaledComponentTransform(ComponentTransform.GetRotation(), ComponentTransform.GetTranslation());
+	const FVector scale = ComponentTransform.GetScale3D();
+	const uint32 actorId = Component->GetOwner() ? Component->GetOwner()->GetUniqueID() : 0;
+
+	// the shapes go straight into the snapshot, and are taken back out if the component turns out not to be capturable after all
+	const int32 firstShapeIdx = Shapes.Num();
+	const int32 firstPlaneIdx = Planes.Num();
+	auto AddShape = [&](ECoverCollisionShapeType Type) -> FCoverCollisionShape&
+	{
+		FCoverCollisionShape& shape = Shapes.AddDefaulted_GetRef();
+		shape.Type = Type;
+		shape.Component = Component;
+		shape.ActorId = actorId;
+		shape.Item = Item;
+		return shape;
+	};
+
+	auto AddConvex = [&](TArrayView<const FPlane> LocalPlanes, const FBox& LocalBounds, const FTransform& ElemTransform)
+	{
+		// the transpose adjoint used by FPlane::TransformBy() keeps the planes right under non-uniform scaling too, but not their length
+		const FMatrix elemToWorld = (ElemTransform * ComponentTransform).ToMatrixWithScale();
+		FCoverCollisionShape& shape = AddShape(ECoverCollisionShapeType::Convex);
+		shape.PlaneStart = Planes.Num();
+		for (const FPlane& localPlane : LocalPlanes)
+		{
+			const FPlane plane = localPlane.TransformBy(elemToWorld);
+			const float normalLength = FVector(plane).Size();
+			if (normalLength > KINDA_SMALL_NUMBER)
+				Planes.Add(FPlane(plane.X / normalLength, plane.Y / normalLength, plane.Z / normalLength, plane.W / normalLength));
+		}
+
+		shape.PlaneCount = Planes.Num() - shape.PlaneStart;
+
+		shape.Bounds = LocalBounds.TransformBy(elemToWorld);
+	};
+
+	for (const FKBoxElem& box : aggGeom.BoxElems)
+	{
+		const FVector halfExtent(box.X * 0.5f, box.Y * 0.5f, box.Z * 0.5f);
+		const FPlane planes[] = {
+			FPlane(FVector::ForwardVector, halfExtent.X), FPlane(-FVector::ForwardVector, halfExtent.X),
+			FPlane(FVector::RightVector, halfExtent.Y), FPlane(-FVector::RightVector, halfExtent.Y),
+			FPlane(FVector::UpVector, halfExtent.Z), FPlane(-FVector::UpVector, halfExtent.Z) };
+		AddConvex(planes, FBox(-halfExtent, halfExtent), box.GetTransform());
+	}
+
+	for (const FKConvexElem& convex : aggGeom.ConvexElems)
+	{
+		ConvexPlanes.Reset();
+		convex.GetPlanes(ConvexPlanes);
+		if (ConvexPlanes.Num() == 0)
+		{
+			Shapes.SetNum(firstShapeIdx, false);
+			Planes.SetNum(firstPlaneIdx, false);
+			return false;
+		}
+
+		AddConvex(ConvexPlanes, convex.ElemBox, convex.GetTransform());
+	}
+
+	for (const FKSphereElem& sphere : aggGeom.SphereElems)
+	{
+		const FKSphereElem scaledSphere = sphere.GetFinalScaled(scale, FTransform::Identity);
+		FCoverCollisionShape& shape = AddShape(ECoverCollisionShapeType::Sphere);
+		shape.Start = unscaledComponentTransform.TransformPosition(scaledSphere.Center);
+		shape.End = shape.Start;
+		shape.Radius = scaledSphere.Radius;
+		shape.Bounds = FBox(shape.Start, shape.Start).ExpandBy(shape.Radius);
+	}
+
+	for (const FKSphylElem& sphyl : aggGeom.SphylElems)
+	{
+		const FKSphylElem scaledSphyl = sphyl.GetFinalScaled(scale, FTransform::Identity);
+		const FVector halfSegment = scaledSphyl.Rotation.RotateVector(FVector(0.0f, 0.0f, scaledSphyl.Length * 0.5f));
+		FCoverCollisionShape& shape = AddShape(ECoverCollisionShapeType::Capsule);
+		shape.Start = unscaledComponentTransform.TransformPosition(scaledSphyl.Center - halfSegment);
+		shape.End = unscaledComponentTransform.TransformPosition(scaledSphyl.Center + halfSegment);
+		shape.Radius = scaledSphyl.Radius;
+		shape.Bounds = FBox(shape.Start.ComponentMin(shape.End), shape.Start.ComponentMax(shape.End)).ExpandBy(shape.Radius);
+	}
+
+	return true;
+}
+
+void FCoverCollisionSnapshot::BuildNode(int32 NodeIdx, int32 Start, int32 Count)
+{
+	FBox bounds(ForceInit);
+	FBox centers(ForceInit);
+	for (int32 iShape = Start; iShape < Start + Count; iShape++)
+	{
+		bounds += Shapes[iShape].Bounds;
+		centers += Shapes[iShape].Bounds.GetCenter();
+	}
+
+	Nodes[NodeIdx].Bounds = bounds;
+	if (Count <= ShapesPerLeaf)
+	{
+		Nodes[NodeIdx].Start = Start;
+		Nodes[NodeIdx].Count = Count;
+		return;
+	}
+
+	// split at the median along the longest axis of the shapes' centers
+	const FVector extent = centers.GetExtent();
+	const int32 axis = extent.X >= extent.Y && extent.X >= extent.Z ? 0 : (extent.Y >= extent.Z ? 1 : 2);
+	Sort(Shapes.GetData() + Start, Count, [axis](const FCoverCollisionShape& A, const FCoverCollisionShape& B)
+	{
+		return A.Bounds.GetCenter()[axis] < B.Bounds.GetCenter()[axis];
+	});
+
+	const int32 childIdx = Nodes.AddDefaulted(2);
+	Nodes[NodeIdx].Start = childIdx;
+	Nodes[NodeIdx].Count = 0;
+
+	const int32 firstHalf = Count / 2;
+	BuildNode(childIdx, Start, firstHalf);
+	BuildNode(childIdx + 1, Start + firstHalf, Count - firstHalf);
+}
+
+template<typename VisitorType>
+void FCoverCollisionSnapshot::VisitShapeHits(const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams, VisitorType&& Visitor) const
+{
+	const FVector startToEnd = End - Start;
+	if (Nodes.Num() == 0 || startToEnd.IsNearlyZero())
+		return;
+
+	TArray<int32, TInlineAllocator<64>> nodeStack;
+	nodeStack.Add(0);
+	while (nodeStack.Num() > 0)
+	{
+		const FCoverCollisionNode& node = Nodes[nodeStack.Pop(false)];
+		if (!FMath::LineBoxIntersection(node.Bounds, Start, End, startToEnd))
+			continue;
+
+		if (node.Count == 0)
+		{
+			nodeStack.Add(node.Start);
+			nodeStack.Add(node.Start + 1);
+			continue;
+		}
+
+		for (int32 iShape = node.Start; iShape < node.Start + node.Count; iShape++)
+		{
+			const FCoverCollisionShape& shape = Shapes[iShape];
+			if (QueryParams.GetIgnoredActors().Contains(shape.ActorId))
+				continue;
+
+			float time;
+			FVector normal;
+			bool bStartInside;
+			bool bHit = false;
+			switch (shape.Type)
+			{
+			case ECoverCollisionShapeType::Convex:
+				bHit = IntersectConvex(time, normal, bStartInside, TArrayView<const FPlane>(Planes.GetData() + shape.PlaneStart, shape.PlaneCount), Start, startToEnd);
+				break;
+			case ECoverCollisionShapeType::Sphere:
+				bHit = IntersectSphere(time, normal, bStartInside, shape.Start, shape.Radius, Start, startToEnd);
+				break;
+			case ECoverCollisionShapeType::Capsule:
+				bHit = IntersectCapsule(time, normal, bStartInside, shape.Start, shape.End, shape.Radius, Start, startToEnd);
+				break;
+			}
+
+			if (!bHit || (bStartInside && !QueryParams.bFindInitialOverlaps))
+				continue;
+
+			Visitor(shape, time, normal, bStartInside);
+		}
+	}
+}
+
+// Fills out the main fields of a hit on a captured shape, the same ones as a scene query would.
+static void MakeShapeHit(FHitResult& OutHit, const FCoverCollisionShape& Shape, float Time, const FVector& Normal, bool bStartInside, const FVector& Start, const FVector& End, bool bBlockingHit)
+{
+	OutHit = FHitResult(Start, End);
+	OutHit.bBlockingHit = bBlockingHit;
+	OutHit.bStartPenetrating = bStartInside;
+	OutHit.Time = Time;
+	OutHit.Distance = FVector::Dist(Start, End) * Time;
+	OutHit.Location = FMath::Lerp(Start, End, Time);
+	OutHit.ImpactPoint = OutHit.Location;
+	OutHit.Normal = Normal;
+	OutHit.ImpactNormal = Normal;
+	OutHit.Component = Shape.Component;
+	OutHit.Item = Shape.Item;
+	OutHit.Actor = Shape.Component.IsValid() ? Shape.Component->GetOwner() : nullptr;
+}
+
+bool FCoverCollisionSnapshot::TraceShapes(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams) const
+{
+	const FCoverCollisionShape* hitShape = nullptr;
+	float hitTime = MAX_FLT;
+	FVector hitNormal = FVector::ZeroVector;
+	bool bHitStartInside = false;
+	VisitShapeHits(Start, End, QueryParams, [&](const FCoverCollisionShape& Shape, float Time, const FVector& Normal, bool bStartInside)
+	{
+		if (Time >= hitTime)
+			return;
+
+		hitShape = &Shape;
+		hitTime = Time;
+		hitNormal = Normal;
+		bHitStartInside = bStartInside;
+	});
+
+	if (!hitShape)
+		return false;
+
+	MakeShapeHit(OutHit, *hitShape, hitTime, hitNormal, bHitStartInside, Start, End, true);
+	return true;
+}
+
+bool FCoverCollisionSnapshot::LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams) const
+{
+	// whatever couldn't be captured is up to the physics scene
+	const FVector startToEnd = End - Start;
+	for (const FBox& fallbackBounds : FallbackBounds)
+		if (FMath::LineBoxIntersection(fallbackBounds, Start, End, startToEnd))
+		{
+			INC_DWORD_STAT(STAT_CoverSnapshotSceneTraceCount);
+			return World->LineTraceSingleByChannel(OutHit, Start, End, Channel, QueryParams);
+		}
+
+	OutHit = FHitResult(Start, End);
+	const bool bHit = TraceShapes(OutHit, Start, End, QueryParams);
+	if (!bVerify)
+		return bHit;
+
+	// equivalence check against the scene-query path
+	FHitResult sceneHit;
+	const bool bSceneHit = World->LineTraceSingleByChannel(sceneHit, Start, End, Channel, QueryParams);
+	if (bSceneHit != bHit
+		|| (bHit && (sceneHit.GetActor() != OutHit.GetActor() || sceneHit.bStartPenetrating != OutHit.bStartPenetrating || FMath::Abs(sceneHit.Distance - OutHit.Distance) > VerifyTolerance)))
+	{
+		INC_DWORD_STAT(STAT_CoverSnapshotMismatchCount);
+		UE_LOG(CoverCollisionSnapshot, Warning, TEXT("Trace from %s to %s: snapshot hit %s at %f, scene hit %s at %f"),
+			*Start.ToString(), *End.ToString(),
+			bHit ? *GetNameSafe(OutHit.GetActor()) : TEXT("nothing"), OutHit.Distance,
+			bSceneHit ? *GetNameSafe(sceneHit.GetActor()) : TEXT("nothing"), sceneHit.Distance);
+	}
+
+	return bHit;
+}
+
+bool FCoverCollisionSnapshot::LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams) const
+{
+	OutHits.Reset();
+
+	// whatever couldn't be captured is up to the physics scene; every hit of it is made a touch, so that the trace goes through them all
+	const FVector startToEnd = End - Start;
+	for (const FBox& fallbackBounds : FallbackBounds)
+		if (FMath::LineBoxIntersection(fallbackBounds, Start, End, startToEnd))
+		{
+			INC_DWORD_STAT(STAT_CoverSnapshotSceneTraceCount);
+			World->LineTraceMultiByChannel(OutHits, Start, End, Channel, QueryParams, FCollisionResponseParams(ECR_Overlap));
+			return OutHits.Num() > 0;
+		}
+
+	VisitShapeHits(Start, End, QueryParams, [&](const FCoverCollisionShape& Shape, float Time, const FVector& Normal, bool bStartInside)
+	{
+		MakeShapeHit(OutHits.AddDefaulted_GetRef(), Shape, Time, Normal, bStartInside, Start, End, false);
+	});
+	OutHits.Sort([](const FHitResult& A, const FHitResult& B) { return A.Time < B.Time; });
+	if (!bVerify)
+		return OutHits.Num() > 0;
+
+	// equivalence check against the scene-query path
+	TArray<FHitResult> sceneHits;
+	World->LineTraceMultiByChannel(sceneHits, Start, End, Channel, QueryParams, FCollisionResponseParams(ECR_Overlap));
+	bool bMismatch = sceneHits.Num() != OutHits.Num();
+	for (int32 iHit = 0; iHit < OutHits.Num() && !bMismatch; iHit++)
+		bMismatch = sceneHits[iHit].GetActor() != OutHits[iHit].GetActor() || FMath::Abs(sceneHits[iHit].Distance - OutHits[iHit].Distance) > VerifyTolerance;
+
+	if (bMismatch)
+	{
+		INC_DWORD_STAT(STAT_CoverSnapshotMismatchCount);
+		UE_LOG(CoverCollisionSnapshot, Warning, TEXT("Multi-trace from %s to %s: snapshot hit %d surfaces, scene hit %d"),
+			*Start.ToString(), *End.ToString(), OutHits.Num(), sceneHits.Num());
+	}
+
+	return OutHits.Num() > 0;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "CoverSystem/CoverGenerationScheduler.h"
+
+void FCoverGenerationScheduler::Schedule(uint32 TileIdx, float Priority)
+{
+	FCoverTileJobs& tileJobs = TileJobs.FindOrAdd(TileIdx);
+	if (!tileJobs.bPending)
+		PendingJobCount++;
+
+	// the queue entry of the replaced pending job is left behind, it gets skipped once popped
+	tileJobs.LatestJobId = NextJobId++;
+	tileJobs.bPending = true;
+	Queue.HeapPush(FCoverTileQueueEntry(TileIdx, tileJobs.LatestJobId, Priority));
+}
+
+bool FCoverGenerationScheduler::Pop(uint32& OutTileIdx, uint32& OutJobId)
+{
+	while (Queue.Num() > 0 && BusyWorkerCount < WorkerLimit)
+	{
+		FCoverTileQueueEntry entry;
+		Queue.HeapPop(entry, false);
+
+		FCoverTileJobs* tileJobs = TileJobs.Find(entry.TileIdx);
+		if (!tileJobs || !tileJobs->bPending || tileJobs->LatestJobId != entry.JobId)
+			continue;
+
+		tileJobs->bPending = false;
+		tileJobs->RunningCount++;
+		PendingJobCount--;
+		BusyWorkerCount++;
+
+		OutTileIdx = entry.TileIdx;
+		OutJobId = entry.JobId;
+		return true;
+	}
+
+	return false;
+}
+
+void FCoverGenerationScheduler::Finish(uint32 TileIdx)
+{
+	FCoverTileJobs* tileJobs = TileJobs.Find(TileIdx);
+	if (!tileJobs)
+		return;
+
+	tileJobs->RunningCount = FMath::Max(0, tileJobs->RunningCount - 1);
+	if (tileJobs->RunningCount == 0 && !tileJobs->bPending)
+		TileJobs.Remove(TileIdx);
+}
+
+void FCoverGenerationScheduler::AcquireWorker()
+{
+	BusyWorkerCount++;
+}
+
+void FCoverGenerationScheduler::ReleaseWorker()
+{
+	BusyWorkerCount = FMath::Max(0, BusyWorkerCount - 1);
+}
+
+void FCoverGenerationScheduler::Reprioritize(TFunctionRef<float(uint32 TileIdx)> GetPriority)
+{
+	// get rid of the entries of replaced jobs while we're at it
+	Queue.RemoveAllSwap([this](const FCoverTileQueueEntry& Entry)
+	{
+		const FCoverTileJobs* tileJobs = TileJobs.Find(Entry.TileIdx);
+		return !tileJobs || !tileJobs->bPending || tileJobs->LatestJobId != Entry.JobId;
+	});
+
+	for (FCoverTileQueueEntry& entry : Queue)
+		entry.Priority = GetPriority(entry.TileIdx);
+
+	Queue.Heapify();
+}
+
+bool FCoverGenerationScheduler::IsSuperseded(uint32 TileIdx, uint32 JobId) const
+{
+	const FCoverTileJobs* tileJobs = TileJobs.Find(TileIdx);
+	return !tileJobs || tileJobs->LatestJobId != JobId;
+}
+
+bool FCoverGenerationScheduler::IsBusy(uint32 TileIdx) const
+{
+	return TileJobs.Contains(TileIdx);
+}
+
+void FCoverGenerationScheduler::SetWorkerLimit(int32 _WorkerLimit)
+{
+	WorkerLimit = FMath::Max(1, _WorkerLimit);
+}
+
+int32 FCoverGenerationScheduler::GetPendingJobCount() const
+{
+	return PendingJobCount;
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "CoverSystem/CoverInstanceIds.h"
+
+FCoverInstanceIds::FCoverInstanceIds(bool _bSwapRemove)
+	: bSwapRemove(_bSwapRemove)
+{}
+
+int32 FCoverInstanceIds::GetId(int32 InstanceIndex)
+{
+	check(InstanceIndex >= 0);
+
+	if (bSwapRemove)
+	{
+		while (Ids.Num() <= InstanceIndex)
+			AddId();
+
+		return Ids[InstanceIndex];
+	}
+
+	while (AliveCount <= InstanceIndex)
+		AddId();
+
+	return FindAlive(InstanceIndex);
+}
+
+int32 FCoverInstanceIds::Remove(int32 InstanceIndex, int32 InstanceCount)
+{
+	// instances added since the last lookup have to be known for the renumbering to match the component's
+	GetId(FMath::Max(InstanceIndex, InstanceCount - 1));
+
+	if (bSwapRemove)
+	{
+		const int32 id = Ids[InstanceIndex];
+		Ids.RemoveAtSwap(InstanceIndex, 1, false);
+		AliveIds[id] = false;
+		return id;
+	}
+
+	const int32 id = FindAlive(InstanceIndex);
+	for (int32 node = id + 1; node <= AliveTree.Num(); node += node & -node)
+		AliveTree[node - 1]--;
+
+	AliveCount--;
+	return id;
+}
+
+bool FCoverInstanceIds::IsAlive(int32 Id) const
+{
+	if (Id < 0 || Id >= IdCount)
+		return false;
+
+	if (bSwapRemove)
+		return AliveIds[Id];
+
+	return CountAliveBelow(Id + 1) > CountAliveBelow(Id);
+}
+
+void FCoverInstanceIds::AddId()
+{
+	const int32 id = IdCount++;
+	if (bSwapRemove)
+	{
+		Ids.Add(id);
+		AliveIds.Add(true);
+		return;
+	}
+
+	// the node of the new id also counts the ids right below it, which are already in the tree
+	const int32 node = id + 1;
+	AliveTree.Add(1 + CountAliveBelow(node - 1) - CountAliveBelow(node - (node & -node)));
+	AliveCount++;
+}
+
+int32 FCoverInstanceIds::CountAliveBelow(int32 Id) const
+{
+	int32 count = 0;
+	for (int32 node = Id; node > 0; node -= node & -node)
+		count += AliveTree[node - 1];
+
+	return count;
+}
+
+int32 FCoverInstanceIds::FindAlive(int32 InstanceIndex) const
+{
+	// descend the tree for the last node that has no more than InstanceIndex alive ids up to it, the id after it is the instance's
+	int32 node = 0;
+	int32 remaining = InstanceIndex;
+	for (int32 step = 1 << FMath::FloorLog2(AliveTree.Num()); step > 0; step >>= 1)
+	{
+		if (node + step <= AliveTree.Num() && AliveTree[node + step - 1] <= remaining)
+		{
+			node += step;
+			remaining -= AliveTree[node - 1];
+		}
+	}
+
+	return node;
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "CoverSystem/CoverMeshTemplateCache.h"
+
+TSharedPtr<const FCoverMeshTemplate, ESPMode::ThreadSafe> FCoverMeshTemplateCache::Find(const FCoverMeshTemplateKey& Key) const
+{
+	FRWScopeLock CacheLock(CacheLockObject, FRWScopeLockType::SLT_ReadOnly);
+
+	const TSharedRef<const FCoverMeshTemplate, ESPMode::ThreadSafe>* meshTemplate = Templates.Find(Key);
+	if (!meshTemplate)
+		return nullptr;
+
+	return *meshTemplate;
+}
+
+void FCoverMeshTemplateCache::Add(const FCoverMeshTemplateKey& Key, TSharedRef<const FCoverMeshTemplate, ESPMode::ThreadSafe> Template)
+{
+	FRWScopeLock CacheLock(CacheLockObject, FRWScopeLockType::SLT_Write);
+
+	if (Templates.Contains(Key))
+		return;
+
+	Templates.Add(Key, Template);
+	AllocatedSize += sizeof(FCoverMeshTemplate) + Template->Candidates.GetAllocatedSize();
+}
+
+void FCoverMeshTemplateCache::Empty()
+{
+	FRWScopeLock CacheLock(CacheLockObject, FRWScopeLockType::SLT_Write);
+
+	Templates.Empty();
+	AllocatedSize = 0;
+}
+
+int64 FCoverMeshTemplateCache::GetAllocatedSize() const
+{
+	FRWScopeLock CacheLock(CacheLockObject, FRWScopeLockType::SLT_ReadOnly);
+	return AllocatedSize + Templates.GetAllocatedSize();
+}
@@ -0,0 +1,218 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "CoverSystem/CoverQueryBackends.h"
+#include "LandscapeProxy.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(CoverQueryBackends, Log, All);
+DEFINE_LOG_CATEGORY(CoverQueryBackends)
+
+// Bumped whenever FCoverQueryRecording changes.
+static const int32 CoverQueryRecordingVersion = 3;
+
+bool FCoverSceneQueries::AnyHitUsesComplexAsSimple(const TArray<FHitResult>& Hits)
+{
+	return Hits.ContainsByPredicate([](const FHitResult& Hit)
+	{
+		const UPrimitiveComponent* component = Hit.GetComponent();
+		const UBodySetup* bodySetup = component ? component->GetBodySetup() : nullptr;
+		return bodySetup && bodySetup->GetCollisionTraceFlag() == CTF_UseComplexAsSimple;
+	});
+}
+
+void FCoverSceneQueries::GetLandscapes(TArray<ALandscapeProxy*>& OutLandscapes, const FBox& Area)
+{
+	static const FName GetLandscapesOverlapTag(TEXT("CoverSystem_GetLandscapes"));
+
+	// an overlap query rather than an actor iterator, as it's called for every tile; the results go into a buffer of the thread that keeps its allocation
+	static thread_local TArray<FOverlapResult> Overlaps;
+	TArray<FOverlapResult>& overlaps = Overlaps;
+	overlaps.Reset();
+	World->OverlapMultiByChannel(overlaps, Area.GetCenter(), FQuat::Identity, Channel, FCollisionShape::MakeBox(Area.GetExtent()), FCollisionQueryParams(GetLandscapesOverlapTag, false));
+	for (const FOverlapResult& overlap : overlaps)
+		if (overlap.bBlockingHit)
+			if (ALandscapeProxy* landscape = Cast<ALandscapeProxy>(overlap.GetActor()))
+				OutLandscapes.AddUnique(landscape);
+}
+
+FArchive& operator<<(FArchive& Ar, FCoverQueryRecord& Record)
+{
+	Ar << Record.Type;
+	Ar << Record.Start;
+	Ar << Record.End;
+	Ar << Record.bResult;
+	Ar << Record.Location;
+	Ar << Record.Normal;
+	Ar << Record.Time;
+	Ar << Record.bStartPenetrating;
+	Ar << Record.HitCount;
+	Ar << Record.ObjectId;
+	Ar << Record.bComplexAsSimple;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FCoverRecordedObject& Object)
+{
+	Ar << Object.Name;
+	Ar << Object.bForceField;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FCoverRecordedProbe& Probe)
+{
+	Ar << Probe.Location;
+	Ar << Probe.Direction;
+	Ar << Probe.bRunStart;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FCoverRecordedTile& Tile)
+{
+	Ar << Tile.NavmeshTileIndex;
+	Ar << Tile.AdaptiveProbeStride;
+	Ar << Tile.SmallestAgentHeight;
+	Ar << Tile.CoverPointGroundOffset;
+	Ar << Tile.Probes;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FCoverRecordedScan& Scan)
+{
+	Ar << Scan.Bounds;
+	Ar << Scan.Candidates;
+	Ar << Scan.bTemplate;
+	Ar << Scan.InstanceIndex;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FCoverRecordedActor& Actor)
+{
+	Ar << Actor.OwnerId;
+	Ar << Actor.ScanGridUnit;
+	Ar << Actor.SmallestAgentHeight;
+	Ar << Actor.bScanColumns;
+	Ar << Actor.Scans;
+	return Ar;
+}
+
+int32 FCoverQueryRecording::AddObject(const AActor* Object)
+{
+	if (!Object)
+		return INDEX_NONE;
+
+	if (const int32* objectId = ObjectIds.Find(Object))
+		return *objectId;
+
+	FCoverRecordedObject& recordedObject = Objects.AddDefaulted_GetRef();
+	recordedObject.Name = Object->GetName();
+	const USceneComponent* rootComponent = Object->GetRootComponent();
+	recordedObject.bForceField = rootComponent && ECC_GameTraceChannel2 == rootComponent->GetCollisionObjectType();
+	return ObjectIds.Add(Object, Objects.Num() - 1);
+}
+
+bool FCoverQueryRecording::SaveToFile(const FString& FilePath) const
+{
+	TArray<uint8> bytes;
+	FMemoryWriter writer(bytes);
+	int32 version = CoverQueryRecordingVersion;
+	writer << version;
+	writer << const_cast<TArray<FCoverQueryRecord>&>(Records);
+	writer << const_cast<TArray<FCoverRecordedObject>&>(Objects);
+	writer << const_cast<FCoverRecordedTile&>(Tile);
+	writer << const_cast<FCoverRecordedActor&>(Actor);
+
+	return FFileHelper::SaveArrayToFile(bytes, *FilePath);
+}
+
+bool FCoverQueryRecording::LoadFromFile(const FString& FilePath)
+{
+	TArray<uint8> bytes;
+	if (!FFileHelper::LoadFileToArray(bytes, *FilePath))
+		return false;
+
+	FMemoryReader reader(bytes);
+	int32 version = 0;
+	reader << version;
+	if (version != CoverQueryRecordingVersion)
+	{
+		UE_LOG(CoverQueryBackends, Warning, TEXT("%s was recorded with version %d of the cover query recordings, expected %d."), *FilePath, version, CoverQueryRecordingVersion);
+		return false;
+	}
+
+	reader << Records;
+	reader << Objects;
+	reader << Tile;
+	reader << Actor;
+	ObjectIds.Reset();
+	return !reader.IsError();
+}
+
+const FCoverQueryRecord* FCoverReplayQueries::TakeRecord(ECoverQueryType Type, const FVector& Start, const FVector& End)
+{
+	const FCoverQueryRecord* record = Recording.Records.IsValidIndex(NextRecordIdx) ? &Recording.Records[NextRecordIdx] : nullptr;
+	if (!record || record->Type != Type || !record->Start.Equals(Start, MatchTolerance) || !record->End.Equals(End, MatchTolerance))
+	{
+		MismatchCount++;
+		return nullptr;
+	}
+
+	NextRecordIdx++;
+	return record;
+}
+
+void FCoverReplayQueries::FillHit(FHitResult& OutHit, const FCoverQueryRecord& Record)
+{
+	OutHit = FHitResult(Record.Start, Record.End);
+	OutHit.bBlockingHit = Record.bResult;
+	OutHit.bStartPenetrating = Record.bStartPenetrating;
+	OutHit.Time = Record.Time;
+	OutHit.Distance = Record.Time * FVector::Dist(Record.Start, Record.End);
+	OutHit.Location = Record.Location;
+	OutHit.ImpactPoint = Record.Location;
+	OutHit.Normal = Record.Normal;
+	OutHit.ImpactNormal = Record.Normal;
+}
+
+bool FCoverReplayQueries::LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+{
+	LastHitObjectId = INDEX_NONE;
+	const FCoverQueryRecord* record = TakeRecord(ECoverQueryType::LineTrace, Start, End);
+	if (!record)
+	{
+		OutHit = FHitResult(Start, End);
+		return false;
+	}
+
+	FillHit(OutHit, *record);
+	LastHitObjectId = record->bResult ? record->ObjectId : INDEX_NONE;
+	return record->bResult;
+}
+
+bool FCoverReplayQueries::LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+{
+	OutHits.Reset();
+	bLastComplexAsSimple = false;
+	const FCoverQueryRecord* record = TakeRecord(ECoverQueryType::LineTraceMulti, Start, End);
+	if (!record)
+		return false;
+
+	// the hits follow their trace
+	bLastComplexAsSimple = record->bComplexAsSimple;
+	for (int32 iHit = 0; iHit < record->HitCount && Recording.Records.IsValidIndex(NextRecordIdx); iHit++)
+		FillHit(OutHits.AddDefaulted_GetRef(), Recording.Records[NextRecordIdx++]);
+
+	return record->bResult;
+}
+
+bool FCoverReplayQueries::ProjectPointToNavigation(FVector& OutLocation, const FVector& Point, const FVector& Extent)
+{
+	const FCoverQueryRecord* record = TakeRecord(ECoverQueryType::ProjectPointToNavigation, Point, Extent);
+	if (!record)
+		return false;
+
+	OutLocation = record->Location;
+	return record->bResult;
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "CoverSystem/CoverStaticLayer.h"
+
+FCriticalSection FCoverStaticLayer::RegistryLockObject;
+TMap<FString, TWeakPtr<FCoverStaticLayer, ESPMode::ThreadSafe>> FCoverStaticLayer::Registry;
+
+TSharedRef<FCoverStaticLayer, ESPMode::ThreadSafe> FCoverStaticLayer::Get(const FString& MapName)
+{
+	FScopeLock RegistryLock(&RegistryLockObject);
+
+	if (TWeakPtr<FCoverStaticLayer, ESPMode::ThreadSafe>* existingLayer = Registry.Find(MapName))
+		if (TSharedPtr<FCoverStaticLayer, ESPMode::ThreadSafe> layer = existingLayer->Pin())
+			return layer.ToSharedRef();
+
+	// forget the layers of maps that aren't loaded anymore
+	for (auto It = Registry.CreateIterator(); It; ++It)
+		if (!It.Value().IsValid())
+			It.RemoveCurrent();
+
+	TSharedRef<FCoverStaticLayer, ESPMode::ThreadSafe> layer = MakeShared<FCoverStaticLayer, ESPMode::ThreadSafe>();
+	Registry.Add(MapName, layer);
+	return layer;
+}
+
+TSharedPtr<const FCoverStaticTile, ESPMode::ThreadSafe> FCoverStaticLayer::FindTile(const FIntVector& TileCoord) const
+{
+	FRWScopeLock LayerLock(LayerLockObject, FRWScopeLockType::SLT_ReadOnly);
+
+	const TSharedRef<const FCoverStaticTile, ESPMode::ThreadSafe>* tile = Tiles.Find(TileCoord);
+	if (!tile)
+		return nullptr;
+
+	return *tile;
+}
+
+bool FCoverStaticLayer::HasTile(const FIntVector& TileCoord) const
+{
+	FRWScopeLock LayerLock(LayerLockObject, FRWScopeLockType::SLT_ReadOnly);
+	return Tiles.Contains(TileCoord);
+}
+
+void FCoverStaticLayer::AddTile(const FIntVector& TileCoord, TSharedRef<const FCoverStaticTile, ESPMode::ThreadSafe> Tile)
+{
+	FRWScopeLock LayerLock(LayerLockObject, FRWScopeLockType::SLT_Write);
+
+	if (Tiles.Contains(TileCoord))
+		return;
+
+	Tiles.Add(TileCoord, Tile);
+	AllocatedSize += sizeof(FCoverStaticTile) + Tile->CoverPoints.GetAllocatedSize();
+}
+
+int64 FCoverStaticLayer::GetAllocatedSize() const
+{
+	FRWScopeLock LayerLock(LayerLockObject, FRWScopeLockType::SLT_ReadOnly);
+	return AllocatedSize + Tiles.GetAllocatedSize();
+}
@@ -3,7 +3,13 @@
 #include "CoverSystem/CoverSubsystem.h"
 
 #include "EngineUtils.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/Controller.h"
+#include "GameFramework/PlayerStart.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
 #include "Tasks/NavmeshCoverPointGeneratorTask.h"
+#include "Detour/DetourNavMesh.h"
+#include "HAL/Event.h"
 
 #if DEBUG_RENDERING
 #include "DrawDebugHelpers.h"
@@ -13,105 +19,1419 @@
 DEFINE_STAT(STAT_GenerateCover);
 DEFINE_STAT(STAT_GenerateCoverInBounds);
 DEFINE_STAT(STAT_FindCover);
+DEFINE_STAT(STAT_CaptureCollisionSnapshot);
 
 UCoverSubsystem::UCoverSubsystem()
 {
 	//TODO: take the extents of the underlying navigation mesh instead of using 64000, see NavData->GetBounds() in OnNavmeshUpdated
 	CoverOctree = MakeShareable(new TCoverOctree(FVector(0, 0, 0), 64000));
+	GeneratorStagesDoneEvent = FPlatformProcess::GetSynchEventFromPool(false);
 }
 
 UCoverSubsystem::~UCoverSubsystem()
 {
+	FPlatformProcess::ReturnSynchEventToPool(GeneratorStagesDoneEvent);
+	GeneratorStagesDoneEvent = nullptr;
+
 	if (CoverOctree.IsValid())
 	{
-		CoverOctree->Destroy();
-		CoverOctree = nullptr;
+		CoverOctree->Destroy();
+		CoverOctree = nullptr;
+	}
+
+	ElementToID.Empty();
+	CoverObjectToID.Empty();
+	CoverInstanceToID.Empty();
+	CoverInstanceIds.Empty();
+	CoverObjectFrames.Empty();
+	MovedCoverLocations.Empty();
+}
+
+bool ContainsCoverPoint(FCoverPointOctreeElement CoverPoint, TArray<FCoverPointOctreeElement> CoverPoints)
+{
+	for (FCoverPointOctreeElement cp : CoverPoints)
+		if (CoverPoint.Data->Location == cp.Data->Location)
+			return true;
+
+	return false;
+}
+
+bool UCoverSubsystem::GetElementID(FOctreeElementId2& OutElementID, const FVector ElementLocation) const
+{
+	const FOctreeElementId2* element = ElementToID.Find(ElementLocation);
+	if (!element || !element->IsValidId())
+		return false;
+
+	OutElementID = *element;
+	return true;
+}
+
+void UCoverSubsystem::AssignIDToElement(const FVector ElementLocation, FOctreeElementId2 ID)
+{
+	ElementToID.Add(ElementLocation, ID);
+}
+
+bool UCoverSubsystem::RemoveIDToElementMapping(const FVector ElementLocation)
+{
+	return ElementToID.Remove(ElementLocation) > 0;
+}
+
+bool IsNearAnyAgent(const FBox& Bounds, const TArray<FVector>& AgentLocations, const float RadiusSquared)
+{
+	for (const FVector& agentLocation : AgentLocations)
+		if (Bounds.ComputeSquaredDistanceToPoint(agentLocation) <= RadiusSquared)
+			return true;
+
+	return false;
+}
+
+void UCoverSubsystem::OnNavMeshTilesUpdated(const TSet<uint32>& UpdatedTiles, const TArray<FBox>& DirtyAreas)
+{
+	if (bShareStaticCover && !StaticLayer.IsValid())
+		StaticLayer = FCoverStaticLayer::Get(GetStaticLayerMapName());
+
+	// regenerate cover points within the updated navmesh tiles
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		for (uint32 tileIdx : UpdatedTiles)
+		{
+			FCoverTile& tile = FindOrAddCoverTile(tileIdx);
+			tile.BuildCount++;
+
+			// cover that's already in this world's octree only needs to be regenerated where the geometry has changed, unless the whole tile is due anyway
+			// a generating tile without dirty areas is being generated in full
+			// the areas go straight into the tile's own array, which keeps its allocation from update to update
+			const bool bPartialUpdate = !tile.bStatic
+				&& (tile.State == ECoverTileState::Ready || (tile.State == ECoverTileState::Generating && tile.DirtyAreas.Num() > 0));
+			const int32 nTileDirtyAreas = tile.DirtyAreas.Num();
+			if (bPartialUpdate)
+				for (const FBox& dirtyArea : DirtyAreas)
+					if (dirtyArea.Intersect(tile.Bounds))
+						tile.DirtyAreas.Add(dirtyArea);
+
+			if (!bPartialUpdate || tile.DirtyAreas.Num() == nTileDirtyAreas)
+				tile.DirtyAreas.Reset();
+
+			// Recast has only just added the tile, so copy it while it's fresh; its edges are extracted from the copy by the tile's job, on a worker
+			// removed tiles can't be copied, their job finds them gone too
+			tile.TileSnapshot.Reset();
+			if (bGenerateCoverWithTileBuild)
+				tile.TileSnapshot = FNavmeshEdgeExtractor::CaptureTile(Navmesh, tileIdx);
+
+			// the tile has changed since the level was loaded, so the shared cover doesn't apply to this world anymore
+			if (tile.bStatic)
+				UnshareCoverTile(tileIdx, tile);
+
+			if (tile.State == ECoverTileState::Evicted)
+			{
+				// the compact cover of an evicted tile is outdated now
+				CompactCoverPointCount -= tile.CompactCoverPoints.Num();
+				tile.CompactCoverPoints.Empty();
+
+				if (bLazyGeneration)
+				{
+					SetCoverTileState(tileIdx, tile, ECoverTileState::Pending);
+					continue;
+				}
+			}
+			// in lazy mode, tiles without cover can wait until they're needed; the ones that already have cover must be kept up-to-date
+			else if (bLazyGeneration && tile.State == ECoverTileState::Pending)
+			{
+				continue;
+			}
+
+			EnqueueCoverTile(tileIdx, tile);
+		}
+	}
+
+	DispatchCoverGeneration();
+}
+
+void UCoverSubsystem::OnNavMeshGenerationFinished(const TSet<uint32>& UpdatedTiles)
+{
+	FScopeLock TileLock(&CoverTileLockObject);
+
+	// the buffered tile updates may arrive a little later, but the tiles must already count as not ready
+	for (uint32 tileIdx : UpdatedTiles)
+		if (!CoverTiles.Contains(tileIdx))
+			FindOrAddCoverTile(tileIdx);
+
+	bInitialNavmeshBuildFinished = true;
+}
+
+FCoverTile& UCoverSubsystem::FindOrAddCoverTile(uint32 TileIdx)
+{
+	FCoverTile* existingTile = CoverTiles.Find(TileIdx);
+	FCoverTile& tile = existingTile ? *existingTile : CoverTiles.Add(TileIdx);
+	if (!existingTile)
+		PendingCoverTileCount++; // new tiles start out pending
+	tile.Bounds = Navmesh->GetNavMeshTileBounds(TileIdx);
+
+	// every tile of the navmesh is laid out on the same grid
+	if (const dtNavMesh* recastMesh = Navmesh->GetRecastMesh())
+	{
+		const dtNavMeshParams* params = recastMesh->getParams();
+		CoverTileGridOrigin = FVector(params->orig[0], params->orig[1], params->orig[2]);
+		CoverTileGridSize = FVector2D(params->tileWidth, params->tileHeight);
+	}
+
+	int32 tileX, tileY, tileLayer;
+	if (!Navmesh->GetNavMeshTileXY(TileIdx, tileX, tileY, tileLayer))
+		return tile;
+
+	// Recast reuses the index of a removed tile for the next one it adds, wherever that is
+	const FIntVector coord(tileX, tileY, tileLayer);
+	if (coord != tile.Coord)
+	{
+		if (tile.Coord != FIntVector::NoneValue)
+			if (TArray<uint32, TInlineAllocator<4>>* cell = CoverTileGrid.Find(FIntPoint(tile.Coord.X, tile.Coord.Y)))
+				cell->RemoveSingleSwap(TileIdx);
+
+		CoverTileGrid.FindOrAdd(FIntPoint(coord.X, coord.Y)).Add(TileIdx);
+		tile.Coord = coord;
+	}
+
+	return tile;
+}
+
+void UCoverSubsystem::ForEachCoverTileInArea(const FBox& Area, TFunctionRef<void(uint32 TileIdx, FCoverTile& Tile)> Func) const
+{
+	if (CoverTileGridSize.X <= 0.0f || CoverTileGridSize.Y <= 0.0f)
+		return;
+
+	// the cells of the grid along Recast's X and Z axes, i.e. the world's -X and -Y axes, see dtNavMesh::calcTileLoc()
+	// the area is expanded a little so that tiles whose bounds merely touch it are included, same as FBox::Intersect()
+	const FBox area = Area.ExpandBy(1.0f);
+	const int32 minX = FMath::FloorToInt((-area.Max.X - CoverTileGridOrigin.X) / CoverTileGridSize.X);
+	const int32 maxX = FMath::FloorToInt((-area.Min.X - CoverTileGridOrigin.X) / CoverTileGridSize.X);
+	const int32 minY = FMath::FloorToInt((-area.Max.Y - CoverTileGridOrigin.Z) / CoverTileGridSize.Y);
+	const int32 maxY = FMath::FloorToInt((-area.Min.Y - CoverTileGridOrigin.Z) / CoverTileGridSize.Y);
+
+	// areas larger than the navmesh itself are quicker to go through tile by tile
+	if ((int64)(maxX - minX + 1) * (int64)(maxY - minY + 1) > CoverTileGrid.Num())
+	{
+		for (TPair<uint32, FCoverTile>& tile : CoverTiles)
+			Func(tile.Key, tile.Value);
+
+		return;
+	}
+
+	for (int32 x = minX; x <= maxX; x++)
+		for (int32 y = minY; y <= maxY; y++)
+			if (const TArray<uint32, TInlineAllocator<4>>* cell = CoverTileGrid.Find(FIntPoint(x, y)))
+				for (uint32 tileIdx : *cell)
+					if (FCoverTile* tile = CoverTiles.Find(tileIdx))
+						Func(tileIdx, *tile);
+}
+
+float UCoverSubsystem::GetGenerationPriority(const FCoverTile& Tile) const
+{
+	// tiles that are being queried go before everything else
+	if (Tile.bDemanded)
+		return -1.0f;
+
+	float priority = MAX_FLT;
+	for (const FBox& hotspot : GenerationHotspots)
+		priority = FMath::Min(priority, Tile.Bounds.ComputeSquaredDistanceToBox(hotspot));
+
+	for (const FVector& focusLocation : GenerationFocusLocations)
+		priority = FMath::Min(priority, Tile.Bounds.ComputeSquaredDistanceToPoint(focusLocation));
+
+	return priority;
+}
+
+void UCoverSubsystem::SetCoverTileState(uint32 TileIdx, FCoverTile& Tile, ECoverTileState State)
+{
+	if (Tile.State == ECoverTileState::Pending)
+		PendingCoverTileCount--;
+	else if (Tile.State == ECoverTileState::Evicted)
+		EvictedCoverTiles.Remove(TileIdx);
+
+	if (State == ECoverTileState::Pending)
+		PendingCoverTileCount++;
+	else if (State == ECoverTileState::Evicted)
+		EvictedCoverTiles.Add(TileIdx);
+
+	Tile.State = State;
+}
+
+void UCoverSubsystem::EnqueueCoverTile(uint32 TileIdx, FCoverTile& Tile)
+{
+	SetCoverTileState(TileIdx, Tile, ECoverTileState::Generating);
+	GenerationScheduler.Schedule(TileIdx, GetGenerationPriority(Tile));
+}
+
+void UCoverSubsystem::DispatchCoverGeneration()
+{
+	// keep only as many tasks in flight as there are workers, so that the queue order is what decides which tile comes next
+	const int32 maxWorkers = MaxCoverGenerationWorkers > 0 ? MaxCoverGenerationWorkers : (GThreadPool ? GThreadPool->GetNumThreads() : 1);
+
+	// tasks that run synchronously, i.e. without a thread pool, hand their tile over for tracing right inside RunGeneratorStage(), in which case we keep going until the queue is empty
+	TArray<FNavmeshCoverPointGeneratorTask*, TInlineAllocator<16>> jobsToStart;
+	do
+	{
+		jobsToStart.Reset();
+		{
+			FScopeLock TileLock(&CoverTileLockObject);
+			if (bDeinitialized)
+				return;
+
+			GenerationScheduler.SetWorkerLimit(maxWorkers);
+
+			uint32 tileIdx, jobId;
+			while (GenerationScheduler.Pop(tileIdx, jobId))
+			{
+				FCoverTile* tile = CoverTiles.Find(tileIdx);
+				if (!tile)
+				{
+					GenerationScheduler.ReleaseWorker();
+					GenerationScheduler.Finish(tileIdx);
+					continue;
+				}
+
+				tile->bDemanded = false;
+
+				// another world of the map has already generated the level-derived cover of the tile
+				if (StaticLayer.IsValid() && tile->BuildCount == 1 && StaticLayer->HasTile(tile->Coord))
+				{
+					GenerationScheduler.ReleaseWorker();
+					GenerationScheduler.Finish(tileIdx);
+					tile->bStatic = true;
+					if (!GenerationScheduler.IsBusy(tileIdx))
+						SetCoverTileState(tileIdx, *tile, ECoverTileState::Ready);
+
+					INC_DWORD_STAT(STAT_CoverStaticTilesReused);
+					continue;
+				}
+
+				// the tile's dirty areas stay until a job finishes without being superseded, see FinishCoverTile()
+				FNavmeshCoverPointGeneratorTask* generator = AcquireCoverGenerator();
+				generator->Reset(MapBounds, AdaptiveProbeStride, tile->DirtyAreas, tile->TileSnapshot, tileIdx, jobId);
+				jobsToStart.Add(generator);
+			}
+
+			SET_DWORD_STAT(STAT_CoverPendingJobCount, GenerationScheduler.GetPendingJobCount());
+		}
+
+		for (FNavmeshCoverPointGeneratorTask* generator : jobsToStart)
+			RunGeneratorStage(*generator);
+	} while (jobsToStart.Num() > 0 && IsInGameThread());
+}
+
+FNavmeshCoverPointGeneratorTask* UCoverSubsystem::AcquireCoverGenerator()
+{
+	if (IdleCoverGenerators.Num() > 0)
+		return IdleCoverGenerators.Pop(false);
+
+	// the pool only grows to the number of tiles in flight at once: the workers, plus the tiles whose traces or commits are pending
+	TSharedRef<FNavmeshCoverPointGeneratorTask, ESPMode::ThreadSafe> generator = MakeShared<FNavmeshCoverPointGeneratorTask, ESPMode::ThreadSafe>(
+		CoverPointMinDistance,
+		SmallestAgentHeight,
+		CoverPointGroundOffset,
+		GetWorld(),
+		RunningGeneratorStages,
+		GeneratorStagesDoneEvent
+		);
+	CoverGenerators.Add(generator);
+	return &generator.Get();
+}
+
+void UCoverSubsystem::RecycleCoverGenerator(FNavmeshCoverPointGeneratorTask& Generator)
+{
+	Generator.ReportAllocations();
+
+	// the removed cover points of the diff shouldn't be kept alive by an idle generator; the buffer keeps its allocation
+	Generator.GetCommit().Removals.Reset();
+	IdleCoverGenerators.Add(&Generator);
+}
+
+void UCoverSubsystem::RunGeneratorStage(FNavmeshCoverPointGeneratorTask& Generator)
+{
+	// the generator is queued as it is, rather than wrapped into a task of its own for every stage; same as FAutoDeleteAsyncTask, it runs right away without a thread pool
+	// debug shapes are recorded by the tasks and drawn by TickCoverTraces(), so they run in the background even when debug drawing
+	RunningGeneratorStages.Increment();
+	if (GThreadPool && FPlatformProcess::SupportsMultithreading())
+		GThreadPool->AddQueuedWork(&Generator);
+	else
+		Generator.DoThreadedWork();
+}
+
+void UCoverSubsystem::SubmitCoverTraces(FNavmeshCoverPointGeneratorTask& Generator)
+{
+	// the tile no longer occupies a worker while its traces are in flight
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		GenerationScheduler.ReleaseWorker();
+
+		// nobody is going to tick the traces of a world that's being torn down
+		if (bDeinitialized)
+			return;
+
+		SubmittedTraceGenerators.Add(&Generator);
+	}
+
+	// synchronous tasks are looped over by DispatchCoverGeneration() itself
+	if (!IsInGameThread())
+		DispatchCoverGeneration();
+}
+
+void UCoverSubsystem::TickCoverTraces(UWorld* World, ELevelTick TickType, float DeltaSeconds)
+{
+	if (World != GetWorld())
+		return;
+
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		TracingGenerators.Append(SubmittedTraceGenerators);
+		SubmittedTraceGenerators.Reset();
+	}
+
+	bool bResolvedAny = false;
+	for (int32 iGenerator = TracingGenerators.Num() - 1; iGenerator >= 0; iGenerator--)
+	{
+		// superseded generators don't submit any more traces, they go straight to their last stage to give up on the tile
+		// that's once the traces in flight have come back though, as the generator is reused for another tile afterwards
+		FNavmeshCoverPointGeneratorTask* generator = TracingGenerators[iGenerator];
+		if (IsCoverGenerationSuperseded(generator->GetNavmeshTileIndex(), generator->GetJobId()))
+		{
+			if (generator->HasPendingTraces())
+				continue;
+		}
+		else if (!generator->TickTraces())
+		{
+			continue;
+		}
+
+		// resolving the cover points takes up a worker again
+		{
+			FScopeLock TileLock(&CoverTileLockObject);
+			GenerationScheduler.AcquireWorker();
+		}
+
+		TracingGenerators.RemoveAtSwap(iGenerator);
+		RunGeneratorStage(*generator);
+		bResolvedAny = true;
+	}
+
+	SET_DWORD_STAT(STAT_CoverTracingTileCount, TracingGenerators.Num());
+
+	// write the cover of the tiles that have finished since the last batch into the octree
+	const double now = FPlatformTime::Seconds();
+	if (now >= NextCoverCommitTime)
+	{
+		CommitQueuedCoverTiles();
+		NextCoverCommitTime = now + CoverCommitInterval;
+	}
+
+#if DEBUG_RENDERING
+	// DrawDebugXXX calls may crash UE4 when not called from the main thread, so the tasks leave them to us
+	FCoverDebugDrawBuffer debugDraw;
+	while (QueuedDebugDraws.Dequeue(debugDraw))
+		debugDraw.Draw(GetWorld());
+#endif
+
+	// synchronous tasks don't dispatch the next tiles by themselves
+	if (bResolvedAny)
+		DispatchCoverGeneration();
+}
+
+#if DEBUG_RENDERING
+void UCoverSubsystem::QueueDebugDraw(FCoverDebugDrawBuffer&& DebugDraw)
+{
+	if (!DebugDraw.IsEmpty())
+		QueuedDebugDraws.Enqueue(MoveTemp(DebugDraw));
+}
+#endif
+
+void UCoverSubsystem::FinishCoverTile(uint32 TileIdx)
+{
+	GenerationScheduler.Finish(TileIdx);
+
+	FCoverTile* tile = CoverTiles.Find(TileIdx);
+	if (!tile)
+		return;
+
+	// a superseded job leaves the tile generating, its replacement is still pending along with the dirty areas of both
+	if (!GenerationScheduler.IsBusy(TileIdx))
+	{
+		tile->DirtyAreas.Reset();
+		tile->TileSnapshot.Reset();
+		if (tile->State == ECoverTileState::Generating)
+			SetCoverTileState(TileIdx, *tile, ECoverTileState::Ready);
+	}
+
+	// freshly generated tiles shouldn't be the first ones to get evicted
+	tile->LastDemandTime = FPlatformTime::Seconds();
+}
+
+void UCoverSubsystem::OnCoverTileGenerated(FNavmeshCoverPointGeneratorTask& Generator)
+{
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		GenerationScheduler.ReleaseWorker();
+		FinishCoverTile(Generator.GetNavmeshTileIndex());
+		RecycleCoverGenerator(Generator);
+	}
+
+	// background tasks hand their worker thread over to the next tile right away; synchronous ones are looped over by DispatchCoverGeneration() itself
+	if (!IsInGameThread())
+		DispatchCoverGeneration();
+}
+
+bool UCoverSubsystem::IsCoverGenerationSuperseded(uint32 TileIdx, uint32 JobId) const
+{
+	FScopeLock TileLock(&CoverTileLockObject);
+	return bDeinitialized || GenerationScheduler.IsSuperseded(TileIdx, JobId);
+}
+
+FString UCoverSubsystem::GetStaticLayerMapName() const
+{
+	return UWorld::RemovePIEPrefix(GetWorld()->GetOutermost()->GetName());
+}
+
+// Cell of the spatial hash that DiffCoverTile() and ShareStaticCover() match cover points with.
+static FIntVector GetCoverDiffCell(const FVector& Location, float CellSize)
+{
+	return FIntVector(FMath::FloorToInt(Location.X / CellSize), FMath::FloorToInt(Location.Y / CellSize), FMath::FloorToInt(Location.Z / CellSize));
+}
+
+// Whether the actor has been loaded along with its level, rather than spawned at runtime, i.e. every world of the map has it under the same name.
+static bool IsLevelCoverObject(const AActor* CoverObject)
+{
+	return CoverObject->IsNetStartupActor() && !CoverObject->HasAnyFlags(RF_Transient);
+}
+
+bool UCoverSubsystem::ShareStaticCover(uint32 TileIdx, const TArray<FDTOCoverData>& CoverPoints)
+{
+	if (!StaticLayer.IsValid())
+		return false;
+
+	FIntVector tileCoord;
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+
+		// rebuilt tiles may contain cover of dynamic changes, which is specific to this world
+		const FCoverTile* tile = CoverTiles.Find(TileIdx);
+		if (!tile || tile->BuildCount != 1 || tile->Coord == FIntVector::NoneValue)
+			return false;
+
+		tileCoord = tile->Coord;
+	}
+
+	// other worlds only find the cover objects that have been loaded along with the level under the same name; a tile with cover of anything spawned at runtime stays in this world
+	for (const FDTOCoverData& coverPoint : CoverPoints)
+		if (IsValid(coverPoint.CoverObject) && !IsLevelCoverObject(coverPoint.CoverObject))
+			return false;
+
+	// the octree would filter out near-duplicates on insertion, so do the same here
+	// the cells are as large as the radius, so a near-duplicate is always in the same cell or in one of its neighbours
+	const float duplicateRadius = CoverPointMinDistance * 0.9f;
+	TSharedRef<FCoverStaticTile, ESPMode::ThreadSafe> staticTile = MakeShared<FCoverStaticTile, ESPMode::ThreadSafe>();
+	TMultiMap<FIntVector, int32> staticCoverPointCells;
+	TArray<int32, TInlineAllocator<8>> cellCoverPoints;
+	for (const FDTOCoverData& coverPoint : CoverPoints)
+	{
+		if (!IsValid(coverPoint.CoverObject))
+			continue;
+
+		const FIntVector cell = GetCoverDiffCell(coverPoint.Location, duplicateRadius);
+		bool bUnique = true;
+		for (int32 x = -1; x <= 1 && bUnique; x++)
+			for (int32 y = -1; y <= 1 && bUnique; y++)
+				for (int32 z = -1; z <= 1 && bUnique; z++)
+				{
+					cellCoverPoints.Reset();
+					staticCoverPointCells.MultiFind(cell + FIntVector(x, y, z), cellCoverPoints);
+					for (int32 staticCoverPointIdx : cellCoverPoints)
+					{
+						const FVector& staticLocation = staticTile->CoverPoints[staticCoverPointIdx].Location;
+						if (FMath::Abs(staticLocation.X - coverPoint.Location.X) <= duplicateRadius
+							&& FMath::Abs(staticLocation.Y - coverPoint.Location.Y) <= duplicateRadius
+							&& FMath::Abs(staticLocation.Z - coverPoint.Location.Z) <= duplicateRadius)
+						{
+							bUnique = false;
+							break;
+						}
+					}
+				}
+
+		if (bUnique)
+			staticCoverPointCells.Add(cell, staticTile->CoverPoints.Add(FCoverStaticPoint(
+				coverPoint.Location,
+				coverPoint.CoverObject->GetFName(),
+				FName(*UWorld::RemovePIEPrefix(coverPoint.CoverObject->GetLevel()->GetOutermost()->GetName())),
+				coverPoint.bForceField)));
+	}
+
+	// if another world has beaten us to it then its cover is the same as ours
+	StaticLayer->AddTile(tileCoord, staticTile);
+
+	FScopeLock TileLock(&CoverTileLockObject);
+	FCoverTile* tile = CoverTiles.Find(TileIdx);
+	if (!tile || tile->BuildCount != 1)
+		return false;
+
+	tile->bStatic = true;
+	return true;
+}
+
+void UCoverSubsystem::UnshareCoverTile(uint32 TileIdx, FCoverTile& Tile)
+{
+	Tile.bStatic = false;
+
+	// taken flags of the tile's static cover points are lost, the regenerated cover starts out free
+	FScopeLock ViewLock(&StaticCoverViewLockObject);
+	TArray<FVector> viewLocations;
+	StaticCoverViewsByTile.MultiFind(TileIdx, viewLocations);
+	for (const FVector& viewLocation : viewLocations)
+		StaticCoverViews.Remove(viewLocation);
+
+	StaticCoverViewsByTile.Remove(TileIdx);
+}
+
+AActor* UCoverSubsystem::ResolveStaticCoverObject(const FCoverStaticPoint& StaticCoverPoint) const
+{
+	for (ULevel* level : GetWorld()->GetLevels())
+		if (level && FName(*UWorld::RemovePIEPrefix(level->GetOutermost()->GetName())) == StaticCoverPoint.CoverObjectLevelName)
+			return FindObjectFast<AActor>(level, StaticCoverPoint.CoverObjectName);
+
+	return nullptr;
+}
+
+void UCoverSubsystem::FindStaticCoverPoints(TArray<FCoverPointOctreeElement>& OutCoverPoints, const FBox& QueryBox, const FSphere* QuerySphere) const
+{
+	if (!StaticLayer.IsValid())
+		return;
+
+	// find the static tiles of this world that overlap the query
+	TArray<TPair<uint32, TSharedRef<const FCoverStaticTile, ESPMode::ThreadSafe>>> staticTiles;
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		ForEachCoverTileInArea(QueryBox.ExpandBy(CoverPointMinDistance), [&](uint32 TileIdx, FCoverTile& Tile)
+		{
+			if (Tile.bStatic && Tile.Bounds.ExpandBy(CoverPointMinDistance).Intersect(QueryBox))
+				if (TSharedPtr<const FCoverStaticTile, ESPMode::ThreadSafe> staticTile = StaticLayer->FindTile(Tile.Coord))
+					staticTiles.Add(TPair<uint32, TSharedRef<const FCoverStaticTile, ESPMode::ThreadSafe>>(TileIdx, staticTile.ToSharedRef()));
+		});
+	}
+
+	FScopeLock ViewLock(&StaticCoverViewLockObject);
+	for (const TPair<uint32, TSharedRef<const FCoverStaticTile, ESPMode::ThreadSafe>>& staticTile : staticTiles)
+		for (const FCoverStaticPoint& staticCoverPoint : staticTile.Value->CoverPoints)
+		{
+			if (!QueryBox.IsInsideOrOn(staticCoverPoint.Location))
+				continue;
+
+			// same test as TCoverOctree::FindCoverPoints(), which intersects the query sphere with the unit sphere of the cover point
+			if (QuerySphere && FVector::DistSquared(QuerySphere->Center, staticCoverPoint.Location) > FMath::Square(QuerySphere->W + 1.0f))
+				continue;
+
+			// views are made on first sight, so this world only pays for the static cover it actually uses
+			FCoverPointOctreeElement* view = StaticCoverViews.Find(staticCoverPoint.Location);
+			if (!view)
+			{
+				AActor* coverObject = ResolveStaticCoverObject(staticCoverPoint);
+				if (!coverObject)
+					continue;
+
+				FDTOCoverData coverData(coverObject, staticCoverPoint.Location, staticCoverPoint.bForceField, staticTile.Key);
+				view = &StaticCoverViews.Add(staticCoverPoint.Location, FCoverPointOctreeElement(coverData));
+				StaticCoverViewsByTile.Add(staticTile.Key, staticCoverPoint.Location);
+			}
+
+			// the cover object has been destroyed in this world
+			if (!IsValid(view->GetOwner()))
+				continue;
+
+			OutCoverPoints.Add(*view);
+		}
+}
+
+void UCoverSubsystem::DemandCoverTiles(const FBox& Area) const
+{
+	const double now = FPlatformTime::Seconds();
+
+	FScopeLock TileLock(&CoverTileLockObject);
+	ForEachCoverTileInArea(Area, [&](uint32 TileIdx, FCoverTile& Tile)
+	{
+		if (!Tile.Bounds.Intersect(Area))
+			return;
+
+		Tile.LastDemandTime = now;
+		if (Tile.State != ECoverTileState::Ready)
+		{
+			Tile.bDemanded = true;
+			DemandedCoverTiles.Add(TileIdx);
+		}
+	});
+}
+
+void UCoverSubsystem::UpdateCoverTiles()
+{
+	// pawns are points of interest for ordering the generation; they're found through their controllers, which the world keeps a list of, rather than by going through every actor
+	TArray<FVector> pawnLocations;
+	for (FConstControllerIterator It = GetWorld()->GetControllerIterator(); It; ++It)
+		if (const APawn* pawn = It->IsValid() ? (*It)->GetPawn() : nullptr)
+			pawnLocations.Add(pawn->GetActorLocation());
+
+	TArray<FVector> agentLocations;
+	TArray<uint32> tilesToRestore;
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+
+		// gather the locations of the registered agents, dropping the ones that have been destroyed since
+		CoverAgents.RemoveAll([](const TWeakObjectPtr<const AActor>& Agent) { return !Agent.IsValid(); });
+		for (const TWeakObjectPtr<const AActor>& agent : CoverAgents)
+			agentLocations.Add(agent->GetActorLocation());
+
+		GenerationFocusLocations = PlayerStartLocations;
+		GenerationFocusLocations.Append(pawnLocations);
+		GenerationFocusLocations.Append(agentLocations);
+
+		const float lazyGenerationRadiusSquared = FMath::Square(LazyGenerationAgentRadius);
+		const float evictionRadiusSquared = FMath::Square(CoverEvictionAgentRadius);
+
+		// evicted tiles come back as soon as they're queried, pending ones are generated
+		// demanded tiles get the highest priority in the queue, they're the ones that AI is waiting on; the ones that aren't due yet keep their demand until they are
+		for (auto It = DemandedCoverTiles.CreateIterator(); It; ++It)
+		{
+			FCoverTile* tile = CoverTiles.Find(*It);
+			if (tile && tile->bDemanded)
+			{
+				if (tile->State == ECoverTileState::Evicted)
+					tilesToRestore.Add(*It);
+				else if (bLazyGeneration && tile->State == ECoverTileState::Pending)
+					EnqueueCoverTile(*It, *tile);
+				else if (tile->State != ECoverTileState::Ready)
+					continue;
+			}
+
+			It.RemoveCurrent();
+		}
+
+		// the same goes for the tiles that an agent approaches, which are looked up around each agent rather than going through all of the tiles
+		const float agentRadius = FMath::Max(LazyGenerationAgentRadius, CoverEvictionAgentRadius);
+		for (const FVector& agentLocation : agentLocations)
+			ForEachCoverTileInArea(FBoxCenterAndExtent(agentLocation, FVector(agentRadius)).GetBox(), [&](uint32 TileIdx, FCoverTile& Tile)
+			{
+				const float distanceSquared = Tile.Bounds.ComputeSquaredDistanceToPoint(agentLocation);
+				if (Tile.State == ECoverTileState::Evicted && distanceSquared <= evictionRadiusSquared)
+					tilesToRestore.Add(TileIdx); // restoring a tile twice does nothing
+				else if (bLazyGeneration && Tile.State == ECoverTileState::Pending && distanceSquared <= lazyGenerationRadiusSquared)
+					EnqueueCoverTile(TileIdx, Tile);
+			});
+
+		SET_DWORD_STAT(STAT_PendingCoverTiles, bLazyGeneration ? PendingCoverTileCount : 0);
+
+		// the points of interest have moved since the tiles were queued
+		GenerationScheduler.Reprioritize([this](uint32 TileIdx)
+		{
+			const FCoverTile* tile = CoverTiles.Find(TileIdx);
+			return tile ? GetGenerationPriority(*tile) : MAX_FLT;
+		});
+	}
+
+	for (uint32 tileIdx : tilesToRestore)
+		RestoreCoverTile(tileIdx);
+
+	DispatchCoverGeneration();
+
+	if (CoverMemoryBudgetKB > 0)
+		EnforceMemoryBudget(agentLocations);
+
+	SET_MEMORY_STAT(STAT_CoverResidentMemory, GetCoverMemoryStats().ResidentBytes);
+	if (StaticLayer.IsValid())
+		SET_MEMORY_STAT(STAT_CoverStaticLayerMemory, StaticLayer->GetAllocatedSize());
+	SET_MEMORY_STAT(STAT_CoverMeshTemplateMemory, MeshTemplates.GetAllocatedSize());
+
+	ProcessCoverReadyRequests();
+}
+
+bool UCoverSubsystem::IsCoverReady(FVector Origin, float Radius) const
+{
+	// whoever is asking is going to need the cover soon
+	const FBox area = FBoxCenterAndExtent(Origin, FVector(Radius)).GetBox();
+	DemandCoverTiles(area);
+
+	FScopeLock TileLock(&CoverTileLockObject);
+
+	if (!bInitialNavmeshBuildFinished)
+		return false;
+
+	const float radiusSquared = FMath::Square(Radius);
+	bool bReady = true;
+	ForEachCoverTileInArea(area, [&](uint32 TileIdx, FCoverTile& Tile)
+	{
+		if (Tile.State != ECoverTileState::Ready && Tile.Bounds.ComputeSquaredDistanceToPoint(Origin) <= radiusSquared)
+			bReady = false;
+	});
+
+	return bReady;
+}
+
+void UCoverSubsystem::WaitForCoverReady(FVector Origin, float Radius, FCoverReadyDelegate OnCoverReady)
+{
+	if (IsCoverReady(Origin, Radius))
+	{
+		OnCoverReady.ExecuteIfBound();
+		return;
+	}
+
+	CoverReadyRequests.Add(FCoverReadyRequest(Origin, Radius, OnCoverReady));
+}
+
+void UCoverSubsystem::ProcessCoverReadyRequests()
+{
+	// gather the ready requests first, as the delegates are free to call WaitForCoverReady() again
+	TArray<FCoverReadyDelegate> readyDelegates;
+	for (int32 iRequest = CoverReadyRequests.Num() - 1; iRequest >= 0; iRequest--)
+		if (IsCoverReady(CoverReadyRequests[iRequest].Origin, CoverReadyRequests[iRequest].Radius))
+		{
+			readyDelegates.Add(CoverReadyRequests[iRequest].Delegate);
+			CoverReadyRequests.RemoveAtSwap(iRequest);
+		}
+
+	for (const FCoverReadyDelegate& readyDelegate : readyDelegates)
+		readyDelegate.ExecuteIfBound();
+}
+
+int64 UCoverSubsystem::GetResidentBytesPerCoverPoint()
+{
+	// the octree element, the shared data it points to and the location-to-id mapping
+	return sizeof(FCoverPointOctreeElement) + sizeof(FCoverPointOctreeData) + sizeof(TPair<FVector, FOctreeElementId2>);
+}
+
+FCoverMemoryStats UCoverSubsystem::GetCoverMemoryStats() const
+{
+	int32 nResidentCoverPoints;
+	{
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_ReadOnly);
+		nResidentCoverPoints = ElementToID.Num();
+	}
+	{
+		// the shared static layer itself doesn't count towards any single world
+		FScopeLock ViewLock(&StaticCoverViewLockObject);
+		nResidentCoverPoints += StaticCoverViews.Num();
+	}
+
+	FScopeLock TileLock(&CoverTileLockObject);
+	FCoverMemoryStats stats = MemoryStats;
+	stats.ResidentBytes = nResidentCoverPoints * GetResidentBytesPerCoverPoint() + CompactCoverPointCount * (int64)sizeof(FCompactCoverPoint);
+	return stats;
+}
+
+bool UCoverSubsystem::EvictCoverTile(uint32 TileIdx, const FBox& TileBounds, int64& OutFreedBytes)
+{
+	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+	// the tile lock is held from the check through to the removal, so that the tile can't start generating in between and lose its new cover to the eviction
+	FScopeLock TileLock(&CoverTileLockObject);
+
+	// shared cover isn't this world's to evict
+	FCoverTile* tile = CoverTiles.Find(TileIdx);
+	if (!tile || tile->State != ECoverTileState::Ready || tile->bStatic)
+		return false;
+
+	// only the cover points generated by this very tile are evicted, the ones of cover actors stay in the octree
+	TArray<FCoverPointOctreeElement> coverPoints;
+	CoverOctree->FindCoverPoints(coverPoints, EnlargeAABB(TileBounds));
+	coverPoints.RemoveAll([TileIdx](const FCoverPointOctreeElement& CoverPoint) { return CoverPoint.Data->TileIndex != (int32)TileIdx; });
+
+	// don't pull the rug out from under units that are in cover
+	for (const FCoverPointOctreeElement& coverPoint : coverPoints)
+		if (coverPoint.Data->bTaken)
+			return false;
+
+	tile->CompactCoverPoints.Reset(coverPoints.Num());
+	for (const FCoverPointOctreeElement& coverPoint : coverPoints)
+	{
+		tile->CompactCoverPoints.Add(FCompactCoverPoint(coverPoint.Data->Location, coverPoint.Data->CoverObject, coverPoint.Data->bForceField));
+
+		FOctreeElementId2 id;
+		if (GetElementID(id, coverPoint.Data->Location))
+			CoverOctree->RemoveElement(id);
+
+		RemoveIDToElementMapping(coverPoint.Data->Location);
+	}
+
+	// diffs of the tile that are still queued no longer match its cover
+	CoverTileSequences.Add(TileIdx, ++CoverDataSequence);
+
+	// optimize the octree
+	CoverOctree->ShrinkElements();
+
+	CompactCoverPointCount += tile->CompactCoverPoints.Num();
+	OutFreedBytes = tile->CompactCoverPoints.Num() * (GetResidentBytesPerCoverPoint() - (int64)sizeof(FCompactCoverPoint));
+	SetCoverTileState(TileIdx, *tile, ECoverTileState::Evicted);
+	tile->bDemanded = false;
+	MemoryStats.Evictions++;
+	INC_DWORD_STAT(STAT_CoverTileEvictions);
+
+	return true;
+}
+
+void UCoverSubsystem::RestoreCoverTile(uint32 TileIdx)
+{
+	TArray<FCompactCoverPoint> compactCoverPoints;
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+
+		FCoverTile* tile = CoverTiles.Find(TileIdx);
+		if (!tile || tile->State != ECoverTileState::Evicted)
+			return;
+
+		CompactCoverPointCount -= tile->CompactCoverPoints.Num();
+		compactCoverPoints = MoveTemp(tile->CompactCoverPoints);
+		SetCoverTileState(TileIdx, *tile, ECoverTileState::Ready);
+		tile->bDemanded = false;
+		tile->LastDemandTime = FPlatformTime::Seconds();
+		MemoryStats.Restores++;
+		INC_DWORD_STAT(STAT_CoverTileRestores);
+	}
+
+	// cover objects that have been destroyed while the tile was evicted don't provide cover anymore
+	TArray<FDTOCoverData> coverPointDTOs;
+	coverPointDTOs.Reserve(compactCoverPoints.Num());
+	for (const FCompactCoverPoint& compactCoverPoint : compactCoverPoints)
+		if (AActor* coverObject = compactCoverPoint.CoverObject.Get())
+			coverPointDTOs.Add(FDTOCoverData(coverObject, compactCoverPoint.Location, compactCoverPoint.bForceField, TileIdx));
+
+	AddCoverPoints(coverPointDTOs);
+}
+
+void UCoverSubsystem::EnforceMemoryBudget(const TArray<FVector>& AgentLocations)
+{
+	const int64 budgetBytes = (int64)CoverMemoryBudgetKB * 1024;
+	int64 residentBytes = GetCoverMemoryStats().ResidentBytes;
+	if (residentBytes <= budgetBytes)
+		return;
+
+	// only what's needed for picking and evicting a tile, rather than a copy of all of its bookkeeping
+	struct FEvictionCandidate
+	{
+		uint32 TileIdx;
+		FBox Bounds;
+		double LastDemandTime;
+	};
+
+	// candidates are the ready tiles that haven't been queried for a while and are far from every agent
+	TArray<FEvictionCandidate> candidates;
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+
+		const double now = FPlatformTime::Seconds();
+		const float evictionRadiusSquared = FMath::Square(CoverEvictionAgentRadius);
+		for (const TPair<uint32, FCoverTile>& tile : CoverTiles)
+			if (tile.Value.State == ECoverTileState::Ready
+				&& !tile.Value.bStatic // shared cover isn't this world's to evict
+				&& now - tile.Value.LastDemandTime >= CoverEvictionMinIdleTime
+				&& !IsNearAnyAgent(tile.Value.Bounds, AgentLocations, evictionRadiusSquared))
+				candidates.Add({ tile.Key, tile.Value.Bounds, tile.Value.LastDemandTime });
+	}
+
+	// least recently queried first
+	candidates.Sort([](const FEvictionCandidate& A, const FEvictionCandidate& B) { return A.LastDemandTime < B.LastDemandTime; });
+
+	// the resident size is kept up-to-date here rather than by asking GetCoverMemoryStats() again, which takes every lock
+	for (const FEvictionCandidate& candidate : candidates)
+	{
+		if (residentBytes <= budgetBytes)
+			break;
+
+		int64 freedBytes;
+		if (EvictCoverTile(candidate.TileIdx, candidate.Bounds, freedBytes))
+			residentBytes -= freedBytes;
+	}
+
+	// in lazy mode the compact cover can be dropped too, the tiles will simply be regenerated once they're needed again
+	if (residentBytes <= budgetBytes || !bLazyGeneration)
+		return;
+
+	FScopeLock TileLock(&CoverTileLockObject);
+
+	TArray<uint32> evictedTiles = EvictedCoverTiles.Array();
+	evictedTiles.Sort([this](uint32 A, uint32 B) { return CoverTiles.FindChecked(A).LastDemandTime < CoverTiles.FindChecked(B).LastDemandTime; });
+
+	for (uint32 tileIdx : evictedTiles)
+	{
+		if (residentBytes <= budgetBytes)
+			break;
+
+		FCoverTile& evictedTile = CoverTiles.FindChecked(tileIdx);
+		residentBytes -= evictedTile.CompactCoverPoints.Num() * (int64)sizeof(FCompactCoverPoint);
+		CompactCoverPointCount -= evictedTile.CompactCoverPoints.Num();
+		evictedTile.CompactCoverPoints.Empty();
+		SetCoverTileState(tileIdx, evictedTile, ECoverTileState::Pending);
+		MemoryStats.Drops++;
+		INC_DWORD_STAT(STAT_CoverTileDrops);
+	}
+}
+
+void UCoverSubsystem::RegisterCoverAgent(AActor* Agent)
+{
+	if (!IsValid(Agent))
+		return;
+
+	FScopeLock TileLock(&CoverTileLockObject);
+	CoverAgents.AddUnique(Agent);
+}
+
+void UCoverSubsystem::UnregisterCoverAgent(AActor* Agent)
+{
+	FScopeLock TileLock(&CoverTileLockObject);
+	CoverAgents.Remove(Agent);
+}
+
+void UCoverSubsystem::FindCoverPoints(TArray<FCoverPointOctreeElement>& OutCoverPoints, const FBox& QueryBox) const
+{
+	DemandCoverTiles(QueryBox);
+
+	{
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_ReadOnly);
+		CoverOctree->FindCoverPoints(OutCoverPoints, QueryBox);
+	}
+
+	FindStaticCoverPoints(OutCoverPoints, QueryBox, nullptr);
+}
+
+void UCoverSubsystem::FindCoverPoints(TArray<FCoverPointOctreeElement>& OutCoverPoints, const FSphere& QuerySphere) const
+{
+	const FBox queryBox = FBoxCenterAndExtent(QuerySphere.Center, FVector(QuerySphere.W)).GetBox();
+	DemandCoverTiles(queryBox);
+
+	{
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_ReadOnly);
+		CoverOctree->FindCoverPoints(OutCoverPoints, QuerySphere);
+	}
+
+	FindStaticCoverPoints(OutCoverPoints, queryBox, &QuerySphere);
+}
+
+void UCoverSubsystem::AddCoverPoints(const TArray<FDTOCoverData>& CoverPointDTOs)
+{
+	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+	// only the cover points of actors are mapped to their object and instance, the cover points of tiles are looked up by their tile instead
+	for (FDTOCoverData coverPointDTO : CoverPointDTOs)
+	{
+		if (coverPointDTO.InstancedMesh)
+			coverPointDTO.InstanceIndex = GetCoverInstanceId(coverPointDTO.InstancedMesh, coverPointDTO.InstanceIndex);
+
+		AddMappedCoverPoint(coverPointDTO);
 	}
 
-	ElementToID.Empty();
-	CoverObjectToID.Empty();
+	// optimize the octree
+	CoverOctree->ShrinkElements();
 }
 
-bool ContainsCoverPoint(FCoverPointOctreeElement CoverPoint, TArray<FCoverPointOctreeElement> CoverPoints)
+void UCoverSubsystem::AddCoverPointsOfObject(const AActor* CoverObject, const FTransform& ScanTransform, const TArray<FDTOCoverData>& CoverPointDTOs)
 {
-	for (FCoverPointOctreeElement cp : CoverPoints)
-		if (CoverPoint.Data->Location == cp.Data->Location)
-			return true;
+	FCoverObjectFrame frame;
+	frame.ScanTransform = ScanTransform;
+	frame.Ground = FindCoverObjectGround(CoverObject);
+	frame.Points.Reserve(CoverPointDTOs.Num());
 
-	return false;
+	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+	for (FDTOCoverData coverPointDTO : CoverPointDTOs)
+	{
+		if (coverPointDTO.InstancedMesh)
+			coverPointDTO.InstanceIndex = GetCoverInstanceId(coverPointDTO.InstancedMesh, coverPointDTO.InstanceIndex);
+
+		frame.Points.Add({ ScanTransform.InverseTransformPosition(coverPointDTO.Location), coverPointDTO.Location, coverPointDTO.Location, coverPointDTO.bForceField, coverPointDTO.InstancedMesh, coverPointDTO.InstanceIndex });
+		AddMappedCoverPoint(coverPointDTO);
+	}
+	CoverObjectFrames.Add(CoverObject, MoveTemp(frame));
+
+	// optimize the octree
+	CoverOctree->ShrinkElements();
 }
 
-bool UCoverSubsystem::GetElementID(FOctreeElementId2& OutElementID, const FVector ElementLocation) const
+int32 UCoverSubsystem::GetCoverInstanceId(const UInstancedStaticMeshComponent* InstancedMesh, int32 InstanceIndex)
 {
-	const FOctreeElementId2* element = ElementToID.Find(ElementLocation);
-	if (!element || !element->IsValidId())
+	FCoverInstanceIds* instanceIds = CoverInstanceIds.Find(InstancedMesh);
+	if (!instanceIds)
+		instanceIds = &CoverInstanceIds.Add(InstancedMesh, FCoverInstanceIds(InstancedMesh->IsA<UHierarchicalInstancedStaticMeshComponent>()));
+
+	return instanceIds->GetId(InstanceIndex);
+}
+
+bool UCoverSubsystem::AddMappedCoverPoint(FDTOCoverData& CoverPointDTO)
+{
+	if (!CoverOctree->AddCoverPoint(CoverPointDTO, CoverPointMinDistance * 0.9f))
 		return false;
 
-	OutElementID = *element;
+	// the cover points of tiles are looked up by their tile instead
+	if (CoverPointDTO.TileIndex != INDEX_NONE)
+		return true;
+
+	// the ones generated per instance only by their instance, so that removing an instance doesn't go through every cover point of the actor
+	if (CoverPointDTO.InstancedMesh)
+		CoverInstanceToID.Add(FCoverInstanceKey(CoverPointDTO.InstancedMesh, CoverPointDTO.InstanceIndex), CoverPointDTO.Location);
+	else
+		CoverObjectToID.Add(CoverPointDTO.CoverObject, CoverPointDTO.Location);
+
 	return true;
 }
 
-void UCoverSubsystem::AssignIDToElement(const FVector ElementLocation, FOctreeElementId2 ID)
+const UPrimitiveComponent* UCoverSubsystem::FindCoverObjectGround(const AActor* CoverObject) const
 {
-	ElementToID.Add(ElementLocation, ID);
+	static const FName FindCoverObjectGroundTraceTag(TEXT("CoverSystem_FindCoverObjectGround"));
+
+	// the first thing under the middle of the object, other than the object itself
+	const FBox bounds = CoverObject->GetComponentsBoundingBox();
+	const FVector start(bounds.GetCenter().X, bounds.GetCenter().Y, bounds.Min.Z + CoverPointGroundOffset);
+	FCollisionQueryParams queryParams(FindCoverObjectGroundTraceTag, false, CoverObject);
+	FHitResult hit;
+	if (!GetWorld()->LineTraceSingleByChannel(hit, start, start - FVector(0.0f, 0.0f, SmallestAgentHeight), ECollisionChannel::ECC_GameTraceChannel1, queryParams))
+		return nullptr;
+
+	return hit.GetComponent();
 }
 
-bool UCoverSubsystem::RemoveIDToElementMapping(const FVector ElementLocation)
+bool UCoverSubsystem::MoveCoverPointsOfObject(AActor* CoverObject, float MaxDistance)
 {
-	return ElementToID.Remove(ElementLocation) > 0;
+	if (!IsValid(CoverObject))
+		return false;
+
+	// copy the frame under a read lock, so that cover queries can go on while the cover points are being reprojected
+	const FTransform transform = CoverObject->GetActorTransform();
+	FCoverObjectFrame frame;
+	{
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_ReadOnly);
+
+		const FCoverObjectFrame* existingFrame = CoverObjectFrames.Find(CoverObject);
+		if (!existingFrame)
+			return false;
+
+		frame = *existingFrame;
+	}
+
+	// the surroundings of the object have changed too much for its cover to be moved along
+	if (FVector::DistSquared(transform.GetLocation(), frame.ScanTransform.GetLocation()) > FMath::Square(MaxDistance)
+		|| !FMath::IsNearlyEqual(transform.GetRotation().GetUpVector().Z, frame.ScanTransform.GetRotation().GetUpVector().Z, CoverObjectTiltTolerance)
+		|| FindCoverObjectGround(CoverObject) != frame.Ground.Get())
+		return false;
+
+	// place the cover points where the scan found them relative to the object, then put them back on the navmesh
+	UNavigationSystemV1* navSys = UNavigationSystemV1::GetCurrent(GetWorld());
+	const FVector projectionExtent(CoverPointMinDistance, CoverPointMinDistance, SmallestAgentHeight * 0.5f);
+	// the moved cover points, and the points of the frame that they've been moved from
+	TArray<FDTOCoverData> movedCoverPoints;
+	TArray<int32> movedFramePoints;
+	movedCoverPoints.Reserve(frame.Points.Num());
+	movedFramePoints.Reserve(frame.Points.Num());
+	for (int32 iFramePoint = 0; iFramePoint < frame.Points.Num(); iFramePoint++)
+	{
+		const FCoverObjectFramePoint& framePoint = frame.Points[iFramePoint];
+		if (framePoint.InstanceId != INDEX_NONE && !framePoint.InstancedMesh.IsValid())
+			continue;
+
+		FNavLocation navLocation;
+		if (!navSys || !navSys->ProjectPointToNavigation(transform.TransformPosition(framePoint.LocalLocation), navLocation, projectionExtent))
+			continue;
+
+		FDTOCoverData& movedCoverPoint = movedCoverPoints.Add_GetRef(FDTOCoverData(CoverObject, navLocation.Location, framePoint.bForceField));
+		movedCoverPoint.InstancedMesh = framePoint.InstancedMesh.Get();
+		movedCoverPoint.InstanceIndex = framePoint.InstanceId;
+		movedFramePoints.Add(iFramePoint);
+	}
+
+	// swap the old cover points for the moved ones in a single batch
+	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+	// the actor's cover has been regenerated while the points were being projected
+	FCoverObjectFrame* currentFrame = CoverObjectFrames.Find(CoverObject);
+	if (!currentFrame || currentFrame->Points.Num() != frame.Points.Num())
+		return false;
+
+	// the claims of the units in cover move along with the cover points, so remember which ones are taken, and by which location, before they're removed
+	TBitArray<> takenFramePoints(false, frame.Points.Num());
+	for (int32 iFramePoint = 0; iFramePoint < frame.Points.Num(); iFramePoint++)
+	{
+		FCoverObjectFramePoint& framePoint = currentFrame->Points[iFramePoint];
+		FOctreeElementId2 elementID;
+		takenFramePoints[iFramePoint] = GetElementID(elementID, framePoint.Location) && CoverOctree->GetElementById(elementID).Data->bTaken;
+
+		// a unit that has taken the cover point at its current location, rather than before a previous move, holds it by that location
+		const FVector* movedLocation = MovedCoverLocations.Find(framePoint.ClaimLocation);
+		const bool bClaimMoved = movedLocation && *movedLocation == framePoint.Location;
+		if (!bClaimMoved)
+			framePoint.ClaimLocation = framePoint.Location;
+		else if (!takenFramePoints[iFramePoint])
+			MovedCoverLocations.Remove(framePoint.ClaimLocation);
+	}
+
+	RemoveObjectCoverPoints(CoverObject);
+	for (int32 iMovedCoverPoint = 0; iMovedCoverPoint < movedCoverPoints.Num(); iMovedCoverPoint++)
+	{
+		FDTOCoverData& movedCoverPoint = movedCoverPoints[iMovedCoverPoint];
+		const int32 iFramePoint = movedFramePoints[iMovedCoverPoint];
+		FCoverObjectFramePoint& framePoint = currentFrame->Points[iFramePoint];
+
+		// the cover points of instances removed since the scan stay removed
+		if (movedCoverPoint.InstancedMesh)
+		{
+			const FCoverInstanceIds* instanceIds = CoverInstanceIds.Find(movedCoverPoint.InstancedMesh);
+			if (!instanceIds || !instanceIds->IsAlive(movedCoverPoint.InstanceIndex))
+				continue;
+		}
+
+		if (!AddMappedCoverPoint(movedCoverPoint))
+			continue;
+
+		framePoint.Location = movedCoverPoint.Location;
+		if (!takenFramePoints[iFramePoint])
+			continue;
+
+		FOctreeElementId2 elementID;
+		if (GetElementID(elementID, movedCoverPoint.Location))
+		{
+			CoverOctree->HoldCover(elementID);
+			MovedCoverLocations.Add(framePoint.ClaimLocation, movedCoverPoint.Location);
+			takenFramePoints[iFramePoint] = false;
+		}
+	}
+
+	// the claims on cover points that haven't made it to the new place are lost
+	for (int32 iFramePoint = 0; iFramePoint < frame.Points.Num(); iFramePoint++)
+		if (takenFramePoints[iFramePoint])
+			MovedCoverLocations.Remove(currentFrame->Points[iFramePoint].ClaimLocation);
+
+	// the octree isn't shrunk here: a moving actor swaps its cover points every few frames, about as many as it has removed, so the slack is reused right away
+	// whatever is left over goes with the next batch of tile commits
+	return true;
 }
 
-void UCoverSubsystem::OnNavMeshTilesUpdated(const TSet<uint32>& UpdatedTiles)
+// Working sets of DiffCoverTile(), one per thread, so that diffing a tile doesn't allocate once they've grown to fit the largest tile.
+// Arrays are only ever Reset(), which keeps their allocations; the cover points are let go of at the end of every diff though, so that they don't outlive their removal.
+struct FCoverDiffScratch
 {
-	// regenerate cover points within the updated navmesh tiles
-	TArray<const AActor*> dirtyCoverActors;
-	for (uint32 tileIdx : UpdatedTiles)
+	TArray<FCoverPointOctreeElement> ExistingCoverPoints;
+
+	// Cover points of the tile being diffed, and the cells of the spatial hash that they fall into.
+	TArray<FCoverPointOctreeElement> TileCoverPoints;
+	TMultiMap<FIntVector, int32> TileCoverPointCells;
+
+	// Whether each of TileCoverPoints has been matched with a regenerated cover point.
+	TBitArray<> Matched;
+
+	TArray<int32> CellCoverPoints;
+
+	// Scratch of the calling thread.
+	static FCoverDiffScratch& Get()
 	{
-#if DEBUG_RENDERING
-		// DrawDebugXXX calls may crash UE4 when not called from the main thread, so start synchronous tasks in case we're planning on drawing debug shapes
-		if (bDebugDraw)
-			(new FAutoDeleteAsyncTask<FNavmeshCoverPointGeneratorTask>(
-				CoverPointMinDistance,
-				SmallestAgentHeight,
-				CoverPointGroundOffset,
-				MapBounds,
-				tileIdx,
-				GetWorld()
-				))->StartSynchronousTask();
-		else
-#endif
-			(new FAutoDeleteAsyncTask<FNavmeshCoverPointGeneratorTask>(
-				CoverPointMinDistance,
-				SmallestAgentHeight,
-				CoverPointGroundOffset,
-				MapBounds,
-				tileIdx,
-				GetWorld()
-				))->StartBackgroundTask();
+		static thread_local FCoverDiffScratch Scratch;
+		return Scratch;
+	}
+};
+
+void UCoverSubsystem::DiffCoverTile(TArray<FCoverPointOctreeElement>& OutRemovals, TArray<FDTOCoverData>& OutAdditions, const FCoverTileCommit& Commit) const
+{
+	const TArray<FBox>& DirtyAreas = Commit.DirtyAreas;
+
+	// a partial update leaves the cover points outside of its dirty areas alone
+	FBox queryBox = DirtyAreas.Num() > 0 ? FBox(ForceInit) : EnlargeAABB(Commit.TileArea);
+	for (const FBox& dirtyArea : DirtyAreas)
+		queryBox += dirtyArea;
+
+	auto IsInsideDirtyAreas = [&DirtyAreas](const FVector& Location)
+	{
+		for (const FBox& dirtyArea : DirtyAreas)
+			if (dirtyArea.IsInside(Location))
+				return true;
+
+		return DirtyAreas.Num() == 0;
+	};
+
+	const int32 nRemovals = OutRemovals.Num();
+	const int32 nAdditions = OutAdditions.Num();
+	int32 nKept = 0;
+
+	FCoverDiffScratch& scratch = FCoverDiffScratch::Get();
+	TArray<FCoverPointOctreeElement>& existingCoverPoints = scratch.ExistingCoverPoints;
+	existingCoverPoints.Reset();
+	CoverOctree->FindCoverPoints(existingCoverPoints, queryBox);
+
+	TArray<FCoverPointOctreeElement>& tileCoverPoints = scratch.TileCoverPoints;
+	TMultiMap<FIntVector, int32>& tileCoverPointCells = scratch.TileCoverPointCells;
+	tileCoverPoints.Reset();
+	tileCoverPointCells.Reset();
+	UNavigationSystemV1* navSys = UNavigationSystemV1::GetCurrent(GetWorld());
+	for (const FCoverPointOctreeElement& coverPoint : existingCoverPoints)
+	{
+		if (!IsInsideDirtyAreas(coverPoint.Data->Location))
+			continue;
+
+		if (coverPoint.Data->TileIndex == (int32)Commit.TileIdx)
+		{
+			tileCoverPointCells.Add(GetCoverDiffCell(coverPoint.Data->Location, CoverPointDiffTolerance), tileCoverPoints.Add(coverPoint));
+			continue;
+		}
+
+		// cover points of others are checked just like in RemoveStaleCoverPoints(): do they still have an owner and do they still fall on the navmesh
+		FNavLocation navLocation;
+		if (!IsValid(coverPoint.GetOwner())
+			|| !navSys->ProjectPointToNavigation(coverPoint.Data->Location, navLocation, FVector(0.1f, 0.1f, CoverPointGroundOffset)))
+			OutRemovals.Add(coverPoint);
+	}
+
+	// match the regenerated cover points with the existing ones of the tile
+	const float toleranceSquared = FMath::Square(CoverPointDiffTolerance);
+	TBitArray<>& matched = scratch.Matched;
+	matched.Init(false, tileCoverPoints.Num());
+	TArray<int32>& cellCoverPoints = scratch.CellCoverPoints;
+	for (const FDTOCoverData& coverPoint : Commit.CoverPoints)
+	{
+		const FIntVector cell = GetCoverDiffCell(coverPoint.Location, CoverPointDiffTolerance);
+		int32 matchIdx = INDEX_NONE;
+		for (int32 x = -1; x <= 1 && matchIdx == INDEX_NONE; x++)
+			for (int32 y = -1; y <= 1 && matchIdx == INDEX_NONE; y++)
+				for (int32 z = -1; z <= 1 && matchIdx == INDEX_NONE; z++)
+				{
+					cellCoverPoints.Reset();
+					tileCoverPointCells.MultiFind(cell + FIntVector(x, y, z), cellCoverPoints);
+					for (int32 tileCoverPointIdx : cellCoverPoints)
+					{
+						const FCoverPointOctreeData& existing = *tileCoverPoints[tileCoverPointIdx].Data;
+						if (!matched[tileCoverPointIdx]
+							&& existing.CoverObject.Get() == coverPoint.CoverObject
+							&& FVector::DistSquared(existing.Location, coverPoint.Location) <= toleranceSquared)
+						{
+							matchIdx = tileCoverPointIdx;
+							break;
+						}
+					}
+				}
+
+		if (matchIdx == INDEX_NONE)
+		{
+			OutAdditions.Add(coverPoint);
+			continue;
+		}
+
+		matched[matchIdx] = true;
+		nKept++;
 	}
+
+	for (int32 iTileCoverPoint = 0; iTileCoverPoint < tileCoverPoints.Num(); iTileCoverPoint++)
+		if (!matched[iTileCoverPoint])
+			OutRemovals.Add(tileCoverPoints[iTileCoverPoint]);
+
+	existingCoverPoints.Reset();
+	tileCoverPoints.Reset();
+
+	INC_DWORD_STAT_BY(STAT_CoverCommitAddedCount, OutAdditions.Num() - nAdditions);
+	INC_DWORD_STAT_BY(STAT_CoverCommitRemovedCount, OutRemovals.Num() - nRemovals);
+	INC_DWORD_STAT_BY(STAT_CoverCommitKeptCount, nKept);
 }
 
-void UCoverSubsystem::FindCoverPoints(TArray<FCoverPointOctreeElement>& OutCoverPoints, const FBox& QueryBox) const
+void UCoverSubsystem::ApplyCoverDiff(const TArray<FCoverPointOctreeElement>& Removals, TArray<FDTOCoverData>& Additions)
 {
-	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_ReadOnly);
-	CoverOctree->FindCoverPoints(OutCoverPoints, QueryBox);
+	// removals go first so that they don't block the additions in their place
+	for (const FCoverPointOctreeElement& coverPoint : Removals)
+	{
+		// neighbouring tiles may both have found the same stale cover point, and another cover point may have been added in its place since the diff
+		FOctreeElementId2 id;
+		if (!GetElementID(id, coverPoint.Data->Location) || CoverOctree->GetElementById(id).Data != coverPoint.Data)
+			continue;
+
+		CoverOctree->RemoveElement(id);
+		RemoveIDToElementMapping(coverPoint.Data->Location);
+		RemoveObjectMapping(*coverPoint.Data);
+	}
+
+	for (FDTOCoverData& coverPoint : Additions)
+		CoverOctree->AddCoverPoint(coverPoint, CoverPointMinDistance * 0.9f);
 }
 
-void UCoverSubsystem::FindCoverPoints(TArray<FCoverPointOctreeElement>& OutCoverPoints, const FSphere& QuerySphere) const
+void UCoverSubsystem::QueueCoverTileCommit(FNavmeshCoverPointGeneratorTask& Generator)
 {
-	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_ReadOnly);
-	CoverOctree->FindCoverPoints(OutCoverPoints, QuerySphere);
+	// diff the tile here on the worker, under a read lock so that cover queries can go on in the meantime
+	FCoverTileCommit& commit = Generator.GetCommit();
+	{
+		FCoverAllocationScope allocationScope(Generator.GetAllocationCount());
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_ReadOnly);
+		commit.DiffSequence = CoverDataSequence;
+		DiffCoverTile(commit.Removals, commit.Additions, commit);
+	}
+
+	// the tile no longer occupies a worker while its commit is queued
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		QueuedCoverTileCommits.Add(&Generator);
+		GenerationScheduler.ReleaseWorker();
+	}
+
+	if (!IsInGameThread())
+		DispatchCoverGeneration();
 }
 
-void UCoverSubsystem::AddCoverPoints(const TArray<FDTOCoverData>& CoverPointDTOs)
+void UCoverSubsystem::CommitQueuedCoverTiles()
 {
-	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+	// the batch is swapped out of the queue, which gets the empty buffer of the previous batch in return
+	TArray<FNavmeshCoverPointGeneratorTask*>& generators = CommittingGenerators;
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		Swap(generators, QueuedCoverTileCommits);
+	}
 
-	for (FDTOCoverData coverPointDTO : CoverPointDTOs)
-		CoverOctree->AddCoverPoint(coverPointDTO, CoverPointMinDistance * 0.9f);
+	if (generators.Num() == 0)
+		return;
 
-	// optimize the octree
-	CoverOctree->ShrinkElements();
+	// a tile that has finished more than once since the last batch only needs its latest results, which cover the dirty areas of the earlier ones as well
+	TMap<uint32, int32>& latestCommits = LatestCoverTileCommits;
+	latestCommits.Reset();
+	for (int32 iCommit = 0; iCommit < generators.Num(); iCommit++)
+	{
+		const FCoverTileCommit& commit = generators[iCommit]->GetCommit();
+		int32& latestCommitIdx = latestCommits.FindOrAdd(commit.TileIdx, iCommit);
+		if (commit.JobId > generators[latestCommitIdx]->GetCommit().JobId)
+			latestCommitIdx = iCommit;
+	}
+
+	// write all of the tiles in a single, short critical section
+	{
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+		const uint64 sequence = ++CoverDataSequence;
+		for (const TPair<uint32, int32>& latestCommit : latestCommits)
+		{
+			FNavmeshCoverPointGeneratorTask& generator = *generators[latestCommit.Value];
+			FCoverAllocationScope allocationScope(generator.GetAllocationCount());
+			FCoverTileCommit& latest = generator.GetCommit();
+
+			// the diff is stale if the tile's cover has been written since, e.g. by an earlier job of the tile that was still queued back then
+			if (latest.DiffSequence < CoverResetSequence || CoverTileSequences.FindRef(latest.TileIdx) > latest.DiffSequence)
+			{
+				latest.Removals.Reset();
+				latest.Additions.Reset();
+				DiffCoverTile(latest.Removals, latest.Additions, latest);
+				INC_DWORD_STAT(STAT_CoverRediffedTileCount);
+			}
+
+			ApplyCoverDiff(latest.Removals, latest.Additions);
+			CoverTileSequences.Add(latest.TileIdx, sequence);
+		}
+
+		// optimize the octree
+		CoverOctree->ShrinkElements();
+	}
+	INC_DWORD_STAT_BY(STAT_CoverCommittedTileCount, latestCommits.Num());
+
+	// the generators of the batch are done with their tiles
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		for (FNavmeshCoverPointGeneratorTask* generator : generators)
+		{
+			FinishCoverTile(generator->GetCommit().TileIdx);
+			RecycleCoverGenerator(*generator);
+		}
+	}
+	generators.Reset();
+
+	// the tiles of the batch may have been waited on
+	ProcessCoverReadyRequests();
 }
 
 FBox UCoverSubsystem::EnlargeAABB(FBox Box)
@@ -151,7 +1471,7 @@ void UCoverSubsystem::RemoveStaleCoverPoints(FBox Area)
 
 		// remove the cover point from the element-to-id and object-to-location maps
 		RemoveIDToElementMapping(coverPoint.Data->Location);
-		CoverObjectToID.RemoveSingle(coverPoint.Data->CoverObject, coverPoint.Data->Location);
+		RemoveObjectMapping(*coverPoint.Data);
 	}
 
 	// optimize the octree
@@ -167,25 +1487,106 @@ void UCoverSubsystem::RemoveCoverPointsOfObject(const AActor* CoverObject)
 {
 	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
 
+	RemoveObjectCoverPoints(CoverObject);
+
+	// the claims on the actor's moved cover go away along with it
+	if (const FCoverObjectFrame* frame = CoverObjectFrames.Find(CoverObject))
+		for (const FCoverObjectFramePoint& framePoint : frame->Points)
+		{
+			const FVector* movedLocation = MovedCoverLocations.Find(framePoint.ClaimLocation);
+			if (movedLocation && *movedLocation == framePoint.Location)
+				MovedCoverLocations.Remove(framePoint.ClaimLocation);
+		}
+	CoverObjectFrames.Remove(CoverObject);
+
+	// the instances are numbered afresh by the next scan
+	for (auto It = CoverInstanceIds.CreateIterator(); It; ++It)
+		if (!It.Key().IsValid() || It.Key()->GetOwner() == CoverObject)
+			It.RemoveCurrent();
+
+	// optimize the octree
+	CoverOctree->ShrinkElements();
+}
+
+void UCoverSubsystem::RemoveObjectCoverPoints(const AActor* CoverObject)
+{
 	TArray<FVector> coverPointLocations;
 	CoverObjectToID.MultiFind(CoverObject, coverPointLocations, false);
+	CoverObjectToID.Remove(CoverObject);
+
+	// the cover points generated per instance are only mapped to their instance; the ones of meshes that have been destroyed since go as well
+	for (const TPair<TWeakObjectPtr<const UInstancedStaticMeshComponent>, FCoverInstanceIds>& instanceIds : CoverInstanceIds)
+	{
+		if (instanceIds.Key.IsValid() && instanceIds.Key->GetOwner() != CoverObject)
+			continue;
+
+		for (int32 id = 0; id < instanceIds.Value.GetIdCount(); id++)
+		{
+			const FCoverInstanceKey instanceKey(instanceIds.Key, id);
+			CoverInstanceToID.MultiFind(instanceKey, coverPointLocations);
+			CoverInstanceToID.Remove(instanceKey);
+		}
+	}
 
 	for (const FVector coverPointLocation : coverPointLocations)
 	{
 		FOctreeElementId2 elementID;
-		GetElementID(elementID, coverPointLocation);
-		CoverOctree->RemoveElement(elementID);
+		if (GetElementID(elementID, coverPointLocation))
+			CoverOctree->RemoveElement(elementID);
+
 		RemoveIDToElementMapping(coverPointLocation);
-		CoverObjectToID.Remove(CoverObject);
 
 #if DEBUG_RENDERING
 		if (bDebugDraw)
 			DrawDebugSphere(GetWorld(), coverPointLocation, 20.0f, 4, FColor::Red, true, -1.0f, 0, 2.0f);
 #endif
 	}
+}
 
-	// optimize the octree
-	CoverOctree->ShrinkElements();
+void UCoverSubsystem::RemoveCoverPointsOfInstance(UInstancedStaticMeshComponent* InstancedMesh, int32 InstanceIndex)
+{
+	if (!IsValid(InstancedMesh))
+		return;
+
+	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+	// none of the instances have cover points of their own unless the mesh has ids, the next scan numbers them afresh
+	FCoverInstanceIds* instanceIds = CoverInstanceIds.Find(InstancedMesh);
+	if (!instanceIds)
+		return;
+
+	const FCoverInstanceKey instanceKey(InstancedMesh, instanceIds->Remove(InstanceIndex, InstancedMesh->GetInstanceCount() + 1));
+	TArray<FVector> coverPointLocations;
+	CoverInstanceToID.MultiFind(instanceKey, coverPointLocations);
+	CoverInstanceToID.Remove(instanceKey);
+
+	for (const FVector& coverPointLocation : coverPointLocations)
+	{
+		FOctreeElementId2 elementID;
+		if (GetElementID(elementID, coverPointLocation))
+			CoverOctree->RemoveElement(elementID);
+
+		RemoveIDToElementMapping(coverPointLocation);
+
+#if DEBUG_RENDERING
+		if (bDebugDraw)
+			DrawDebugSphere(GetWorld(), coverPointLocation, 20.0f, 4, FColor::Red, true, -1.0f, 0, 2.0f);
+#endif
+	}
+
+	// the octree isn't shrunk for a single instance, e.g. a tree that has been chopped down; that's left to the next batch of tile commits
+}
+
+void UCoverSubsystem::RemoveObjectMapping(const FCoverPointOctreeData& CoverPoint)
+{
+	// same as AddMappedCoverPoint(): the cover points of tiles aren't mapped, the ones generated per instance are mapped to their instance only
+	if (CoverPoint.TileIndex != INDEX_NONE)
+		return;
+
+	if (CoverPoint.InstanceId != INDEX_NONE)
+		CoverInstanceToID.RemoveSingle(FCoverInstanceKey(CoverPoint.InstancedMesh, CoverPoint.InstanceId), CoverPoint.Location);
+	else
+		CoverObjectToID.RemoveSingle(CoverPoint.CoverObject, CoverPoint.Location);
 }
 
 void UCoverSubsystem::RemoveAll()
@@ -201,31 +1602,72 @@ void UCoverSubsystem::RemoveAll()
 
 	// remove the id-to-element mappings
 	ElementToID.Empty();
+	CoverObjectToID.Empty();
+	CoverInstanceToID.Empty();
+	CoverInstanceIds.Empty();
+	CoverObjectFrames.Empty();
+	MovedCoverLocations.Empty();
+
+	// the diffs of the queued tile commits were computed against the old octree
+	CoverResetSequence = ++CoverDataSequence;
+	CoverTileSequences.Empty();
 
 	// make a new octree
 	CoverOctree = MakeShareable(new TCoverOctree(FVector(0, 0, 0), 64000));
+
+	// in lazy mode, the tiles will have to be demanded again
+	FScopeLock TileLock(&CoverTileLockObject);
+	for (TPair<uint32, FCoverTile>& tile : CoverTiles)
+	{
+		if (tile.Value.bStatic)
+			UnshareCoverTile(tile.Key, tile.Value);
+
+		tile.Value.CompactCoverPoints.Empty();
+		if (bLazyGeneration && !GenerationScheduler.IsBusy(tile.Key))
+			SetCoverTileState(tile.Key, tile.Value, ECoverTileState::Pending);
+		else if (tile.Value.State == ECoverTileState::Evicted)
+			SetCoverTileState(tile.Key, tile.Value, ECoverTileState::Ready);
+	}
+	CompactCoverPointCount = 0;
 }
 
 bool UCoverSubsystem::HoldCover(FVector ElementLocation)
 {
-	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
-	
-	FOctreeElementId2 elemID;
-	if (!GetElementID(elemID, ElementLocation))
-		return false;
+	{
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+		FOctreeElementId2 elemID;
+		if (GetElementID(elemID, ElementLocation))
+			return CoverOctree->HoldCover(elemID);
+	}
 
-	return CoverOctree->HoldCover(elemID);
+	// the cover point may come from the shared static layer, whose taken flags live in this world's views
+	FScopeLock ViewLock(&StaticCoverViewLockObject);
+	const FCoverPointOctreeElement* view = StaticCoverViews.Find(ElementLocation);
+	return view && CoverOctree->HoldCover(*view);
 }
 
 bool UCoverSubsystem::ReleaseCover(FVector ElementLocation)
 {
-	FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
-	
-	FOctreeElementId2 elemID;
-	if (!GetElementID(elemID, ElementLocation))
-		return false;
+	{
+		FRWScopeLock CoverDataLock(CoverDataLockObject, FRWScopeLockType::SLT_Write);
+
+		// the cover point may have moved along with its actor since it was taken, see MoveCoverPointsOfObject()
+		FVector location = ElementLocation;
+		if (const FVector* movedLocation = MovedCoverLocations.Find(ElementLocation))
+		{
+			location = *movedLocation;
+			MovedCoverLocations.Remove(ElementLocation);
+		}
+
+		FOctreeElementId2 elemID;
+		if (GetElementID(elemID, location))
+			return CoverOctree->ReleaseCover(elemID);
+	}
 
-	return CoverOctree->ReleaseCover(elemID);
+	FScopeLock ViewLock(&StaticCoverViewLockObject);
+	const FCoverPointOctreeElement* view = StaticCoverViews.Find(ElementLocation);
+	return view && CoverOctree->ReleaseCover(*view);
 }
 
 void UCoverSubsystem::OnWorldBeginPlay(UWorld& InWorld)
@@ -241,7 +1683,14 @@ void UCoverSubsystem::OnWorldBeginPlay(UWorld& InWorld)
 	if (MainNavData && MainNavData->IsA(AChangeNotifyingRecastNavMesh::StaticClass()))
 	{
 		Navmesh = const_cast<AChangeNotifyingRecastNavMesh*>(Cast<AChangeNotifyingRecastNavMesh>(MainNavData));
-		Navmesh->NavmeshTilesUpdatedBufferedDelegate.AddDynamic(this, &UCoverSubsystem::OnNavMeshTilesUpdated);
+		// tiles are either generated as soon as Recast adds them or in the buffered batches
+		if (bGenerateCoverWithTileBuild)
+			Navmesh->NavmeshTilesUpdatedImmediateDelegate.AddDynamic(this, &UCoverSubsystem::OnNavMeshTilesUpdated);
+		else
+			Navmesh->NavmeshTilesUpdatedBufferedDelegate.AddDynamic(this, &UCoverSubsystem::OnNavMeshTilesUpdated);
+		Navmesh->NavmeshTilesUpdatedUntilFinishedDelegate.AddDynamic(this, &UCoverSubsystem::OnNavMeshGenerationFinished);
+		GetWorld()->GetTimerManager().SetTimer(CoverTileUpdateTimerHandle, this, &UCoverSubsystem::UpdateCoverTiles, CoverTileUpdateInterval, true);
+		CoverTracesTickHandle = FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &UCoverSubsystem::TickCoverTraces);
 		
 		bool bFoundCoverSystemBoundsActor;
 		
@@ -262,11 +1711,75 @@ void UCoverSubsystem::OnWorldBeginPlay(UWorld& InWorld)
 		{
 			UE_LOG(LogTemp, Warning, TEXT("No Actor found with the Actor tag CoverSystemBounds. CoverPoints won't get generated."));
 		}
+
+		// gather the points of interest that the generation is ordered by: cover around player starts and hotspots is needed first
+		for (TActorIterator<APlayerStart> It(GetWorld()); It; ++It)
+			PlayerStartLocations.Add(It->GetActorLocation());
+
+		for (FActorIterator It(GetWorld()); It; ++It)
+		{
+			AActor* Actor = *It;
+			if (Actor->ActorHasTag(FName("CoverSystemHotspot")))
+			{
+				FVector Origin, BoxExtent;
+				Actor->GetActorBounds(false, Origin, BoxExtent, false);
+				GenerationHotspots.Add(FBox(Origin - BoxExtent, Origin + BoxExtent));
+			}
+		}
+		GenerationFocusLocations = PlayerStartLocations;
 		
 		Navmesh->RebuildAll();
 	}
 }
 
+void UCoverSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldPostActorTick.Remove(CoverTracesTickHandle);
+	CoverTracesTickHandle.Reset();
+
+	if (UWorld* world = GetWorld())
+		world->GetTimerManager().ClearTimer(CoverTileUpdateTimerHandle);
+
+	if (IsValid(Navmesh))
+	{
+		Navmesh->NavmeshTilesUpdatedImmediateDelegate.RemoveDynamic(this, &UCoverSubsystem::OnNavMeshTilesUpdated);
+		Navmesh->NavmeshTilesUpdatedBufferedDelegate.RemoveDynamic(this, &UCoverSubsystem::OnNavMeshTilesUpdated);
+		Navmesh->NavmeshTilesUpdatedUntilFinishedDelegate.RemoveDynamic(this, &UCoverSubsystem::OnNavMeshGenerationFinished);
+	}
+
+	// running generators give up on their tiles at their next stage, and no new ones are started
+	// the stages that are still queued on the thread pool are taken back rather than waited for
+	{
+		FScopeLock TileLock(&CoverTileLockObject);
+		bDeinitialized = true;
+
+		if (GThreadPool)
+			for (const TSharedRef<FNavmeshCoverPointGeneratorTask, ESPMode::ThreadSafe>& generator : CoverGenerators)
+				if (GThreadPool->RetractQueuedWork(&generator.Get()))
+					RunningGeneratorStages.Decrement();
+	}
+
+	// the running stages still use the world; the event may have been left triggered by an earlier stage, hence the loop
+	while (RunningGeneratorStages.GetValue() > 0)
+		GeneratorStagesDoneEvent->Wait();
+
+	Navmesh = nullptr;
+
+	// whatever hasn't been traced or committed yet goes away with the world; the pending traces of the tracing generators are never delivered
+	TracingGenerators.Empty();
+	SubmittedTraceGenerators.Empty();
+	QueuedCoverTileCommits.Empty();
+	CommittingGenerators.Empty();
+	IdleCoverGenerators.Empty();
+	CoverGenerators.Empty();
+#if DEBUG_RENDERING
+	QueuedDebugDraws.Empty();
+#endif
+	CoverReadyRequests.Empty();
+
+	Super::Deinitialize();
+}
+
 float UCoverSubsystem::GetCoverPointGroundOffset()
 {
 	return CoverPointGroundOffset;
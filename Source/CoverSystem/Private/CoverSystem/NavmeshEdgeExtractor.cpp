@@ -0,0 +1,334 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "CoverSystem/NavmeshEdgeExtractor.h"
+#include "NavMesh/RecastHelpers.h"
+#include "Detour/DetourNavMesh.h"
+
+// Vertices closer than this are welded together.
+static const float WeldTolerance = 1.0f;
+
+// Squared 2D distance under which a detail edge vertex is considered to lie on a polygon edge.
+static const float DetailEdgeTolerance = 1.0f;
+
+// Distance under which a chain end is considered to lie on a tile seam.
+static const float SeamTolerance = 1.0f;
+
+// Returns true if there's a tile next to the given one, on the given side. Sides are numbered like in dtNavMesh, counter-clockwise from +X.
+static bool HasNeighbourTile(const dtNavMesh* DetourMesh, const dtMeshTile* Tile, int32 Side)
+{
+	static const int32 sideOffsets[8][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } };
+
+	const dtMeshTile* neighbourTile = nullptr;
+	return DetourMesh->getTilesAt(Tile->header->x + sideOffsets[Side][0], Tile->header->y + sideOffsets[Side][1], &neighbourTile, 1) > 0;
+}
+
+// Returns true if there's nothing on the other side of the polygon edge.
+static bool IsBoundaryEdge(const dtNavMesh* DetourMesh, const dtMeshTile* Tile, const dtPoly* Poly, int32 EdgeIdx)
+{
+	const unsigned short neighbour = Poly->neis[EdgeIdx];
+
+	// no neighbour at all
+	if (neighbour == 0)
+		return true;
+
+	// neighbour inside the same tile
+	if ((neighbour & DT_EXT_LINK) == 0)
+		return false;
+
+	// portal to a neighbouring tile: it's only a boundary if it isn't linked to anything
+	for (unsigned int iLink = Poly->firstLink; iLink != DT_NULL_LINK; iLink = DetourMesh->getLink(Tile, iLink).next)
+		if (DetourMesh->getLink(Tile, iLink).edge == EdgeIdx)
+			return false;
+
+	// an unlinked portal is probed whether or not there's a tile behind it: at the outer border of the built navmesh, e.g. around navigation invokers,
+	// it's left to the cliff traces to tell a hole from the end of the navmesh
+	return true;
+}
+
+static bool IsOnEdge2D(const FVector& Point, const FVector& EdgeStart, const FVector& EdgeEnd)
+{
+	return FMath::PointDistToSegmentSquared(FVector(Point.X, Point.Y, 0.0f), FVector(EdgeStart.X, EdgeStart.Y, 0.0f), FVector(EdgeEnd.X, EdgeEnd.Y, 0.0f)) <= DetailEdgeTolerance;
+}
+
+// Detail triangles index the polygon's own vertices first, then the detail vertices.
+static const float* GetDetailVertex(const dtMeshTile* Tile, const dtPoly* Poly, const dtPolyDetail* PolyDetail, unsigned char VertexIdx)
+{
+	return VertexIdx < Poly->vertCount
+		? &Tile->verts[Poly->verts[VertexIdx] * 3]
+		: &Tile->detailVerts[(PolyDetail->vertBase + VertexIdx - Poly->vertCount) * 3];
+}
+
+// Appends the boundary edges of the tile. IsBoundary(PolyIdx, Poly, EdgeIdx) tells whether the edge of the polygon borders on nothing, see IsBoundaryEdge().
+template<typename IsBoundaryType>
+static void ExtractTileBoundaryEdges(TArray<FNavmeshBoundaryEdge>& OutEdges, const dtMeshTile* Tile, IsBoundaryType IsBoundary)
+{
+	for (int32 iPoly = 0; iPoly < Tile->header->polyCount; iPoly++)
+	{
+		// off-mesh connections don't have any area to border on
+		const dtPoly* poly = &Tile->polys[iPoly];
+		if (poly->getType() != DT_POLYTYPE_GROUND)
+			continue;
+
+		// polygons are convex, so their centroid tells the inside of an edge from its outside
+		FVector centroid = FVector::ZeroVector;
+		for (int32 iVertex = 0; iVertex < poly->vertCount; iVertex++)
+			centroid += Recast2UnrealPoint(&Tile->verts[poly->verts[iVertex] * 3]);
+		centroid /= poly->vertCount;
+
+		const dtPolyDetail* polyDetail = &Tile->detailMeshes[iPoly];
+		for (int32 iEdge = 0; iEdge < poly->vertCount; iEdge++)
+		{
+			if (!IsBoundary(iPoly, poly, iEdge))
+				continue;
+
+			const FVector polyEdgeStart = Recast2UnrealPoint(&Tile->verts[poly->verts[iEdge] * 3]);
+			const FVector polyEdgeEnd = Recast2UnrealPoint(&Tile->verts[poly->verts[(iEdge + 1) % poly->vertCount] * 3]);
+
+			FVector normal = FVector(polyEdgeEnd.Y - polyEdgeStart.Y, polyEdgeStart.X - polyEdgeEnd.X, 0.0f).GetSafeNormal();
+			if (FVector::DotProduct(normal, centroid - polyEdgeStart) > 0.0f)
+				normal = -normal;
+
+			if (polyDetail->triCount == 0)
+			{
+				OutEdges.Add(FNavmeshBoundaryEdge(polyEdgeStart, polyEdgeEnd, normal));
+				continue;
+			}
+
+			// follow the detail triangles along the polygon edge so that the edge hugs the ground
+			for (int32 iTri = 0; iTri < polyDetail->triCount; iTri++)
+			{
+				const unsigned char* tri = &Tile->detailTris[(polyDetail->triBase + iTri) * 4];
+				for (int32 iTriEdge = 0; iTriEdge < 3; iTriEdge++)
+				{
+					// the 4th byte holds 2 flag bits per triangle edge, non-zero for edges on the polygon's boundary
+					if (((tri[3] >> (iTriEdge * 2)) & 0x3) == 0)
+						continue;
+
+					const FVector detailEdgeStart = Recast2UnrealPoint(GetDetailVertex(Tile, poly, polyDetail, tri[iTriEdge]));
+					const FVector detailEdgeEnd = Recast2UnrealPoint(GetDetailVertex(Tile, poly, polyDetail, tri[(iTriEdge + 1) % 3]));
+
+					// the polygon's boundary is made up of all of its edges, only keep the part that lies on this one
+					if (!IsOnEdge2D(detailEdgeStart, polyEdgeStart, polyEdgeEnd) || !IsOnEdge2D(detailEdgeEnd, polyEdgeStart, polyEdgeEnd))
+						continue;
+
+					OutEdges.Add(FNavmeshBoundaryEdge(detailEdgeStart, detailEdgeEnd, normal));
+				}
+			}
+		}
+	}
+}
+
+bool FNavmeshEdgeExtractor::ExtractBoundaryEdges(TArray<FNavmeshBoundaryEdge>& OutEdges, const ARecastNavMesh* NavData, int32 TileIdx)
+{
+	const dtNavMesh* detourMesh = NavData ? NavData->GetRecastMesh() : nullptr;
+	if (!detourMesh || TileIdx < 0 || TileIdx >= detourMesh->getMaxTiles())
+		return false;
+
+	const dtMeshTile* tile = detourMesh->getTile(TileIdx);
+	if (!tile || !tile->header)
+		return false;
+
+	ExtractTileBoundaryEdges(OutEdges, tile, [detourMesh, tile](int32 PolyIdx, const dtPoly* Poly, int32 EdgeIdx)
+	{
+		return IsBoundaryEdge(detourMesh, tile, Poly, EdgeIdx);
+	});
+
+	return true;
+}
+
+void FNavmeshEdgeExtractor::ExtractBoundaryEdges(TArray<FNavmeshBoundaryEdge>& OutEdges, const FNavmeshTileSnapshot& TileSnapshot)
+{
+	if (TileSnapshot.Data.Num() == 0)
+		return;
+
+	// a tile that points into the copy instead, with only what's read by ExtractTileBoundaryEdges(); Detour's tiles aren't const-correct, but nothing is written to it
+	unsigned char* data = const_cast<unsigned char*>(TileSnapshot.Data.GetData());
+	dtMeshTile tile;
+	FMemory::Memzero(&tile, sizeof(dtMeshTile));
+	tile.header = (dtMeshHeader*)data;
+	tile.polys = (dtPoly*)(data + TileSnapshot.PolysOffset);
+	tile.verts = (float*)(data + TileSnapshot.VertsOffset);
+	tile.detailMeshes = (dtPolyDetail*)(data + TileSnapshot.DetailMeshesOffset);
+	tile.detailVerts = (float*)(data + TileSnapshot.DetailVertsOffset);
+	tile.detailTris = (unsigned char*)(data + TileSnapshot.DetailTrisOffset);
+
+	ExtractTileBoundaryEdges(OutEdges, &tile, [&TileSnapshot](int32 PolyIdx, const dtPoly* Poly, int32 EdgeIdx)
+	{
+		return (TileSnapshot.BoundaryEdgeMasks[PolyIdx] & (1 << EdgeIdx)) != 0;
+	});
+}
+
+TSharedPtr<const FNavmeshTileSnapshot, ESPMode::ThreadSafe> FNavmeshEdgeExtractor::CaptureTile(const ARecastNavMesh* NavData, int32 TileIdx)
+{
+	static_assert(DT_VERTS_PER_POLYGON <= 8, "The boundary edges of a polygon must fit into a byte.");
+
+	const dtNavMesh* detourMesh = NavData ? NavData->GetRecastMesh() : nullptr;
+	if (!detourMesh || TileIdx < 0 || TileIdx >= detourMesh->getMaxTiles())
+		return nullptr;
+
+	const dtMeshTile* tile = detourMesh->getTile(TileIdx);
+	if (!tile || !tile->header || !tile->data)
+		return nullptr;
+
+	// the polygons, vertices and detail mesh all point into the tile's data, see dtNavMesh::addTile()
+	TSharedRef<FNavmeshTileSnapshot, ESPMode::ThreadSafe> tileSnapshot = MakeShared<FNavmeshTileSnapshot, ESPMode::ThreadSafe>();
+	tileSnapshot->Data.Append(tile->data, tile->dataSize);
+	auto GetOffset = [tile](const void* Pointer) { return (int32)((const unsigned char*)Pointer - tile->data); };
+	tileSnapshot->PolysOffset = GetOffset(tile->polys);
+	tileSnapshot->VertsOffset = GetOffset(tile->verts);
+	tileSnapshot->DetailMeshesOffset = GetOffset(tile->detailMeshes);
+	tileSnapshot->DetailVertsOffset = GetOffset(tile->detailVerts);
+	tileSnapshot->DetailTrisOffset = GetOffset(tile->detailTris);
+
+	// the links aren't, so the portals are checked right here
+	tileSnapshot->BoundaryEdgeMasks.SetNumZeroed(tile->header->polyCount);
+	for (int32 iPoly = 0; iPoly < tile->header->polyCount; iPoly++)
+	{
+		const dtPoly* poly = &tile->polys[iPoly];
+		if (poly->getType() != DT_POLYTYPE_GROUND)
+			continue;
+
+		for (int32 iEdge = 0; iEdge < poly->vertCount; iEdge++)
+			if (IsBoundaryEdge(detourMesh, tile, poly, iEdge))
+				tileSnapshot->BoundaryEdgeMasks[iPoly] |= 1 << iEdge;
+	}
+
+	return tileSnapshot;
+}
+
+void FNavmeshEdgeExtractor::MarkForeignSeams(TArray<FNavmeshBoundaryChain>& Chains, const ARecastNavMesh* NavData, int32 TileIdx)
+{
+	const dtNavMesh* detourMesh = NavData ? NavData->GetRecastMesh() : nullptr;
+	if (!detourMesh || TileIdx < 0 || TileIdx >= detourMesh->getMaxTiles())
+		return;
+
+	const dtMeshTile* tile = detourMesh->getTile(TileIdx);
+	if (!tile || !tile->header)
+		return;
+
+	// each seam is owned by the tile on its +X/+Y (recast) side, i.e. a tile owns its min seams and leaves its max seams to the neighbours, if there are any
+	const bool bForeignMaxX = HasNeighbourTile(detourMesh, tile, 0);
+	const bool bForeignMaxY = HasNeighbourTile(detourMesh, tile, 2);
+	if (!bForeignMaxX && !bForeignMaxY)
+		return;
+
+	auto IsOnForeignSeam = [&](const FVector& Vertex)
+	{
+		const FVector recastVertex = Unreal2RecastPoint(Vertex);
+		return (bForeignMaxX && FMath::Abs(recastVertex.X - tile->header->bmax[0]) <= SeamTolerance)
+			|| (bForeignMaxY && FMath::Abs(recastVertex.Z - tile->header->bmax[2]) <= SeamTolerance);
+	};
+
+	for (FNavmeshBoundaryChain& chain : Chains)
+	{
+		// closed chains don't have ends
+		if (chain.bClosed || chain.Vertices.Num() < 2)
+			continue;
+
+		chain.bStartOnForeignSeam = IsOnForeignSeam(chain.Vertices[0]);
+		chain.bEndOnForeignSeam = IsOnForeignSeam(chain.Vertices.Last());
+	}
+}
+
+SIZE_T FNavmeshWeldScratch::GetAllocatedSize() const
+{
+	SIZE_T allocatedSize = VertexIndices.GetAllocatedSize() + Vertices.GetAllocatedSize() + VertexEdges.GetAllocatedSize() + EdgeVertices.GetAllocatedSize()
+		+ VisitedEdges.GetAllocatedSize() + SpareChains.GetAllocatedSize();
+	for (const TArray<int32, TInlineAllocator<2>>& edges : VertexEdges)
+		allocatedSize += edges.GetAllocatedSize();
+	for (const FNavmeshBoundaryChain& chain : SpareChains)
+		allocatedSize += chain.Vertices.GetAllocatedSize() + chain.Normals.GetAllocatedSize();
+
+	return allocatedSize;
+}
+
+void FNavmeshEdgeExtractor::WeldBoundaryEdges(TArray<FNavmeshBoundaryChain>& OutChains, const TArray<FNavmeshBoundaryEdge>& Edges)
+{
+	FNavmeshWeldScratch scratch;
+	WeldBoundaryEdges(OutChains, Edges, scratch);
+}
+
+void FNavmeshEdgeExtractor::WeldBoundaryEdges(TArray<FNavmeshBoundaryChain>& OutChains, const TArray<FNavmeshBoundaryEdge>& Edges, FNavmeshWeldScratch& Scratch)
+{
+	// the chains of the previous call are reused instead of freed
+	while (OutChains.Num() > 0)
+		Scratch.SpareChains.Add(OutChains.Pop(false));
+
+	// find the shared vertices; adjacent edges come from the same tile vertices, so snapping to a fine grid is enough
+	TMap<FIntVector, int32>& vertexIndices = Scratch.VertexIndices;
+	TArray<FVector>& vertices = Scratch.Vertices;
+	TArray<TArray<int32, TInlineAllocator<2>>>& vertexEdges = Scratch.VertexEdges;
+	TArray<TPair<int32, int32>>& edgeVertices = Scratch.EdgeVertices;
+	vertexIndices.Reset();
+	vertices.Reset();
+	vertexEdges.Reset();
+	edgeVertices.Reset(Edges.Num());
+
+	auto GetVertexIndex = [&](const FVector& Vertex)
+	{
+		const FIntVector key(FMath::RoundToInt(Vertex.X / WeldTolerance), FMath::RoundToInt(Vertex.Y / WeldTolerance), FMath::RoundToInt(Vertex.Z / WeldTolerance));
+		if (const int32* vertexIdx = vertexIndices.Find(key))
+			return *vertexIdx;
+
+		vertexEdges.AddDefaulted();
+		return vertexIndices.Add(key, vertices.Add(Vertex));
+	};
+
+	for (int32 iEdge = 0; iEdge < Edges.Num(); iEdge++)
+	{
+		const int32 startIdx = GetVertexIndex(Edges[iEdge].Start);
+		const int32 endIdx = GetVertexIndex(Edges[iEdge].End);
+		edgeVertices.Add(TPair<int32, int32>(startIdx, endIdx));
+
+		// degenerate edges are left out of the chains
+		if (startIdx == endIdx)
+			continue;
+
+		vertexEdges[startIdx].Add(iEdge);
+		vertexEdges[endIdx].Add(iEdge);
+	}
+
+	TBitArray<>& visitedEdges = Scratch.VisitedEdges;
+	visitedEdges.Init(false, Edges.Num());
+	auto WalkChain = [&](int32 StartVertexIdx, int32 StartEdgeIdx)
+	{
+		FNavmeshBoundaryChain& chain = Scratch.SpareChains.Num() > 0 ? OutChains.Add_GetRef(Scratch.SpareChains.Pop(false)) : OutChains.AddDefaulted_GetRef();
+		chain.Vertices.Reset();
+		chain.Normals.Reset();
+		chain.bClosed = false;
+		chain.bStartOnForeignSeam = false;
+		chain.bEndOnForeignSeam = false;
+		chain.Vertices.Add(vertices[StartVertexIdx]);
+
+		int32 vertexIdx = StartVertexIdx;
+		int32 edgeIdx = StartEdgeIdx;
+		while (edgeIdx != INDEX_NONE)
+		{
+			visitedEdges[edgeIdx] = true;
+			vertexIdx = edgeVertices[edgeIdx].Key == vertexIdx ? edgeVertices[edgeIdx].Value : edgeVertices[edgeIdx].Key;
+			chain.Vertices.Add(vertices[vertexIdx]);
+			chain.Normals.Add(Edges[edgeIdx].Normal);
+
+			// keep going as long as the chain doesn't fork
+			edgeIdx = INDEX_NONE;
+			if (vertexEdges[vertexIdx].Num() == 2)
+				for (int32 nextEdgeIdx : vertexEdges[vertexIdx])
+					if (!visitedEdges[nextEdgeIdx])
+						edgeIdx = nextEdgeIdx;
+		}
+
+		chain.bClosed = vertexIdx == StartVertexIdx && chain.Normals.Num() > 2;
+	};
+
+	// open chains start at their loose ends or at forks
+	for (int32 iVertex = 0; iVertex < vertices.Num(); iVertex++)
+		if (vertexEdges[iVertex].Num() != 2)
+			for (int32 edgeIdx : vertexEdges[iVertex])
+				if (!visitedEdges[edgeIdx])
+					WalkChain(iVertex, edgeIdx);
+
+	// whatever's left are closed loops, e.g. around pillars
+	for (int32 iEdge = 0; iEdge < Edges.Num(); iEdge++)
+		if (!visitedEdges[iEdge] && edgeVertices[iEdge].Key != edgeVertices[iEdge].Value)
+			WalkChain(edgeVertices[iEdge].Key, iEdge);
+}
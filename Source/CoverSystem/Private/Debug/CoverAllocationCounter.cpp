@@ -0,0 +1,138 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "Debug/CoverAllocationCounter.h"
+
+// Counter of the innermost FCoverAllocationScope of the thread. A plain pointer, so that reading it from inside the allocator doesn't allocate.
+static thread_local FThreadSafeCounter* GCoverAllocationCount = nullptr;
+
+static FCoverAllocationCounter* GCoverAllocationCounter = nullptr;
+
+FCoverAllocationCounter::FCoverAllocationCounter(FMalloc* _InnerMalloc)
+	: InnerMalloc(_InnerMalloc)
+{}
+
+void FCoverAllocationCounter::Install()
+{
+	check(IsInGameThread());
+	if (GCoverAllocationCounter || !GMalloc)
+		return;
+
+	// whatever is already allocated is freed through the counter, which hands it to the allocator that it's come from
+	GCoverAllocationCounter = new FCoverAllocationCounter(GMalloc);
+	GMalloc = GCoverAllocationCounter;
+}
+
+bool FCoverAllocationCounter::IsInstalled()
+{
+	return GCoverAllocationCounter != nullptr;
+}
+
+void FCoverAllocationCounter::CountAllocation()
+{
+	if (FThreadSafeCounter* count = GCoverAllocationCount)
+		count->Increment();
+}
+
+void* FCoverAllocationCounter::Malloc(SIZE_T Count, uint32 Alignment)
+{
+	CountAllocation();
+	return InnerMalloc->Malloc(Count, Alignment);
+}
+
+void* FCoverAllocationCounter::TryMalloc(SIZE_T Count, uint32 Alignment)
+{
+	CountAllocation();
+	return InnerMalloc->TryMalloc(Count, Alignment);
+}
+
+void* FCoverAllocationCounter::Realloc(void* Original, SIZE_T Count, uint32 Alignment)
+{
+	if (Count > 0)
+		CountAllocation();
+
+	return InnerMalloc->Realloc(Original, Count, Alignment);
+}
+
+void* FCoverAllocationCounter::TryRealloc(void* Original, SIZE_T Count, uint32 Alignment)
+{
+	if (Count > 0)
+		CountAllocation();
+
+	return InnerMalloc->TryRealloc(Original, Count, Alignment);
+}
+
+void FCoverAllocationCounter::Free(void* Original)
+{
+	InnerMalloc->Free(Original);
+}
+
+SIZE_T FCoverAllocationCounter::QuantizeSize(SIZE_T Count, uint32 Alignment)
+{
+	return InnerMalloc->QuantizeSize(Count, Alignment);
+}
+
+bool FCoverAllocationCounter::GetAllocationSize(void* Original, SIZE_T& SizeOut)
+{
+	return InnerMalloc->GetAllocationSize(Original, SizeOut);
+}
+
+void FCoverAllocationCounter::Trim(bool bTrimThreadCaches)
+{
+	InnerMalloc->Trim(bTrimThreadCaches);
+}
+
+void FCoverAllocationCounter::SetupTLSCachesOnCurrentThread()
+{
+	InnerMalloc->SetupTLSCachesOnCurrentThread();
+}
+
+void FCoverAllocationCounter::ClearAndDisableTLSCachesOnCurrentThread()
+{
+	InnerMalloc->ClearAndDisableTLSCachesOnCurrentThread();
+}
+
+void FCoverAllocationCounter::InitializeStatsMetadata()
+{
+	InnerMalloc->InitializeStatsMetadata();
+}
+
+void FCoverAllocationCounter::UpdateStats()
+{
+	InnerMalloc->UpdateStats();
+}
+
+void FCoverAllocationCounter::GetAllocatorStats(FGenericMemoryStats& OutStats)
+{
+	InnerMalloc->GetAllocatorStats(OutStats);
+}
+
+void FCoverAllocationCounter::DumpAllocatorStats(FOutputDevice& Ar)
+{
+	InnerMalloc->DumpAllocatorStats(Ar);
+}
+
+bool FCoverAllocationCounter::IsInternallyThreadSafe() const
+{
+	return InnerMalloc->IsInternallyThreadSafe();
+}
+
+bool FCoverAllocationCounter::ValidateHeap()
+{
+	return InnerMalloc->ValidateHeap();
+}
+
+const TCHAR* FCoverAllocationCounter::GetDescriptiveName()
+{
+	return InnerMalloc->GetDescriptiveName();
+}
+
+FCoverAllocationScope::FCoverAllocationScope(FThreadSafeCounter& _Count)
+	: PreviousCount(GCoverAllocationCount)
+{
+	GCoverAllocationCount = &_Count;
+}
+
+FCoverAllocationScope::~FCoverAllocationScope()
+{
+	GCoverAllocationCount = PreviousCount;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#include "Debug/CoverDebugDrawBuffer.h"
+#include "DrawDebugHelpers.h"
+
+void FCoverDebugDrawBuffer::AddCommand(const FCoverDebugDrawCommand& Command)
+{
+	FScopeLock CommandsLock(&CommandsLockObject);
+	Commands.Add(Command);
+}
+
+void FCoverDebugDrawBuffer::AddSphere(const FVector& Center, float Radius, const FColor& Color, bool bPersistentLines, float LifeTime, float Thickness)
+{
+	AddCommand({ ECoverDebugDrawType::Sphere, Center, FVector::ZeroVector, Radius, Color, bPersistentLines, LifeTime, Thickness });
+}
+
+void FCoverDebugDrawBuffer::AddBox(const FVector& Center, const FVector& Extent, const FColor& Color, bool bPersistentLines, float LifeTime, float Thickness)
+{
+	AddCommand({ ECoverDebugDrawType::Box, Center, Extent, 0.0f, Color, bPersistentLines, LifeTime, Thickness });
+}
+
+void FCoverDebugDrawBuffer::AddDirectionalArrow(const FVector& Start, const FVector& End, float ArrowSize, const FColor& Color, bool bPersistentLines, float LifeTime, float Thickness)
+{
+	AddCommand({ ECoverDebugDrawType::DirectionalArrow, Start, End, ArrowSize, Color, bPersistentLines, LifeTime, Thickness });
+}
+
+void FCoverDebugDrawBuffer::Draw(UWorld* World) const
+{
+	check(IsInGameThread());
+
+	for (const FCoverDebugDrawCommand& command : Commands)
+	{
+		switch (command.Type)
+		{
+		case ECoverDebugDrawType::Sphere:
+			DrawDebugSphere(World, command.Start, command.Size, 4, command.Color, command.bPersistentLines, command.LifeTime, 0, command.Thickness);
+			break;
+		case ECoverDebugDrawType::Box:
+			DrawDebugBox(World, command.Start, command.End, command.Color, command.bPersistentLines, command.LifeTime, 0, command.Thickness);
+			break;
+		case ECoverDebugDrawType::DirectionalArrow:
+			DrawDebugDirectionalArrow(World, command.Start, command.End, command.Size, command.Color, command.bPersistentLines, command.LifeTime, 0, command.Thickness);
+			break;
+		default:
+			break;
+		}
+	}
+}
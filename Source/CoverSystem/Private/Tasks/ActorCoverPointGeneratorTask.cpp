@@ -1,10 +1,32 @@
 // Copyright (c) 2018 David Nadaski. All Rights Reserved.
 
 #include "Tasks/ActorCoverPointGeneratorTask.h"
+#include "CoverSystem.h"
+#include "Misc/Paths.h"
+#include "Async/ParallelFor.h"
+#include "Components/InstancedStaticMeshComponent.h"
 
-#if DEBUG_RENDERING
-#include "DrawDebugHelpers.h"
-#endif
+// Trace tags of the generator, named once rather than per trace.
+static const FName FindGroundPointTraceTag(TEXT("CoverGenerator_FindGroundPoint"));
+static const FName GenerateCoverPointsTraceTag(TEXT("CoverGenerator_GenerateCoverPoints"));
+
+SIZE_T FActorCoverGenerationScratch::GetAllocatedSize() const
+{
+	return StaticMeshes.GetAllocatedSize() + BoundingBoxes.GetAllocatedSize() + FreeGridPoints.GetAllocatedSize() + FinalGridPoints.GetAllocatedSize() + BoundingBoxMeshes.GetAllocatedSize() + InstancedMeshes.GetAllocatedSize() + ColumnHits.GetAllocatedSize()
+		+ FreeVoxels.GetAllocatedSize() + BlockedVoxels.GetAllocatedSize() + GatheredVoxels.GetAllocatedSize() + CoverPointCells.GetAllocatedSize() + CoverPoints.GetAllocatedSize();
+}
+
+FActorCoverGenerationScratch& FActorCoverGenerationScratch::Get()
+{
+	static thread_local FActorCoverGenerationScratch Scratch;
+	return Scratch;
+}
+
+FActorCoverGenerationScratch& FActorCoverGenerationScratch::GetForInstances()
+{
+	static thread_local FActorCoverGenerationScratch Scratch;
+	return Scratch;
+}
 
 FActorCoverPointGeneratorTask::FActorCoverPointGeneratorTask(
 	AActor* _Owner,
@@ -12,87 +34,130 @@ FActorCoverPointGeneratorTask::FActorCoverPointGeneratorTask(
 	float _BoundingBoxExpansion,
 	float _ScanGridUnit,
 	float _SmallestAgentHeight,
-	bool _bGeneratePerStaticMesh)
+	bool _bGeneratePerStaticMesh,
+	bool _bScanColumns)
 	: Owner(_Owner),
 	World(_World),
 	BoundingBoxExpansion(_BoundingBoxExpansion),
 	ScanGridUnit(_ScanGridUnit),
 	SmallestAgentHeight(_SmallestAgentHeight),
-	bGeneratePerStaticMesh(_bGeneratePerStaticMesh)
-{}
+	bGeneratePerStaticMesh(_bGeneratePerStaticMesh),
+	bScanColumns(_bScanColumns)
+{
+	GroundQueryParams.AddIgnoredActor(Owner);
+	GroundQueryParams.TraceTag = FindGroundPointTraceTag;
 
-const bool FActorCoverPointGeneratorTask::FindGroundPoint(FVector& OutGroundPoint, const FVector Location) const
+	CoverQueryParams.bFindInitialOverlaps = true;
+	CoverQueryParams.TraceTag = GenerateCoverPointsTraceTag;
+
+	// the instance data of an instanced static mesh is only safe to read on the game thread, which is where the task is created
+	if (bGeneratePerStaticMesh && IsValid(Owner))
+	{
+		TArray<UInstancedStaticMeshComponent*, TInlineAllocator<4>> instancedMeshes;
+		Owner->GetComponents<UInstancedStaticMeshComponent>(instancedMeshes);
+		for (const UInstancedStaticMeshComponent* instancedMesh : instancedMeshes)
+		{
+			TArray<FTransform>& transforms = InstanceTransforms.Add(instancedMesh);
+			transforms.SetNumUninitialized(instancedMesh->GetInstanceCount());
+			for (int32 iInstance = 0; iInstance < transforms.Num(); iInstance++)
+				instancedMesh->GetInstanceTransform(iInstance, transforms[iInstance], true);
+		}
+	}
+}
+
+template<typename QueriesType>
+const bool FActorCoverPointGeneratorTask::FindGroundPoint(FVector& OutGroundPoint, const FVector Location, QueriesType& Queries) const
 {
 	// trace downwards by grid size
 	FHitResult hit;
-	FCollisionQueryParams collQueryParams;
-	collQueryParams.bFindInitialOverlaps;
-	collQueryParams.AddIgnoredActor(Owner);
-	collQueryParams.TraceTag = "CoverGenerator_FindGroundPoint";
-
-	bool result = World->LineTraceSingleByChannel(hit, Location, Location - FVector(0.0f, 0.0f, ScanGridUnit), ECollisionChannel::ECC_GameTraceChannel1, collQueryParams);
+	bool result = Queries.LineTrace(hit, Location, Location - FVector(0.0f, 0.0f, ScanGridUnit), GroundQueryParams);
 
 	OutGroundPoint = hit.ImpactPoint;
 	return result && !hit.bStartPenetrating;
 }
 
-void FActorCoverPointGeneratorTask::GatherFreeGridPoints(TArray<FVector>& OutGridPoints, const FVector BlockedGridPoint, const TArray<FVector>& FreeGridPoints, const float NavPointEqualityTolerance)
+template<typename QueriesType>
+bool FActorCoverPointGeneratorTask::IsGroundPointFree(FHitResult& OutHit, const FVector& GroundPoint, QueriesType& Queries) const
 {
-	for (const FVector& gridPoint : FreeGridPoints)
-	{
-		if (FMath::IsNearlyEqual(gridPoint.X, BlockedGridPoint.X, NavPointEqualityTolerance)
-			&& FMath::IsNearlyEqual(gridPoint.Y, BlockedGridPoint.Y, NavPointEqualityTolerance)
-			&& FMath::IsNearlyEqual(gridPoint.Z, BlockedGridPoint.Z, NavPointEqualityTolerance))
-		{
-			bool bUnique = true;
-			for (const FVector& coverPoint : OutGridPoints)
-				if (FMath::IsNearlyEqual(gridPoint.X, coverPoint.X, NavPointEqualityTolerance)
-					&& FMath::IsNearlyEqual(gridPoint.Y, coverPoint.Y, NavPointEqualityTolerance)
-					&& FMath::IsNearlyEqual(gridPoint.Z, coverPoint.Z, NavPointEqualityTolerance))
-				{
-					bUnique = false;
-					break;
-				}
+	// arbitrarily set minimum cover height to be half of SmallestAgentHeight
+	const float minCoverHeight = SmallestAgentHeight * 0.5f;
 
-			if (bUnique)
-				OutGridPoints.Add(gridPoint);
-		}
-	}
+	// start location: ground position + minCoverHeight on the Z-axis
+	// end location: ground position + SmallestAgentHeight on the Z-axis
+	const bool traceResult = Queries.LineTrace(OutHit, GroundPoint + FVector(0.0f, 0.0f, minCoverHeight), GroundPoint + FVector(0.0f, 0.0f, SmallestAgentHeight), CoverQueryParams);
+	return !traceResult && !OutHit.bStartPenetrating;
+}
+
+// Cell of the spatial hash that the cover points of an actor are deduplicated with.
+static FIntVector GetCoverPointCell(const FVector& Location, float CellSize)
+{
+	return FIntVector(FMath::FloorToInt(Location.X / CellSize), FMath::FloorToInt(Location.Y / CellSize), FMath::FloorToInt(Location.Z / CellSize));
 }
 
-void FActorCoverPointGeneratorTask::GenerateCoverInBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors, FBox& Bounds)
+template<typename QueriesType>
+void FActorCoverPointGeneratorTask::GatherGridPoints(const FBox& Bounds, FActorCoverGenerationScratch& Scratch, QueriesType& Queries)
 {
 	// profiling
 	SCOPE_CYCLE_COUNTER(STAT_GenerateCoverInBounds);
 	INC_DWORD_STAT(STAT_GenerateCoverHistoricalCount);
 	SCOPE_SECONDS_ACCUMULATOR(STAT_GenerateCoverAverageTime);
 
-	// expand the bounding box by a predetermined amount
-	Bounds = Bounds.ExpandBy(ScanGridUnit * BoundingBoxExpansion);
-
-	// arbitrarily set minimum cover height to be half of SmallestAgentHeight
-	const float minCoverHeight = SmallestAgentHeight * 0.5f;
 	const float boundsLengthX = Bounds.Max.X - Bounds.Min.X;
 	const float boundsLengthY = Bounds.Max.Y - Bounds.Min.Y;
 	const float boundsLengthZ = Bounds.Max.Z - Bounds.Min.Z;
 	const int gridCountX = FMath::FloorToInt(boundsLengthX / ScanGridUnit) + 2;
 	const int gridCountY = FMath::FloorToInt(boundsLengthY / ScanGridUnit) + 2;
 	const int gridCountZ = FMath::FloorToInt(boundsLengthZ / ScanGridUnit) + 2;
-	const FVector navProjectionExtent = FVector(ScanGridUnit * 5, ScanGridUnit * 5, ScanGridUnit * 1.5f);
-	const float navPointEqualityTolerance = ScanGridUnit * 0.5f;
 
 #if DEBUG_RENDERING
 	if (bDebugDraw)
-		DrawDebugBox(World, Bounds.GetCenter(), Bounds.GetExtent(), FColor::Orange, false, 1.0f);
+		DebugDraw.AddBox(Bounds.GetCenter(), Bounds.GetExtent(), FColor::Orange, false, 1.0f);
 #endif
 
+	// the ground points are indexed by the voxel they fall into; they may be up to a grid unit below the bottom of the grid, hence the extra layer
+	const int32 voxelCountZ = gridCountZ + 1;
+	auto GetVoxelIndex = [&](int32 X, int32 Y, int32 Z)
+	{
+		return (X * gridCountY + Y) * voxelCountZ + Z;
+	};
+	auto GetVoxel = [&](const FVector& GroundPoint)
+	{
+		return FIntVector(
+			FMath::Clamp(FMath::RoundToInt((GroundPoint.X - Bounds.Min.X) / ScanGridUnit), 0, gridCountX - 1),
+			FMath::Clamp(FMath::RoundToInt((GroundPoint.Y - Bounds.Min.Y) / ScanGridUnit), 0, gridCountY - 1),
+			FMath::Clamp(FMath::RoundToInt((GroundPoint.Z - Bounds.Min.Z) / ScanGridUnit) + 1, 0, voxelCountZ - 1));
+	};
+
+	TArray<FVector>& freeGridPoints = Scratch.FreeGridPoints;
+	TArray<int32>& freeVoxels = Scratch.FreeVoxels;
+	TBitArray<>& blockedVoxels = Scratch.BlockedVoxels;
+	freeGridPoints.Reset();
+	freeVoxels.Reset();
+	freeVoxels.AddUninitialized(gridCountX * gridCountY * voxelCountZ);
+	for (int32& freeVoxel : freeVoxels)
+		freeVoxel = INDEX_NONE;
+	blockedVoxels.Init(false, freeVoxels.Num());
+
+	// sorts a ground point into a free or a blocked voxel
 	FHitResult hit;
-	FCollisionQueryParams collQueryParams;
-	collQueryParams.bFindInitialOverlaps = true;
-	collQueryParams.TraceTag = "CoverGenerator_GenerateCoverPoints";
+	auto ScanGroundPoint = [&](FVector GroundPoint)
+	{
+		GroundPoint.Z += 1.0f; // otherwise we're starting the next ray from inside the ground
 
-	TArray<FVector> freeGridPoints;
-	TArray<FVector> blockedGridPoints;
+		const FIntVector voxel = GetVoxel(GroundPoint);
+		const int32 voxelIdx = GetVoxelIndex(voxel.X, voxel.Y, voxel.Z);
+		if (IsGroundPointFree(hit, GroundPoint, Queries))
+		{
+			// encountered a non-blocking hit; the first free ground point of a voxel stands for all of them
+			if (freeVoxels[voxelIdx] == INDEX_NONE)
+				freeVoxels[voxelIdx] = freeGridPoints.Add(GroundPoint);
+		}
+		else
+		{
+			// encountered a blocking hit
+			blockedVoxels[voxelIdx] = true;
+		}
+	};
 
 	// divide Bounds into a 3D grid and iterate over all the grid points
 	float traceX, traceY, traceZ;
@@ -102,59 +167,328 @@ void FActorCoverPointGeneratorTask::GenerateCoverInBounds(TArray<FDTOCoverData>&
 		for (int y = 0; y < gridCountY; y++)
 		{
 			traceY = Bounds.Min.Y + (y * ScanGridUnit);
+			if (bScanColumns)
+			{
+				// find every surface of the column at once, over the same height range as the traces of the grid points
+				const FVector columnTop(traceX, traceY, Bounds.Min.Z + ((gridCountZ - 1) * ScanGridUnit));
+				const FVector columnBottom(traceX, traceY, Bounds.Min.Z - ScanGridUnit);
+				if (!Queries.LineTraceMulti(Scratch.ColumnHits, columnTop, columnBottom, GroundQueryParams))
+					continue;
+
+				// the surfaces of a complex collision mesh below the first one that the column enters aren't reported, so such columns are scanned a grid point at a time instead
+				if (!Queries.HitsComplexAsSimple(Scratch.ColumnHits))
+				{
+					// only the surfaces facing up are ground; the rest are the backfaces of meshes
+					for (const FHitResult& columnHit : Scratch.ColumnHits)
+						if (!columnHit.bStartPenetrating && columnHit.ImpactNormal.Z > 0.0f)
+							ScanGroundPoint(columnHit.ImpactPoint);
+
+					continue;
+				}
+			}
+
 			for (int z = 0; z < gridCountZ; z++)
 			{
 				traceZ = Bounds.Min.Z + (z * ScanGridUnit);
 
 				// find the ground
 				FVector groundPoint;
-				if (!FindGroundPoint(groundPoint, FVector(traceX, traceY, traceZ)))
+				if (!FindGroundPoint(groundPoint, FVector(traceX, traceY, traceZ), Queries))
 					continue;
-				groundPoint.Z += 1.0f; // otherwise we're starting the next ray from inside the ground
-
-				// start location: ground position + minCoverHeight on the Z-axis
-				// end location: ground position + SmallestAgentHeight on the Z-axis
-				bool traceResult = World->LineTraceSingleByChannel(hit, groundPoint + FVector(0.0f, 0.0f, minCoverHeight), groundPoint + FVector(0.0f, 0.0f, SmallestAgentHeight), ECollisionChannel::ECC_GameTraceChannel1, collQueryParams);
-				if (!traceResult && !hit.bStartPenetrating)
-					// encountered a non-blocking hit
-					freeGridPoints.Add(groundPoint);
-				else
-					// encountered a blocking hit
-					blockedGridPoints.Add(groundPoint);
+
+				ScanGroundPoint(groundPoint);
 			}
 		}
 	}
 
-	TArray<FVector> finalGridPoints;
+	// find the nearest free grid points to each blocked grid point, i.e. the free voxels around each blocked one, each of them only once
+	TBitArray<>& gatheredVoxels = Scratch.GatheredVoxels;
+	TArray<FVector>& finalGridPoints = Scratch.FinalGridPoints;
+	finalGridPoints.Reset();
+	gatheredVoxels.Init(false, freeVoxels.Num());
+	for (int32 x = 0; x < gridCountX; x++)
+		for (int32 y = 0; y < gridCountY; y++)
+			for (int32 z = 0; z < voxelCountZ; z++)
+			{
+				if (!blockedVoxels[GetVoxelIndex(x, y, z)])
+					continue;
+
+				for (int32 neighbourX = FMath::Max(0, x - 1); neighbourX <= FMath::Min(gridCountX - 1, x + 1); neighbourX++)
+					for (int32 neighbourY = FMath::Max(0, y - 1); neighbourY <= FMath::Min(gridCountY - 1, y + 1); neighbourY++)
+						for (int32 neighbourZ = FMath::Max(0, z - 1); neighbourZ <= FMath::Min(voxelCountZ - 1, z + 1); neighbourZ++)
+						{
+							const int32 neighbourIdx = GetVoxelIndex(neighbourX, neighbourY, neighbourZ);
+							if (freeVoxels[neighbourIdx] == INDEX_NONE || gatheredVoxels[neighbourIdx])
+								continue;
+
+							gatheredVoxels[neighbourIdx] = true;
+							finalGridPoints.Add(freeGridPoints[freeVoxels[neighbourIdx]]);
+						}
+			}
+}
+
+template<typename QueriesType>
+void FActorCoverPointGeneratorTask::GenerateCoverInBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FBox& Bounds, FActorCoverGenerationScratch& Scratch, QueriesType& Queries)
+{
+	GatherGridPoints(Bounds, Scratch, Queries);
+	ProjectGridPoints(OutCoverPointsOfActors, Scratch.FinalGridPoints, Scratch, Queries);
+}
+
+template<typename QueriesType>
+void FActorCoverPointGeneratorTask::ProjectGridPoints(TArray<FDTOCoverData>& OutCoverPointsOfActors, const TArray<FVector>& GridPoints, FActorCoverGenerationScratch& Scratch, QueriesType& Queries)
+{
+	const FVector navProjectionExtent = FVector(ScanGridUnit * 5, ScanGridUnit * 5, ScanGridUnit * 1.5f);
+	const float navPointEqualityTolerance = ScanGridUnit * 0.5f;
 
-	// find the nearest free grid points to each blocked grid point and project them onto the navmesh
-	for (const FVector blockedGridPoint : blockedGridPoints)
-		for (int x = -1; x <= 1; x++)
-			for (int y = -1; y <= 1; y++)
-				for (int z = -1; z <= 1; z++)
-					GatherFreeGridPoints(finalGridPoints, FVector(blockedGridPoint.X + ScanGridUnit * x, blockedGridPoint.Y + ScanGridUnit * y, blockedGridPoint.Z + ScanGridUnit * z), freeGridPoints, navPointEqualityTolerance);
+	// the cover points found so far, e.g. in the bounds of the other static meshes of the actor, go into a spatial hash for filtering out near-duplicates
+	TMultiMap<FIntVector, int32>& coverPointCells = Scratch.CoverPointCells;
+	coverPointCells.Reset();
+	for (int32 iCoverPoint = 0; iCoverPoint < OutCoverPointsOfActors.Num(); iCoverPoint++)
+		coverPointCells.Add(GetCoverPointCell(OutCoverPointsOfActors[iCoverPoint].Location, navPointEqualityTolerance), iCoverPoint);
 
-	// filter out any near-duplicates, i.e. vectors that are too close to one another
-	FNavLocation navLocation;
-	bool bUnique;
-	for (FVector finalGridPoint : finalGridPoints)
+	// project the gathered grid points onto the navmesh and filter out any near-duplicates, i.e. vectors that are too close to one another
+	// points within the tolerance of each other are at most one cell apart in the hash
+	FVector navLocation;
+	for (const FVector& gridPoint : GridPoints)
+	{
+		if (!Queries.ProjectPointToNavigation(navLocation, gridPoint, navProjectionExtent))
+			continue;
+
+		const FIntVector cell = GetCoverPointCell(navLocation, navPointEqualityTolerance);
+		bool bUnique = true;
+		for (int32 x = -1; x <= 1 && bUnique; x++)
+			for (int32 y = -1; y <= 1 && bUnique; y++)
+				for (int32 z = -1; z <= 1 && bUnique; z++)
+					for (TMultiMap<FIntVector, int32>::TConstKeyIterator It(coverPointCells, cell + FIntVector(x, y, z)); It; ++It)
+					{
+						const FVector& coverPointLocation = OutCoverPointsOfActors[It.Value()].Location;
+						if (FMath::IsNearlyEqual(navLocation.X, coverPointLocation.X, navPointEqualityTolerance)
+							&& FMath::IsNearlyEqual(navLocation.Y, coverPointLocation.Y, navPointEqualityTolerance)
+							&& FMath::IsNearlyEqual(navLocation.Z, coverPointLocation.Z, navPointEqualityTolerance))
+						{
+							bUnique = false;
+							break;
+						}
+					}
+
+		if (bUnique)
+			coverPointCells.Add(cell, OutCoverPointsOfActors.Add(FDTOCoverData(Owner, navLocation, bOwnerIsForceField)));
+	}
+}
+
+template void FActorCoverPointGeneratorTask::GenerateCoverInBounds<FCoverSceneQueries>(TArray<FDTOCoverData>&, const FBox&, FActorCoverGenerationScratch&, FCoverSceneQueries&);
+template void FActorCoverPointGeneratorTask::GenerateCoverInBounds<FCoverSnapshotQueries>(TArray<FDTOCoverData>&, const FBox&, FActorCoverGenerationScratch&, FCoverSnapshotQueries&);
+template void FActorCoverPointGeneratorTask::GenerateCoverInBounds<FCoverReplayQueries>(TArray<FDTOCoverData>&, const FBox&, FActorCoverGenerationScratch&, FCoverReplayQueries&);
+
+template<typename QueriesType>
+void FActorCoverPointGeneratorTask::GenerateCoverFromTemplate(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FCoverMeshTemplate& Template, const FTransform& Transform, FActorCoverGenerationScratch& Scratch, QueriesType& Queries)
+{
+	// profiling
+	SCOPE_CYCLE_COUNTER(STAT_GenerateCoverInBounds);
+	INC_DWORD_STAT(STAT_CoverMeshTemplatesReused);
+
+	// the candidates are only valid where this instance's surroundings let them be: there's ground under them and none of its neighbours is in the way
+	TArray<FVector>& finalGridPoints = Scratch.FinalGridPoints;
+	finalGridPoints.Reset();
+	FVector groundPoint;
+	FHitResult hit;
+	for (const FVector& candidate : Template.Candidates)
+	{
+		if (!FindGroundPoint(groundPoint, Transform.TransformPosition(candidate) + FVector(0.0f, 0.0f, ScanGridUnit * 0.5f), Queries))
+			continue;
+		groundPoint.Z += 1.0f; // otherwise we're starting the next ray from inside the ground
+
+		if (IsGroundPointFree(hit, groundPoint, Queries))
+			finalGridPoints.Add(groundPoint);
+	}
+
+	ProjectGridPoints(OutCoverPointsOfActors, finalGridPoints, Scratch, Queries);
+}
+
+template<typename QueriesType>
+void FActorCoverPointGeneratorTask::ScanBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FBox& Bounds, FActorCoverGenerationScratch& Scratch, QueriesType& Queries)
+{
+	if (QueryRecording.IsValid())
+	{
+		TCoverRecordingQueries<QueriesType> recordingQueries(Queries, *QueryRecording);
+		GenerateCoverInBounds(OutCoverPointsOfActors, Bounds, Scratch, recordingQueries);
+	}
+	else
 	{
-		if (UNavigationSystemV1::GetCurrent(World)->ProjectPointToNavigation(finalGridPoint, navLocation, navProjectionExtent))
+		GenerateCoverInBounds(OutCoverPointsOfActors, Bounds, Scratch, Queries);
+	}
+}
+
+TSharedPtr<const FCoverMeshTemplate, ESPMode::ThreadSafe> FActorCoverPointGeneratorTask::BuildMeshTemplate(const FCoverMeshTemplateKey& TemplateKey, const FBox& Bounds, UStaticMeshComponent* StaticMesh, int32 InstanceIndex, const FTransform& Transform, FActorCoverGenerationScratch& Scratch)
+{
+	// the ground under the middle of the mesh in place, so that the candidates are at the same height relative to the mesh as the ground points of its instances
+	FCoverSceneQueries sceneQueries(World, ECollisionChannel::ECC_GameTraceChannel1);
+	const FVector boundsCenter = Bounds.GetCenter();
+	FHitResult groundHit;
+	const float groundZ = sceneQueries.LineTrace(groundHit, FVector(boundsCenter.X, boundsCenter.Y, Bounds.Max.Z), FVector(boundsCenter.X, boundsCenter.Y, Bounds.Min.Z - ScanGridUnit), GroundQueryParams)
+		? groundHit.ImpactPoint.Z : Bounds.Min.Z;
+
+	// the scan only sees the mesh and the ground, hence every blocked grid point is blocked by the mesh itself; it doesn't query the world, so it isn't recorded either
+	const FBox bounds = Bounds.ExpandBy(ScanGridUnit * BoundingBoxExpansion);
+	FCoverCollisionSnapshot meshSnapshot(World, ECollisionChannel::ECC_GameTraceChannel1, false);
+	if (!meshSnapshot.CaptureComponent(StaticMesh, InstanceIndex, Transform, bounds.ExpandBy(FVector(ScanGridUnit, ScanGridUnit, ScanGridUnit + SmallestAgentHeight)), groundZ))
+		return nullptr;
+
+	FCoverSnapshotQueries meshQueries(World, meshSnapshot);
+	GatherGridPoints(bounds, Scratch, meshQueries);
+
+	TSharedRef<FCoverMeshTemplate, ESPMode::ThreadSafe> meshTemplate = MakeShared<FCoverMeshTemplate, ESPMode::ThreadSafe>();
+	meshTemplate->Candidates.Reserve(Scratch.FinalGridPoints.Num());
+	for (const FVector& gridPoint : Scratch.FinalGridPoints)
+		meshTemplate->Candidates.Add(Transform.InverseTransformPosition(gridPoint));
+
+	// another instance of the mesh may have added its template in the meantime, which is the one that's kept
+	MeshTemplates->Add(TemplateKey, meshTemplate);
+	return MeshTemplates->Find(TemplateKey);
+}
+
+void FActorCoverPointGeneratorTask::GenerateMeshCover(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FBox& Bounds, UStaticMeshComponent* StaticMesh, int32 InstanceIndex, const FTransform& Transform, FActorCoverGenerationScratch& Scratch)
+{
+	FCoverSceneQueries sceneQueries(World, ECollisionChannel::ECC_GameTraceChannel1);
+
+	// instances of a static mesh only validate the candidates of its template, unless they're tilted, which would tilt the ground around them as well
+	// the template is scanned from the mesh on its own the first time round, so that the first instance's neighbours don't block any of its candidates for the others
+	if (bUseMeshTemplates && StaticMesh && StaticMesh->GetStaticMesh()
+		&& FMath::IsNearlyEqual(Transform.GetRotation().GetUpVector().Z, 1.0f, UprightTolerance))
+	{
+		const FCoverMeshTemplateKey templateKey(StaticMesh->GetStaticMesh(), Transform.GetScale3D(), ScanGridUnit, SmallestAgentHeight, BoundingBoxExpansion, bScanColumns);
+		TSharedPtr<const FCoverMeshTemplate, ESPMode::ThreadSafe> meshTemplate = MeshTemplates->Find(templateKey);
+		if (!meshTemplate.IsValid())
+			meshTemplate = BuildMeshTemplate(templateKey, Bounds, StaticMesh, InstanceIndex, Transform, Scratch);
+
+		if (meshTemplate.IsValid())
 		{
-			bUnique = true;
-			for (const FDTOCoverData coverPoint : OutCoverPointsOfActors)
-				if (FMath::IsNearlyEqual(navLocation.Location.X, coverPoint.Location.X, navPointEqualityTolerance)
-					&& FMath::IsNearlyEqual(navLocation.Location.Y, coverPoint.Location.Y, navPointEqualityTolerance)
-					&& FMath::IsNearlyEqual(navLocation.Location.Z, coverPoint.Location.Z, navPointEqualityTolerance))
-				{
-					bUnique = false;
-					break;
-				}
+			if (QueryRecording.IsValid())
+			{
+				// the candidates are recorded in place, as the mesh isn't around when the scan is replayed
+				FCoverRecordedScan& recordedScan = QueryRecording->Actor.Scans.AddDefaulted_GetRef();
+				recordedScan.bTemplate = true;
+				recordedScan.InstanceIndex = InstanceIndex;
+				recordedScan.Candidates.Reserve(meshTemplate->Candidates.Num());
+				for (const FVector& candidate : meshTemplate->Candidates)
+					recordedScan.Candidates.Add(Transform.TransformPosition(candidate));
+
+				TCoverRecordingQueries<FCoverSceneQueries> recordingQueries(sceneQueries, *QueryRecording);
+				GenerateCoverFromTemplate(OutCoverPointsOfActors, *meshTemplate, Transform, Scratch, recordingQueries);
+			}
+			else
+			{
+				GenerateCoverFromTemplate(OutCoverPointsOfActors, *meshTemplate, Transform, Scratch, sceneQueries);
+			}
+
+			return;
+		}
+	}
+
+	// expand the bounding box by a predetermined amount
+	const FBox bounds = Bounds.ExpandBy(ScanGridUnit * BoundingBoxExpansion);
+
+	if (QueryRecording.IsValid())
+	{
+		FCoverRecordedScan& recordedScan = QueryRecording->Actor.Scans.AddDefaulted_GetRef();
+		recordedScan.Bounds = bounds;
+		recordedScan.InstanceIndex = InstanceIndex;
+	}
+
+	// capture the collision within reach of the grid's traces once, then trace that instead of the physics scene
+	if (bUseCollisionSnapshot)
+	{
+		FCoverCollisionSnapshot collisionSnapshot(World, ECollisionChannel::ECC_GameTraceChannel1, bVerifyCollisionSnapshot);
+		collisionSnapshot.Capture(bounds.ExpandBy(FVector(ScanGridUnit, ScanGridUnit, ScanGridUnit + SmallestAgentHeight)));
+
+		FCoverSnapshotQueries snapshotQueries(World, collisionSnapshot);
+		ScanBounds(OutCoverPointsOfActors, bounds, Scratch, snapshotQueries);
+	}
+	else
+	{
+		ScanBounds(OutCoverPointsOfActors, bounds, Scratch, sceneQueries);
+	}
+}
+
+void FActorCoverPointGeneratorTask::GenerateInstancedMeshCover(TArray<FDTOCoverData>& OutCoverPointsOfActors, UInstancedStaticMeshComponent* InstancedMesh)
+{
+	// instanced static meshes that have been added since the task was created are left to the next generation
+	const TArray<FTransform>* instanceTransforms = InstanceTransforms.Find(InstancedMesh);
+	if (!instanceTransforms || !InstancedMesh->GetStaticMesh())
+		return;
+
+	// every instance is scanned in its own bounds rather than in the bounds of all of them, on its own thread's scratch; recorded queries have to stay in order though
+	const FBox meshBounds = InstancedMesh->GetStaticMesh()->GetBounds().GetBox();
+	FCriticalSection coverPointsLockObject;
+	ParallelFor(instanceTransforms->Num(), [&](int32 InstanceIndex)
+	{
+		const FTransform& instanceTransform = (*instanceTransforms)[InstanceIndex];
+		const FBox bounds = meshBounds.TransformBy(instanceTransform);
+		if (ScanGridUnit > bounds.Max.X - bounds.Min.X
+			|| ScanGridUnit > bounds.Max.Y - bounds.Min.Y
+			|| ScanGridUnit > bounds.Max.Z - bounds.Min.Z)
+			return;
+
+		FActorCoverGenerationScratch& scratch = FActorCoverGenerationScratch::GetForInstances();
+		const SIZE_T scratchSize = scratch.GetAllocatedSize();
+		TArray<FDTOCoverData>& instanceCoverPoints = scratch.CoverPoints;
+		instanceCoverPoints.Reset();
+		GenerateMeshCover(instanceCoverPoints, bounds, InstancedMesh, InstanceIndex, instanceTransform, scratch);
 
-			if (bUnique)
-				OutCoverPointsOfActors.Add(FDTOCoverData(Owner, navLocation.Location, ECC_GameTraceChannel2 == Owner->GetRootComponent()->GetCollisionObjectType()));
+		// tagged with the instance, so that removing it only has to remove its own cover points
+		for (FDTOCoverData& instanceCoverPoint : instanceCoverPoints)
+		{
+			instanceCoverPoint.InstancedMesh = InstancedMesh;
+			instanceCoverPoint.InstanceIndex = InstanceIndex;
 		}
+
+		const int64 scratchGrowth = (int64)scratch.GetAllocatedSize() - (int64)scratchSize;
+		if (scratchGrowth > 0)
+			INC_MEMORY_STAT_BY(STAT_CoverScratchMemory, scratchGrowth);
+
+		FScopeLock CoverPointsLock(&coverPointsLockObject);
+		OutCoverPointsOfActors.Append(instanceCoverPoints);
+	}, QueryRecording.IsValid());
+}
+
+bool FActorCoverPointGeneratorTask::Replay(const FCoverQueryRecording& Recording, TArray<FCoverReplayedPoint>& OutCoverPoints)
+{
+	const FCoverRecordedActor& recordedActor = Recording.Actor;
+	if (Recording.IsTileRecording() || !Recording.Objects.IsValidIndex(recordedActor.OwnerId))
+		return false;
+
+	// a task of its own that never touches the world or the cover system; the scans are already expanded, and the templates already placed
+	FActorCoverPointGeneratorTask task(nullptr, nullptr, 0.0f, recordedActor.ScanGridUnit, recordedActor.SmallestAgentHeight, false, recordedActor.bScanColumns);
+	FActorCoverGenerationScratch& scratch = FActorCoverGenerationScratch::Get();
+	FCoverReplayQueries replayQueries(Recording);
+	TArray<FDTOCoverData> coverPoints;
+	TArray<FDTOCoverData> instanceCoverPoints;
+	for (const FCoverRecordedScan& recordedScan : recordedActor.Scans)
+	{
+		// same as GenerateInstancedMeshCover(), the cover points of an instance are only deduplicated among themselves
+		const bool bInstance = recordedScan.InstanceIndex != INDEX_NONE;
+		instanceCoverPoints.Reset();
+		TArray<FDTOCoverData>& scanCoverPoints = bInstance ? instanceCoverPoints : coverPoints;
+		if (recordedScan.bTemplate)
+		{
+			FCoverMeshTemplate placedTemplate;
+			placedTemplate.Candidates = recordedScan.Candidates;
+			task.GenerateCoverFromTemplate(scanCoverPoints, placedTemplate, FTransform::Identity, scratch, replayQueries);
+		}
+		else
+		{
+			task.GenerateCoverInBounds(scanCoverPoints, recordedScan.Bounds, scratch, replayQueries);
+		}
+
+		if (bInstance)
+			coverPoints.Append(instanceCoverPoints);
 	}
+
+	OutCoverPoints.Reserve(OutCoverPoints.Num() + coverPoints.Num());
+	for (const FDTOCoverData& coverPoint : coverPoints)
+		OutCoverPoints.Add(FCoverReplayedPoint(coverPoint.Location, recordedActor.OwnerId));
+
+	return replayQueries.GetMismatchCount() == 0 && replayQueries.IsFinished();
 }
 
 void FActorCoverPointGeneratorTask::DoWork()
@@ -168,26 +502,59 @@ void FActorCoverPointGeneratorTask::DoWork()
 	if (!IsValid(Owner))
 		return;
 
-#if DEBUG_RENDERING
+	// the cover points follow the actor from where it's been scanned, see UCoverSubsystem::MoveCoverPointsOfObject()
+	const FTransform scanTransform = Owner->GetActorTransform();
+
 	if (UCoverSubsystem* CoverSystem = World->GetSubsystem<UCoverSubsystem>())
 	{
+#if DEBUG_RENDERING
 		bDebugDraw = CoverSystem->bDebugDraw;
+#endif
+		bUseCollisionSnapshot = CoverSystem->bUseCollisionSnapshots;
+		bVerifyCollisionSnapshot = CoverSystem->bVerifyCollisionSnapshots;
+
+		// along with the queries go the scans and the parameters that they're made from, so that the actor can be replayed, see Replay()
+		if (!CoverSystem->CoverQueryRecordingDirectory.IsEmpty())
+		{
+			QueryRecording = MakeUnique<FCoverQueryRecording>();
+			FCoverRecordedActor& recordedActor = QueryRecording->Actor;
+			recordedActor.OwnerId = QueryRecording->AddObject(Owner);
+			recordedActor.ScanGridUnit = ScanGridUnit;
+			recordedActor.SmallestAgentHeight = SmallestAgentHeight;
+			recordedActor.bScanColumns = bScanColumns;
+		}
+
+		bUseMeshTemplates = CoverSystem->bUseMeshCoverTemplates;
+		MeshTemplates = &CoverSystem->GetMeshTemplates();
 	}
 	else
 	{
 		return;
 	}
-#endif
 
-	TArray<FDTOCoverData> coverPoints;
-	TArray<FBox> everyBoundingBox;
+	FActorCoverGenerationScratch& scratch = FActorCoverGenerationScratch::Get();
+	const SIZE_T scratchSize = scratch.GetAllocatedSize();
+	TArray<FDTOCoverData>& coverPoints = scratch.CoverPoints;
+	TArray<FBox>& everyBoundingBox = scratch.BoundingBoxes;
+	TArray<UStaticMeshComponent*>& boundingBoxMeshes = scratch.BoundingBoxMeshes;
+	coverPoints.Reset();
+	everyBoundingBox.Reset();
+	boundingBoxMeshes.Reset();
+	scratch.InstancedMeshes.Reset();
 
 	if (bGeneratePerStaticMesh) // collect the bounding boxes of all the static meshes of Owner
 	{
-		TArray<UStaticMeshComponent*> staticMeshes;
+		TArray<UStaticMeshComponent*>& staticMeshes = scratch.StaticMeshes;
 		Owner->GetComponents<UStaticMeshComponent>(staticMeshes);
 		for (UStaticMeshComponent* staticMesh : staticMeshes)
 		{
+			// the bounds of an instanced static mesh are those of all of its instances, which are scanned one by one instead
+			if (UInstancedStaticMeshComponent* instancedMesh = Cast<UInstancedStaticMeshComponent>(staticMesh))
+			{
+				scratch.InstancedMeshes.Add(instancedMesh);
+				continue;
+			}
+
 			FBox bounds = staticMesh->Bounds.GetBox();
 			if (ScanGridUnit > bounds.Max.X - bounds.Min.X
 				|| ScanGridUnit > bounds.Max.Y - bounds.Min.Y
@@ -195,6 +562,7 @@ void FActorCoverPointGeneratorTask::DoWork()
 				continue;
 
 			everyBoundingBox.Add(bounds);
+			boundingBoxMeshes.Add(staticMesh);
 		}
 	}
 	else // only need the Owner's bounding box
@@ -206,15 +574,47 @@ void FActorCoverPointGeneratorTask::DoWork()
 			return;
 
 		everyBoundingBox.Add(bounds);
+
+		// an actor made up of a single static mesh, e.g. a crate, may use the mesh's template too
+		TArray<UPrimitiveComponent*, TInlineAllocator<2>> primitives;
+		Owner->GetComponents<UPrimitiveComponent>(primitives);
+		UStaticMeshComponent* staticMesh = primitives.Num() == 1 ? Cast<UStaticMeshComponent>(primitives[0]) : nullptr;
+		boundingBoxMeshes.Add(staticMesh && !staticMesh->IsA<UInstancedStaticMeshComponent>() ? staticMesh : nullptr);
 	}
 
 	// generate cover using the bounding box(es)
-	for (FBox boundingBox : everyBoundingBox)
-		GenerateCoverInBounds(coverPoints, boundingBox);
+	bOwnerIsForceField = ECC_GameTraceChannel2 == Owner->GetRootComponent()->GetCollisionObjectType();
+	for (int32 iBoundingBox = 0; iBoundingBox < everyBoundingBox.Num(); iBoundingBox++)
+	{
+		UStaticMeshComponent* staticMesh = boundingBoxMeshes[iBoundingBox];
+		GenerateMeshCover(coverPoints, everyBoundingBox[iBoundingBox], staticMesh, INDEX_NONE, staticMesh ? staticMesh->GetComponentTransform() : FTransform::Identity, scratch);
+	}
+
+	for (UInstancedStaticMeshComponent* instancedMesh : scratch.InstancedMeshes)
+		GenerateInstancedMeshCover(coverPoints, instancedMesh);
+
+	if (QueryRecording.IsValid())
+	{
+		const FString filePath = FPaths::Combine(World->GetSubsystem<UCoverSubsystem>()->CoverQueryRecordingDirectory, FString::Printf(TEXT("Actor_%s.coverqueries"), *Owner->GetName()));
+		if (!QueryRecording->SaveToFile(filePath))
+			COVER_LOG(Warning, TEXT("Couldn't save the cover queries of %s to %s."), *Owner->GetName(), *filePath);
+	}
+
+	// allocation report of the actor: once the scratch of the thread has grown to fit, scanning an actor doesn't allocate
+	const int64 scratchGrowth = (int64)scratch.GetAllocatedSize() - (int64)scratchSize;
+	if (scratchGrowth > 0)
+	{
+		INC_DWORD_STAT(STAT_CoverAllocatingTaskCount);
+		INC_MEMORY_STAT_BY(STAT_CoverScratchMemory, scratchGrowth);
+	}
+	COVER_LOG(Verbose, TEXT("Cover generation of %s: %d cover points, scratch grown by %lld bytes."), *Owner->GetName(), coverPoints.Num(), scratchGrowth);
 
 	if (UCoverSubsystem* CoverSystem = World->GetSubsystem<UCoverSubsystem>())
 	{
-		CoverSystem->AddCoverPoints(coverPoints);
+		CoverSystem->AddCoverPointsOfObject(Owner, scanTransform, coverPoints);
+#if DEBUG_RENDERING
+		CoverSystem->QueueDebugDraw(MoveTemp(DebugDraw));
+#endif
 	}
 	else
 	{
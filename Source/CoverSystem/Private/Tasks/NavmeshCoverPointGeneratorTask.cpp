@@ -1,172 +1,685 @@
 // Copyright (c) 2018 David Nadaski. All Rights Reserved.
 
 #include "Tasks/NavmeshCoverPointGeneratorTask.h"
+#include "CoverSystem.h"
 #include "LandscapeProxy.h"
 #include "NavMesh/RecastNavMesh.h"
 #include "Detour/DetourNavMesh.h"
+#include "Async/ParallelFor.h"
+#include "HAL/Event.h"
+#include "Misc/Paths.h"
 
-#if DEBUG_RENDERING
-#include "DrawDebugHelpers.h"
-#endif
+// Trace tag of every trace of the generator, named once rather than per trace.
+static const FName ScanForCoverTraceTag(TEXT("CoverGenerator_ScanForCoverNavMeshProjection"));
+
+SIZE_T FNavmeshCoverGenerationScratch::GetAllocatedSize() const
+{
+	SIZE_T allocatedSize = Edges.GetAllocatedSize() + Chains.GetAllocatedSize() + Weld.GetAllocatedSize()
+		+ ChunkProbes.GetAllocatedSize() + ChunkCoverPoints.GetAllocatedSize() + Landscapes.GetAllocatedSize() + ProbeGaps.GetAllocatedSize();
+	for (const FNavmeshBoundaryChain& chain : Chains)
+		allocatedSize += chain.Vertices.GetAllocatedSize() + chain.Normals.GetAllocatedSize();
+	for (const TArray<FNavmeshCoverProbe>& probes : ChunkProbes)
+		allocatedSize += probes.GetAllocatedSize();
+	for (const TArray<FDTOCoverData>& coverPoints : ChunkCoverPoints)
+		allocatedSize += coverPoints.GetAllocatedSize();
+
+	return allocatedSize;
+}
+
+FNavmeshCoverGenerationScratch& FNavmeshCoverGenerationScratch::Get()
+{
+	static thread_local FNavmeshCoverGenerationScratch Scratch;
+	return Scratch;
+}
+
+// Adds what the scratch of the calling thread grows by during the scope to the task's scratch growth.
+class FScopedScratchGrowth
+{
+public:
+	FScopedScratchGrowth(int64& _Growth, const FNavmeshCoverGenerationScratch& _Scratch)
+		: Growth(_Growth), Scratch(_Scratch), StartSize(_Scratch.GetAllocatedSize())
+	{}
+
+	~FScopedScratchGrowth()
+	{
+		Growth += (int64)Scratch.GetAllocatedSize() - (int64)StartSize;
+	}
+
+private:
+	int64& Growth;
+	const FNavmeshCoverGenerationScratch& Scratch;
+	const SIZE_T StartSize;
+};
+
+// Makes sure that the first Num buffers exist and are empty, without freeing the ones beyond them.
+template<typename ElementType>
+static void ResetChunkBuffers(TArray<TArray<ElementType>>& Buffers, int32 Num)
+{
+	if (Buffers.Num() < Num)
+		Buffers.SetNum(Num);
+
+	for (int32 iBuffer = 0; iBuffer < Num; iBuffer++)
+		Buffers[iBuffer].Reset();
+}
 
 FNavmeshCoverPointGeneratorTask::FNavmeshCoverPointGeneratorTask(
 	float _CoverPointMinDistance,
 	float _SmallestAgentHeight,
 	float _CoverPointGroundOffset,
-	FBox _MapBounds,
-	int32 _NavmeshTileIndex,
-	UWorld* _World)
+	UWorld* _World,
+	FThreadSafeCounter& _RunningStages,
+	FEvent* _StagesDoneEvent)
 	: CoverPointMinDistance(_CoverPointMinDistance),
 	SmallestAgentHeight(_SmallestAgentHeight),
 	CoverPointGroundOffset(_CoverPointGroundOffset),
 	NavMeshMaxZDistanceFromGround(_CoverPointGroundOffset * 3.0f),
-	MapBounds(_MapBounds),
-	NavmeshTileIndex(_NavmeshTileIndex),
-	World(_World)
-{}
+	World(_World),
+	RunningStages(_RunningStages),
+	StagesDoneEvent(_StagesDoneEvent),
+	NavmeshTileArea(ForceInit)
+{
+	TraceQueryParams.TraceTag = ScanForCoverTraceTag;
+}
 
-FVector FNavmeshCoverPointGeneratorTask::GetPerpendicularVector(const FVector& Vector)
+void FNavmeshCoverPointGeneratorTask::Reset(
+	FBox _MapBounds,
+	int32 _AdaptiveProbeStride,
+	const TArray<FBox>& _DirtyAreas,
+	TSharedPtr<const FNavmeshTileSnapshot, ESPMode::ThreadSafe> _TileSnapshot,
+	int32 _NavmeshTileIndex,
+	uint32 _JobId)
 {
-	return FVector(Vector.Y, -Vector.X, Vector.Z);
+	MapBounds = _MapBounds;
+	AdaptiveProbeStride = FMath::Max(1, _AdaptiveProbeStride);
+	TileSnapshot = _TileSnapshot;
+	NavmeshTileIndex = _NavmeshTileIndex;
+	JobId = _JobId;
+
+	// arrays are only ever Reset() and appended to, which keeps their allocations from the previous tiles
+	DirtyAreas.Reset();
+	DirtyAreas.Append(_DirtyAreas);
+	Probes.Reset();
+	ProbeGaps.Reset();
+	Commit.DirtyAreas.Reset();
+	Commit.CoverPoints.Reset();
+	Commit.Removals.Reset();
+	Commit.Additions.Reset();
+	Commit.DiffSequence = 0;
+	bCommitPending = false;
+
+	Stage = ENavmeshCoverGenerationStage::EnumerateProbes;
+	NavmeshTileArea = FBox(ForceInit);
+	PendingTraceCount = 0;
+	bWaveSubmitted = false;
+	TraceRound = 0;
+	QueryRecording.Reset();
+
+	// the buffers kept from the previous tiles don't count as growth
+	ScratchGrowth = -(int64)GetAllocatedSize();
+	AllocationCount.Reset();
+	ProbeCount = 0;
 }
 
-//TODO: consider using NavData.Raycast or NavData.BatchRaycast() instead
-//TODO: compare raycast() to projectpointonnavigation() in terms of performance: run both alternatives on the same set of geo, on the same map
-bool FNavmeshCoverPointGeneratorTask::ScanForCoverNavMeshProjection(FDTOCoverData& OutCoverData, const FVector& TraceStart, const FVector& TraceDirection)
+SIZE_T FNavmeshCoverPointGeneratorTask::GetAllocatedSize() const
 {
-	const FVector traceEndNavMesh = TraceStart + (TraceDirection * NavmeshHoleCheckReach); // need to keep the navmesh raycast as short as possible
-	const FVector traceEndPhysX = TraceStart + (TraceDirection * ScanReach); // the physx raycast is longer so that it may reach slanted geometry, e.g. ramps
-	const FVector smallestAgentHeightOffset = FVector(0.0f, 0.0f, SmallestAgentHeight);
+	return DirtyAreas.GetAllocatedSize() + Probes.GetAllocatedSize() + ProbeGaps.GetAllocatedSize()
+		+ Commit.DirtyAreas.GetAllocatedSize() + Commit.CoverPoints.GetAllocatedSize() + Commit.Removals.GetAllocatedSize() + Commit.Additions.GetAllocatedSize();
+}
 
-	// project the point onto the navmesh: if the projection is successful then it's not a navmesh hole, so we return failure
-	FNavLocation navLocation;
-	if (UNavigationSystemV1::GetCurrent(World)->ProjectPointToNavigation(traceEndNavMesh, navLocation, FVector(0.1f, 0.1f, 0.1f)))
+bool FNavmeshCoverPointGeneratorTask::AddEdgeStepProbe(TArray<FNavmeshCoverProbe>& OutProbes, const FVector& EdgeStepVertex, const FVector& HoleDirection, bool bRunStart) const
+{
+	// check if we're at the edge of the map
+	if (!MapBounds.IsInside(EdgeStepVertex))
 		return false;
 
-	// to get the cover object within the hole in the navmesh we still need to do a raycast towards its general direction, at a height of SmallestAgentHeight to ensure that the cover is tall enough
-	FHitResult hit;
-	FCollisionQueryParams collQueryParams;
-	collQueryParams.TraceTag = "CoverGenerator_ScanForCoverNavMeshProjection";
-
-	bool bSuccess = World->LineTraceSingleByChannel(hit, TraceStart + smallestAgentHeightOffset, traceEndPhysX + smallestAgentHeightOffset, ECollisionChannel::ECC_GameTraceChannel1, collQueryParams);
+	// the rest of the tile keeps its cover
+	if (!IsInsideDirtyAreas(EdgeStepVertex))
+		return false;
 
-	//TODO: comment out if not needed - ledge detection logic
-	if (!bSuccess)
-	{
-		// if we didn't hit an object with the XY-parallel ray then cast another one towards the ground from an extended location, down along the Z-axis
-		// this ensures that we pick up the edges of cliffs, which are valid cover points against units below, while also discarding flat planes that tend to creep up along navmesh tile boundaries
-		// if this ray doesn't hit anything then we've found a cliff's edge
-		// if it hits, then cast another, similar, but slightly slanted ray to account for any non-perfectly straight cliff walls e.g. that of landscapes
-		FHitResult hitCliff;
-		const FVector cliffTraceStart = traceEndNavMesh + (TraceDirection * CliffEdgeDistance);
-		bSuccess = !World->LineTraceSingleByChannel(hitCliff, cliffTraceStart, cliffTraceStart - smallestAgentHeightOffset, ECollisionChannel::ECC_GameTraceChannel1, collQueryParams);
+	OutProbes.Add(FNavmeshCoverProbe(EdgeStepVertex, HoleDirection, bRunStart));
+	return true;
+}
 
-		if (!bSuccess)
-			// this is the slightly slanted, 2nd ray
-			bSuccess = !World->LineTraceSingleByChannel(hitCliff, cliffTraceStart, cliffTraceStart - smallestAgentHeightOffset + (TraceDirection * StraightCliffErrorTolerance), ECollisionChannel::ECC_GameTraceChannel1, collQueryParams);
+void FNavmeshCoverPointGeneratorTask::AddChainProbes(TArray<FNavmeshCoverProbe>& OutProbes, const FNavmeshBoundaryChain& Chain) const
+{
+	const FVector groundOffset = FVector(0.0f, 0.0f, CoverPointGroundOffset);
+	const TArray<FVector>& vertices = Chain.Vertices;
+	const int32 nSegments = Chain.Normals.Num();
+	if (nSegments == 0)
+		return;
 
-		if (bSuccess)
-			// now that we've established that it's a cliff's edge, we need to trace into the ground to find the "cliff object"
-			bSuccess = World->LineTraceSingleByChannel(hit, TraceStart, TraceStart - FVector(0.0f, 0.0f, NavMeshMaxZDistanceFromGround), ECollisionChannel::ECC_GameTraceChannel1, collQueryParams);
+	float chainLength = 0.0f;
+	for (int32 iSegment = 0; iSegment < nSegments; iSegment++)
+	{
+#if DEBUG_RENDERING
+		if (bDebugDraw)
+			DebugDraw.AddDirectionalArrow(vertices[iSegment], vertices[iSegment + 1], 200.0f, FColor::Purple, true, -1.0f, 2.0f);
+#endif
 
+		chainLength += FVector::Dist(vertices[iSegment], vertices[iSegment + 1]);
 	}
 
-	if (!bSuccess)
-		return false;
+	// step through the chain in increments as close to CoverPointMinDistance as possible but never shorter, without restarting at every vertex
+	// each step is checked for blocking geometry on the side of the hole; if geometry blocks the raycast then the step is marked as a cover point
+	// open chains get a step at both of their ends, while the end of a closed chain is the same as its start
+	// ends on a seam owned by the neighbouring tile are left to it
+	const int32 nSteps = FMath::Max(1, FMath::FloorToInt(chainLength / CoverPointMinDistance));
+	const float stepLength = chainLength / nSteps;
+	const int32 nProbes = Chain.bClosed || Chain.bEndOnForeignSeam ? nSteps : nSteps + 1;
+
+	// steps along segments of the same direction form a straight run, whose results may be filled in without tracing each step, see SelectCoarseProbes()
+	const float straightRunCosThreshold = FMath::Cos(FMath::DegreesToRadians(StraightRunAngleThreshold));
+	bool bRunStart = true;
+	const FVector* runDirection = nullptr;
+
+	int32 iSegment = 0;
+	float segmentStart = 0.0f;
+	float segmentLength = FVector::Dist(vertices[0], vertices[1]);
+	for (int32 iStep = Chain.bStartOnForeignSeam ? 1 : 0; iStep < nProbes; iStep++)
+	{
+		// find the segment that the step falls on
+		const float stepArcLength = iStep * stepLength;
+		while (iSegment < nSegments - 1 && stepArcLength > segmentStart + segmentLength)
+		{
+			segmentStart += segmentLength;
+			iSegment++;
+			segmentLength = FVector::Dist(vertices[iSegment], vertices[iSegment + 1]);
+		}
 
-	// force fields (shields) are handled by FActorCoverPointGeneratorTask instead
-	if (ECC_GameTraceChannel2 == hit.GetActor()->GetRootComponent()->GetCollisionObjectType())
-		return false;
+		const float alpha = segmentLength > KINDA_SMALL_NUMBER ? FMath::Clamp((stepArcLength - segmentStart) / segmentLength, 0.0f, 1.0f) : 0.0f;
+		if (runDirection && FVector::DotProduct(*runDirection, Chain.Normals[iSegment]) < straightRunCosThreshold)
+			bRunStart = true;
 
-	OutCoverData = FDTOCoverData(hit.GetActor(), TraceStart, false);
-	return true;
+		// a step that's been skipped, e.g. outside of the dirty areas, ends the run as well: the probes on either side of it aren't neighbours, so neither may fill in the other's results
+		runDirection = &Chain.Normals[iSegment];
+		bRunStart = !AddEdgeStepProbe(OutProbes, FMath::Lerp(vertices[iSegment], vertices[iSegment + 1], alpha) + groundOffset, Chain.Normals[iSegment], bRunStart);
+	}
+
+	// probe the real corners once more, diagonally: halfway between the normals of the two segments is always the side of the hole
+	const float cornerCosThreshold = FMath::Cos(FMath::DegreesToRadians(CornerAngleThreshold));
+	for (int32 iVertex = Chain.bClosed ? 0 : 1; iVertex < nSegments; iVertex++)
+	{
+		const FVector& previousNormal = Chain.Normals[iVertex > 0 ? iVertex - 1 : nSegments - 1];
+		const FVector& nextNormal = Chain.Normals[iVertex];
+		if (FVector::DotProduct(previousNormal, nextNormal) > cornerCosThreshold)
+			continue;
+
+		// the normals of a hairpin turn cancel each other out
+		const FVector cornerDirection = (previousNormal + nextNormal).GetSafeNormal();
+		if (!cornerDirection.IsZero())
+			AddEdgeStepProbe(OutProbes, vertices[iVertex] + groundOffset, cornerDirection, true);
+	}
 }
 
-void FNavmeshCoverPointGeneratorTask::ProcessEdgeStep(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FVector& EdgeStepVertex, const FVector& EdgeDir)
+void FNavmeshCoverPointGeneratorTask::ForEachChunk(int32 Num, int32 ItemsPerChunk, TFunctionRef<void(int32 ChunkIdx, int32 Start, int32 End)> Body) const
 {
-	if (!MapBounds.IsInside(EdgeStepVertex))
-		return;
+	const int32 nChunks = FMath::DivideAndRoundUp(Num, ItemsPerChunk);
 
-	FDTOCoverData coverData;
-	for (int directionMultiplier = 1; directionMultiplier > -2; directionMultiplier -= 2)
-		// check if we're at the edge of the map
-		if (ScanForCoverNavMeshProjection(coverData, EdgeStepVertex, GetPerpendicularVector(EdgeDir) * directionMultiplier))
-		{
-			OutCoverPointsOfActors.Add(coverData);
-			return;
-		}
+	// debug shapes are recorded rather than drawn, so the chunks may run in parallel with debug drawing on as well
+	ParallelFor(nChunks, [&](int32 iChunk)
+	{
+		// chunks that run on other threads allocate for the tile as well
+		FCoverAllocationScope allocationScope(AllocationCount);
+		Body(iChunk, iChunk * ItemsPerChunk, FMath::Min(Num, (iChunk + 1) * ItemsPerChunk));
+	}, nChunks <= 1);
 }
 
-const FVector FNavmeshCoverPointGeneratorTask::GetEdgeDir(const FVector& EdgeStartVertex, const FVector& EdgeEndVertex) const
+bool FNavmeshCoverPointGeneratorTask::IsInsideDirtyAreas(const FVector& Location) const
 {
-	return (EdgeEndVertex - EdgeStartVertex).GetUnsafeNormal();
+	for (const FBox& dirtyArea : DirtyAreas)
+		if (dirtyArea.IsInside(Location))
+			return true;
+
+	return DirtyAreas.Num() == 0;
 }
 
-const FBox FNavmeshCoverPointGeneratorTask::GenerateCoverInBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors)
+void FNavmeshCoverPointGeneratorTask::EnumerateProbes()
 {
 	// profiling
 	SCOPE_CYCLE_COUNTER(STAT_GenerateCoverInBounds);
 	INC_DWORD_STAT(STAT_GenerateCoverHistoricalCount);
 	SCOPE_SECONDS_ACCUMULATOR(STAT_GenerateCoverAverageTime);
 
-	const ARecastNavMesh* navdata = Cast<ARecastNavMesh>(UNavigationSystemV1::GetCurrent(World)->MainNavData);
-	FRecastDebugGeometry navGeo;
-	navGeo.bGatherNavMeshEdges = true;
+	FNavmeshCoverGenerationScratch& scratch = FNavmeshCoverGenerationScratch::Get();
+	FScopedScratchGrowth scratchGrowth(ScratchGrowth, scratch);
 
-	// get the navigation vertices from recast via a batch query
-	navdata->BeginBatchQuery();
-	navdata->GetDebugGeometry(navGeo, NavmeshTileIndex);
-	navdata->FinishBatchQuery();
+	// get the boundary edges straight from detour, or from the copy of the tile taken when it was added; the side of the navmesh hole is known for each of them
+	const ARecastNavMesh* navdata = Cast<ARecastNavMesh>(UNavigationSystemV1::GetCurrent(World)->MainNavData);
+	TArray<FNavmeshBoundaryEdge>& edges = scratch.Edges;
+	edges.Reset();
+	if (TileSnapshot.IsValid())
+		FNavmeshEdgeExtractor::ExtractBoundaryEdges(edges, *TileSnapshot);
+	else
+		FNavmeshEdgeExtractor::ExtractBoundaryEdges(edges, navdata, NavmeshTileIndex);
 
-	// process the navmesh vertices (called nav mesh edges for some occult reason)
-	TArray<FVector>& vertices = navGeo.NavMeshEdges;
-	const int nVertices = vertices.Num();
-	if (nVertices > 1)
+	// on a partial update, e.g. a door or crate that has moved, only the edges near the modified geometry are walked again
+	if (DirtyAreas.Num() > 0)
 	{
-		const FVector firstEdgeDir = GetEdgeDir(vertices[0], vertices[1]);
-		const FVector lastEdgeDir = GetEdgeDir(vertices[nVertices - 2], vertices[nVertices - 1]);
-		for (int iVertex = 0; iVertex < nVertices; iVertex += 2)
+		const float margin = DirtyAreaMargin + navdata->AgentRadius;
+		for (FBox& dirtyArea : DirtyAreas)
+			dirtyArea = dirtyArea.ExpandBy(margin);
+
+		edges.RemoveAll([this](const FNavmeshBoundaryEdge& Edge)
 		{
-			const FVector edgeStartVertex = vertices[iVertex];
-			const FVector edgeEndVertex = vertices[iVertex + 1];
-			const FVector edge = edgeEndVertex - edgeStartVertex;
-			const FVector edgeDir = edge.GetUnsafeNormal();
+			const FBox edgeBounds(Edge.Start.ComponentMin(Edge.End), Edge.Start.ComponentMax(Edge.End));
+			for (const FBox& dirtyArea : DirtyAreas)
+				if (dirtyArea.Intersect(edgeBounds))
+					return false;
 
-#if DEBUG_RENDERING
-			if (bDebugDraw)
-				DrawDebugDirectionalArrow(World, edgeStartVertex, edgeEndVertex, 200.0f, FColor::Purple, true, -1.0f, 0, 2.0f);
-#endif
+			return true;
+		});
+	}
+
+	// weld the edges into polylines so that the shared vertices don't get probed over and over again
+	TArray<FNavmeshBoundaryChain>& chains = scratch.Chains;
+	FNavmeshEdgeExtractor::WeldBoundaryEdges(chains, edges, scratch.Weld);
 
-			// step through the edge in CoverPointMinDistance increments
-			const int nEdgeSteps = edge.Size() / CoverPointMinDistance;
-			for (int iEdgeStep = 0; iEdgeStep < nEdgeSteps; iEdgeStep++)
-				// check to the left and to optionally, to the right of the vertex's location for any blocking geometry
-				// if geometry blocks the raycast then the vertex is marked as a cover point
-				ProcessEdgeStep(OutCoverPointsOfActors, edgeStartVertex + (iEdgeStep * CoverPointMinDistance * edgeDir) + FVector(0.0f, 0.0f, CoverPointGroundOffset), edgeDir);
+	// the ends of chains that continue in a neighbouring tile are probed by only one of the two tiles
+	FNavmeshEdgeExtractor::MarkForeignSeams(chains, navdata, NavmeshTileIndex);
 
-			// process the first step if the edge was shorter than CoverPointMinDistance
-			if (nEdgeSteps == 0)
-				ProcessEdgeStep(OutCoverPointsOfActors, edgeStartVertex + FVector(0.0f, 0.0f, CoverPointGroundOffset), edgeDir);
+	// heavy tiles, e.g. cities or rubble, are split up among idle workers so that they don't hold up the availability of cover for too long
+	TArray<TArray<FNavmeshCoverProbe>>& chunkProbes = scratch.ChunkProbes;
+	const int32 nChunks = FMath::DivideAndRoundUp(chains.Num(), ChainsPerChunk);
+	ResetChunkBuffers(chunkProbes, nChunks);
+	ForEachChunk(chains.Num(), ChainsPerChunk, [&](int32 ChunkIdx, int32 Start, int32 End)
+	{
+		for (int32 iChain = Start; iChain < End; iChain++)
+			AddChainProbes(chunkProbes[ChunkIdx], chains[iChain]);
+	});
 
-			// process the end vertex; 99% of the time it's left out by the above for-loop, and in that 1% of cases we will just process the same vertex twice (likely to never happen because of floating-point division)
-			ProcessEdgeStep(OutCoverPointsOfActors, edgeEndVertex + FVector(0.0f, 0.0f, CoverPointGroundOffset), edgeDir);
+	// merge the chunks in order, so that the probes are the same as if they were gathered serially; the chunks keep their buffers for the next tile
+	for (int32 iChunk = 0; iChunk < nChunks; iChunk++)
+		Probes.Append(chunkProbes[iChunk]);
 
-			// process the end vertex again, this time with its edge direction rotated by 45 degrees
-			ProcessEdgeStep(OutCoverPointsOfActors, edgeEndVertex + FVector(0.0f, 0.0f, CoverPointGroundOffset), FVector(FVector2D(edgeDir).GetRotated(45.0f), edgeDir.Z));
-		}
-	}
+	SelectCoarseProbes();
 
-	// return the AABB of the navmesh tile that's been processed, expanded by minimum tile height on the Z-axis
+	// store the AABB of the navmesh tile that's been processed, expanded by minimum tile height on the Z-axis
 	const ARecastNavMesh* recastNavmesh = Cast<ARecastNavMesh>(UNavigationSystemV1::GetCurrent(World)->MainNavData);
-	FBox navmeshBounds = navdata->GetNavMeshTileBounds(NavmeshTileIndex);
+	NavmeshTileArea = navdata->GetNavMeshTileBounds(NavmeshTileIndex);
 	float navmeshTileHeight = recastNavmesh->GetRecastMesh()->getParams()->tileHeight;
 	if (navmeshTileHeight > 0)
-		navmeshBounds = navmeshBounds.ExpandBy(FVector(0.0f, 0.0f, navmeshTileHeight * 0.5f));
+		NavmeshTileArea = NavmeshTileArea.ExpandBy(FVector(0.0f, 0.0f, navmeshTileHeight * 0.5f));
+}
+
+void FNavmeshCoverPointGeneratorTask::SelectCoarseProbes()
+{
+	// probes are stored run by run, each run starting with a probe flagged as such
+	int32 runStart = 0;
+	while (runStart < Probes.Num())
+	{
+		int32 runEnd = runStart + 1;
+		while (runEnd < Probes.Num() && !Probes[runEnd].bRunStart)
+			runEnd++;
+
+		// without refinement, i.e. with a stride of 1, every probe is traced in the first round
+		Probes[runStart].TraceRound = 0;
+		int32 previousProbeIdx = runStart;
+		for (int32 iProbe = runStart + 1; iProbe < runEnd; iProbe++)
+			if (iProbe == runEnd - 1 || (iProbe - runStart) % AdaptiveProbeStride == 0)
+			{
+				Probes[iProbe].TraceRound = 0;
+				AddProbeGap(previousProbeIdx, iProbe);
+				previousProbeIdx = iProbe;
+			}
+
+		runStart = runEnd;
+	}
+}
+
+void FNavmeshCoverPointGeneratorTask::AddProbeGap(int32 FirstProbeIdx, int32 LastProbeIdx)
+{
+	if (LastProbeIdx - FirstProbeIdx > 1)
+		ProbeGaps.Add(TPair<int32, int32>(FirstProbeIdx, LastProbeIdx));
+}
+
+bool FNavmeshCoverPointGeneratorTask::RefineProbes()
+{
+	TArray<TPair<int32, int32>>& gaps = FNavmeshCoverGenerationScratch::Get().ProbeGaps;
+	gaps.Reset();
+	gaps.Append(ProbeGaps);
+	ProbeGaps.Reset();
+	TraceRound++;
+
+	bool bAnyProbesToTrace = false;
+	for (const TPair<int32, int32>& gap : gaps)
+	{
+		const FNavmeshCoverProbe& firstProbe = Probes[gap.Key];
+		if (firstProbe.HasSameTraceResults(Probes[gap.Value]))
+		{
+			// nothing changes along the gap, e.g. it's the middle of a long wall
+			for (int32 iProbe = gap.Key + 1; iProbe < gap.Value; iProbe++)
+				Probes[iProbe].CopyTraceResults(firstProbe);
+
+			INC_DWORD_STAT_BY(STAT_CoverInterpolatedProbeCount, gap.Value - gap.Key - 1);
+			continue;
+		}
+
+		// something changes along the gap, e.g. the wall ends or there's a gap in it, so look closer
+		const int32 middleProbeIdx = (gap.Key + gap.Value) / 2;
+		Probes[middleProbeIdx].TraceRound = TraceRound;
+		AddProbeGap(gap.Key, middleProbeIdx);
+		AddProbeGap(middleProbeIdx, gap.Value);
+		bAnyProbesToTrace = true;
+	}
+
+	return bAnyProbesToTrace;
+}
+
+void FNavmeshCoverPointGeneratorTask::SubmitTrace(int32 ProbeIdx, ENavmeshCoverTrace TraceType, const FVector& TraceStart, const FVector& TraceEnd, const FCollisionQueryParams& CollQueryParams)
+{
+	// the probe and the type of the trace are encoded in the user data, to be picked up by OnTraceCompleted()
+	const uint32 userData = ProbeIdx * (uint32)ENavmeshCoverTrace::Num + (uint32)TraceType;
+	World->AsyncLineTraceByChannel(EAsyncTraceType::Single, TraceStart, TraceEnd, ECollisionChannel::ECC_GameTraceChannel1, CollQueryParams, FCollisionResponseParams::DefaultResponseParam, &TraceDelegate, userData);
+	PendingTraceCount++;
+	INC_DWORD_STAT(STAT_CoverAsyncTraceCount);
+}
+
+bool FNavmeshCoverPointGeneratorTask::IsBlockedByLandscape(const TArray<ALandscapeProxy*>& Landscapes, const FVector& Start, const FVector& End) const
+{
+	auto GetLandscapeHeight = [&Landscapes](const FVector& Location)
+	{
+		for (ALandscapeProxy* landscape : Landscapes)
+		{
+			const TOptional<float> height = landscape->GetHeightAtLocation(Location);
+			if (height.IsSet())
+				return height;
+		}
+
+		return TOptional<float>();
+	};
+
+	// a trace that starts inside the terrain doesn't hit the heightfield
+	const TOptional<float> startHeight = GetLandscapeHeight(Start);
+	if (!startHeight.IsSet() || Start.Z <= startHeight.GetValue())
+		return false;
+
+	const int32 nSamples = FMath::Max(1, FMath::CeilToInt(FVector::Dist(Start, End) / LandscapeSampleSpacing));
+	for (int32 iSample = 1; iSample <= nSamples; iSample++)
+	{
+		const FVector sample = FMath::Lerp(Start, End, (float)iSample / nSamples);
+		const TOptional<float> height = GetLandscapeHeight(sample);
+		if (height.IsSet() && sample.Z <= height.GetValue())
+			return true;
+	}
+
+	return false;
+}
+
+void FNavmeshCoverPointGeneratorTask::GetCliffTraces(const FNavmeshCoverProbe& Probe, FVector& OutStart, FVector& OutStraightEnd, FVector& OutSlantedEnd) const
+{
+	OutStart = Probe.Location + (Probe.Direction * (NavmeshHoleCheckReach + CliffEdgeDistance));
+	OutStraightEnd = OutStart - FVector(0.0f, 0.0f, SmallestAgentHeight);
+	OutSlantedEnd = OutStraightEnd + (Probe.Direction * StraightCliffErrorTolerance);
+}
 
-	return navmeshBounds;
+void FNavmeshCoverPointGeneratorTask::ResolveLandscapeCliffs(FCoverSceneQueries& Queries)
+{
+	// landscapes that the cliff traces of the tile may hit, for sampling their heightfields instead of tracing
+	TArray<ALandscapeProxy*>& landscapes = FNavmeshCoverGenerationScratch::Get().Landscapes;
+	landscapes.Reset();
+	Queries.GetLandscapes(landscapes, NavmeshTileArea.ExpandBy(NavmeshHoleCheckReach + CliffEdgeDistance + StraightCliffErrorTolerance));
+	if (landscapes.Num() == 0)
+		return;
+
+	// on landscapes, the navmesh mostly ends at slopes rather than cliffs; if the heightfield is enough to tell that both cliff traces would hit then it's not a cliff's edge,
+	// and the ground trace isn't needed either
+	// serially, as the heightfields may only be read on the game thread
+	for (FNavmeshCoverProbe& probe : Probes)
+	{
+		FVector cliffTraceStart, cliffStraightTraceEnd, cliffSlantedTraceEnd;
+		GetCliffTraces(probe, cliffTraceStart, cliffStraightTraceEnd, cliffSlantedTraceEnd);
+		probe.bLandscapeCliffHit = IsBlockedByLandscape(landscapes, cliffTraceStart, cliffStraightTraceEnd)
+			&& IsBlockedByLandscape(landscapes, cliffTraceStart, cliffSlantedTraceEnd);
+	}
 }
 
-void FNavmeshCoverPointGeneratorTask::DoWork()
+template<typename TraceFuncType>
+void FNavmeshCoverPointGeneratorTask::SubmitWave(TraceFuncType&& Trace)
+{
+	const FVector smallestAgentHeightOffset = FVector(0.0f, 0.0f, SmallestAgentHeight);
+	for (int32 iProbe = 0; iProbe < Probes.Num(); iProbe++)
+	{
+		// probes of other rounds have been traced already, or will be filled in from their neighbours
+		FNavmeshCoverProbe& probe = Probes[iProbe];
+		if (probe.TraceRound != TraceRound)
+			continue;
+
+		if (Stage == ENavmeshCoverGenerationStage::WallTraces)
+		{
+			// to get the cover object within the hole in the navmesh we still need to do a raycast towards its general direction, at a height of SmallestAgentHeight to ensure that the cover is tall enough
+			// the physx raycast is longer than the navmesh hole check so that it may reach slanted geometry, e.g. ramps
+			const FVector traceEndPhysX = probe.Location + (probe.Direction * ScanReach);
+			Trace(iProbe, ENavmeshCoverTrace::Wall, probe.Location + smallestAgentHeightOffset, traceEndPhysX + smallestAgentHeightOffset);
+		}
+		//TODO: comment out if not needed - ledge detection logic
+		else if (Stage == ENavmeshCoverGenerationStage::CliffTraces && !probe.bWallHit)
+		{
+			// resolved from the heightfield by ResolveLandscapeCliffs()
+			if (probe.bLandscapeCliffHit)
+			{
+				probe.bCliffStraightHit = true;
+				probe.bCliffSlantedHit = true;
+				INC_DWORD_STAT(STAT_CoverLandscapeCliffProbeCount);
+				continue;
+			}
+
+			// if we didn't hit an object with the XY-parallel ray then cast another one towards the ground from an extended location, down along the Z-axis
+			// this ensures that we pick up the edges of cliffs, which are valid cover points against units below, while also discarding flat planes that tend to creep up along navmesh tile boundaries
+			// if this ray doesn't hit anything then we've found a cliff's edge
+			// if it hits, then the similar, but slightly slanted ray accounts for any non-perfectly straight cliff walls e.g. that of landscapes
+			FVector cliffTraceStart, cliffStraightTraceEnd, cliffSlantedTraceEnd;
+			GetCliffTraces(probe, cliffTraceStart, cliffStraightTraceEnd, cliffSlantedTraceEnd);
+			Trace(iProbe, ENavmeshCoverTrace::CliffStraight, cliffTraceStart, cliffStraightTraceEnd);
+			Trace(iProbe, ENavmeshCoverTrace::CliffSlanted, cliffTraceStart, cliffSlantedTraceEnd);
+		}
+		// the trace into the ground that finds the "cliff object" is only needed if the probe has turned out to be a cliff's edge
+		else if (Stage == ENavmeshCoverGenerationStage::GroundTraces && !probe.bWallHit && !(probe.bCliffStraightHit && probe.bCliffSlantedHit))
+		{
+			Trace(iProbe, ENavmeshCoverTrace::Ground, probe.Location, probe.Location - FVector(0.0f, 0.0f, NavMeshMaxZDistanceFromGround));
+		}
+	}
+}
+
+void FNavmeshCoverPointGeneratorTask::OnTraceCompleted(const FTraceHandle& TraceHandle, FTraceDatum& TraceData)
+{
+	FCoverAllocationScope allocationScope(AllocationCount);
+	PendingTraceCount--;
+
+	const FHitResult* hit = TraceData.OutHits.Num() > 0 && TraceData.OutHits[0].bBlockingHit ? &TraceData.OutHits[0] : nullptr;
+	StoreTraceResult(TraceData.UserData / (uint32)ENavmeshCoverTrace::Num, (ENavmeshCoverTrace)(TraceData.UserData % (uint32)ENavmeshCoverTrace::Num), hit);
+}
+
+void FNavmeshCoverPointGeneratorTask::StoreTraceResult(int32 ProbeIdx, ENavmeshCoverTrace TraceType, const FHitResult* Hit, int32 HitObjectId)
+{
+	if (!Probes.IsValidIndex(ProbeIdx))
+		return;
+
+	FNavmeshCoverProbe& probe = Probes[ProbeIdx];
+	switch (TraceType)
+	{
+	case ENavmeshCoverTrace::Wall:
+		probe.bWallHit = Hit != nullptr;
+		if (Hit)
+		{
+			probe.WallObject = Hit->GetActor();
+			probe.WallObjectId = HitObjectId;
+		}
+		break;
+	case ENavmeshCoverTrace::CliffStraight:
+		probe.bCliffStraightHit = Hit != nullptr;
+		break;
+	case ENavmeshCoverTrace::CliffSlanted:
+		probe.bCliffSlantedHit = Hit != nullptr;
+		break;
+	case ENavmeshCoverTrace::Ground:
+		probe.bGroundHit = Hit != nullptr;
+		if (Hit)
+		{
+			probe.GroundObject = Hit->GetActor();
+			probe.GroundObjectId = HitObjectId;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+template<typename TraceFuncType>
+bool FNavmeshCoverPointGeneratorTask::AdvanceWaves(TraceFuncType&& Trace)
+{
+	FScopedScratchGrowth scratchGrowth(ScratchGrowth, FNavmeshCoverGenerationScratch::Get());
+	while (PendingTraceCount == 0)
+	{
+		// the current wave has come back in full, so move on to the next one
+		if (bWaveSubmitted)
+		{
+			bWaveSubmitted = false;
+			if (Stage == ENavmeshCoverGenerationStage::WallTraces)
+				Stage = ENavmeshCoverGenerationStage::CliffTraces;
+			else if (Stage == ENavmeshCoverGenerationStage::CliffTraces)
+				Stage = ENavmeshCoverGenerationStage::GroundTraces;
+			// once a round is over, start another one for the gaps between its probes that need a closer look, if any
+			else
+				Stage = RefineProbes() ? ENavmeshCoverGenerationStage::WallTraces : ENavmeshCoverGenerationStage::ResolveCoverPoints;
+		}
+
+		if (Stage != ENavmeshCoverGenerationStage::WallTraces && Stage != ENavmeshCoverGenerationStage::CliffTraces && Stage != ENavmeshCoverGenerationStage::GroundTraces)
+			return true;
+
+		// a wave without any traces is over right away
+		SubmitWave(Trace);
+		bWaveSubmitted = true;
+	}
+
+	return false;
+}
+
+bool FNavmeshCoverPointGeneratorTask::TickTraces()
+{
+	FCoverAllocationScope allocationScope(AllocationCount);
+
+	// bound once per generator, rather than once per tile
+	if (!TraceDelegate.IsBound())
+		TraceDelegate.BindThreadSafeSP(AsShared(), &FNavmeshCoverPointGeneratorTask::OnTraceCompleted);
+
+	// the landscapes are sampled right before the first wave of the tile, here on the game thread
+	if (Stage == ENavmeshCoverGenerationStage::WallTraces && TraceRound == 0 && !bWaveSubmitted)
+	{
+		FCoverSceneQueries sceneQueries(World, ECollisionChannel::ECC_GameTraceChannel1);
+		ResolveLandscapeCliffs(sceneQueries);
+	}
+
+	// the traces go to the scene asynchronously
+	return AdvanceWaves([this](int32 ProbeIdx, ENavmeshCoverTrace TraceType, const FVector& Start, const FVector& End)
+	{
+		SubmitTrace(ProbeIdx, TraceType, Start, End, TraceQueryParams);
+	});
+}
+
+template<typename QueriesType>
+void FNavmeshCoverPointGeneratorTask::TraceWaves(QueriesType& Queries)
+{
+	// every trace comes back right away, so a single call goes through all of the waves
+	// the landscapes aren't sampled on the worker, so their traces go to the backend like any other
+	AdvanceWaves([this, &Queries](int32 ProbeIdx, ENavmeshCoverTrace TraceType, const FVector& Start, const FVector& End)
+	{
+		FHitResult hit;
+		StoreTraceResult(ProbeIdx, TraceType, Queries.LineTrace(hit, Start, End, TraceQueryParams) ? &hit : nullptr);
+	});
+}
+
+template void FNavmeshCoverPointGeneratorTask::TraceWaves<FCoverSceneQueries>(FCoverSceneQueries&);
+template void FNavmeshCoverPointGeneratorTask::TraceWaves<FCoverSnapshotQueries>(FCoverSnapshotQueries&);
+
+bool FNavmeshCoverPointGeneratorTask::Replay(const FCoverQueryRecording& Recording, TArray<FCoverReplayedPoint>& OutCoverPoints)
+{
+	const FCoverRecordedTile& recordedTile = Recording.Tile;
+	if (!Recording.IsTileRecording())
+		return false;
+
+	// a generator of its own that never touches the world, the cover system or the thread pool
+	FThreadSafeCounter runningStages;
+	FNavmeshCoverPointGeneratorTask generator(0.0f, recordedTile.SmallestAgentHeight, recordedTile.CoverPointGroundOffset, nullptr, runningStages, nullptr);
+	generator.Reset(FBox(ForceInit), recordedTile.AdaptiveProbeStride, TArray<FBox>(), nullptr, recordedTile.NavmeshTileIndex, 0);
+
+	// the probes as enumerated by the recorded run, which the waves start from
+	generator.Probes.Reserve(recordedTile.Probes.Num());
+	for (const FCoverRecordedProbe& recordedProbe : recordedTile.Probes)
+		generator.Probes.Add(FNavmeshCoverProbe(recordedProbe.Location, recordedProbe.Direction, recordedProbe.bRunStart));
+
+	generator.SelectCoarseProbes();
+	generator.Stage = ENavmeshCoverGenerationStage::WallTraces;
+
+	// same as TraceWaves(), except that the hit objects are the recorded ones, as there are no actors to hit
+	FCoverReplayQueries replayQueries(Recording);
+	generator.AdvanceWaves([&generator, &replayQueries](int32 ProbeIdx, ENavmeshCoverTrace TraceType, const FVector& Start, const FVector& End)
+	{
+		FHitResult hit;
+		const bool bHit = replayQueries.LineTrace(hit, Start, End, generator.TraceQueryParams);
+		generator.StoreTraceResult(ProbeIdx, TraceType, bHit ? &hit : nullptr, replayQueries.GetLastHitObjectId());
+	});
+
+	// same as ResolveProbe(), by object id
+	for (const FNavmeshCoverProbe& probe : generator.Probes)
+	{
+		int32 objectId = INDEX_NONE;
+		if (probe.IsWallCover())
+			objectId = probe.WallObjectId;
+		else if (probe.IsCliffCover())
+			objectId = probe.GroundObjectId;
+
+		if (Recording.Objects.IsValidIndex(objectId) && !Recording.Objects[objectId].bForceField)
+			OutCoverPoints.Add(FCoverReplayedPoint(probe.Location, objectId));
+	}
+
+	return replayQueries.GetMismatchCount() == 0 && replayQueries.IsFinished();
+}
+
+bool FNavmeshCoverPointGeneratorTask::ResolveProbe(FDTOCoverData& OutCoverData, const FNavmeshCoverProbe& Probe) const
+{
+	AActor* coverObject = nullptr;
+	if (Probe.IsWallCover())
+		coverObject = Probe.WallObject.Get();
+	// it's a cliff's edge unless both cliff traces have hit something, in which case the cover object is whatever's in the ground below the probe
+	else if (Probe.IsCliffCover())
+		coverObject = Probe.GroundObject.Get();
+
+	if (!coverObject)
+		return false;
+
+	// force fields (shields) are handled by FActorCoverPointGeneratorTask instead
+	if (ECC_GameTraceChannel2 == coverObject->GetRootComponent()->GetCollisionObjectType())
+		return false;
+
+	OutCoverData = FDTOCoverData(coverObject, Probe.Location, false, NavmeshTileIndex);
+	return true;
+}
+
+void FNavmeshCoverPointGeneratorTask::ResolveCoverPoints(TArray<FDTOCoverData>& OutCoverPointsOfActors) const
+{
+	// each chunk of probes gets its own buffer, merged at the end
+	TArray<TArray<FDTOCoverData>>& chunkCoverPoints = FNavmeshCoverGenerationScratch::Get().ChunkCoverPoints;
+	const int32 nChunks = FMath::DivideAndRoundUp(Probes.Num(), ProbesPerChunk);
+	ResetChunkBuffers(chunkCoverPoints, nChunks);
+	ForEachChunk(Probes.Num(), ProbesPerChunk, [&](int32 ChunkIdx, int32 Start, int32 End)
+	{
+		FDTOCoverData coverData;
+		for (int32 iProbe = Start; iProbe < End; iProbe++)
+			if (ResolveProbe(coverData, Probes[iProbe]))
+				chunkCoverPoints[ChunkIdx].Add(coverData);
+	});
+
+	// the cover points go into the generator's commit, whose buffer is kept from tile to tile
+	int32 nCoverPoints = 0;
+	for (int32 iChunk = 0; iChunk < nChunks; iChunk++)
+		nCoverPoints += chunkCoverPoints[iChunk].Num();
+
+	OutCoverPointsOfActors.Reserve(OutCoverPointsOfActors.Num() + nCoverPoints);
+	for (int32 iChunk = 0; iChunk < nChunks; iChunk++)
+		OutCoverPointsOfActors.Append(chunkCoverPoints[iChunk]);
+}
+
+void FNavmeshCoverPointGeneratorTask::DoWork(UCoverSubsystem& CoverSystem)
 {
 	// profiling
 	SCOPE_CYCLE_COUNTER(STAT_GenerateCover);
@@ -175,39 +688,165 @@ void FNavmeshCoverPointGeneratorTask::DoWork()
 	INC_DWORD_STAT(STAT_TaskCount);
 
 #if DEBUG_RENDERING
-	if (UCoverSubsystem* CoverSystem = World->GetSubsystem<UCoverSubsystem>())
-	{
-		bDebugDraw = CoverSystem->bDebugDraw;
-	}
-	else
+	bDebugDraw = CoverSystem.bDebugDraw;
+#endif
+
+	// the tile has been dirtied again since this job was started, so its results would be outdated anyway
+	if (CoverSystem.IsCoverGenerationSuperseded(NavmeshTileIndex, JobId))
 	{
+		Stage = ENavmeshCoverGenerationStage::Done;
+		INC_DWORD_STAT(STAT_CoverSupersededJobCount);
+		DEC_DWORD_STAT(STAT_TaskCount);
 		return;
 	}
-#endif
-
-	// generate cover points
-	TArray<FDTOCoverData> coverPoints;
-	FBox navmeshTileArea = GenerateCoverInBounds(coverPoints);
 
-	// remove any cover points that don't fall on the navmesh anymore
-	// happens when a newly placed cover object is placed on top of previously generated cover points
-	if (UCoverSubsystem* CoverSystem = World->GetSubsystem<UCoverSubsystem>())
+	if (Stage == ENavmeshCoverGenerationStage::EnumerateProbes)
 	{
-		//TODO: consider deleting this - a few more cover points might be left over upon object removal but at the expense of fewer cover points per object. most apparent near ledges. not a big deal either way, though.
-		CoverSystem->RemoveStaleCoverPoints(navmeshTileArea);
-		// add the generated cover points to the octree in a single batch
-		CoverSystem->AddCoverPoints(coverPoints);
+		EnumerateProbes();
+		ProbeCount = Probes.Num();
+		Stage = ENavmeshCoverGenerationStage::WallTraces;
+
+		// along with the queries go the probes and the parameters that they're made from, so that the tile can be replayed, see Replay()
+		if (!CoverSystem.CoverQueryRecordingDirectory.IsEmpty())
+		{
+			QueryRecording = MakeUnique<FCoverQueryRecording>();
+			FCoverRecordedTile& recordedTile = QueryRecording->Tile;
+			recordedTile.NavmeshTileIndex = NavmeshTileIndex;
+			recordedTile.AdaptiveProbeStride = AdaptiveProbeStride;
+			recordedTile.SmallestAgentHeight = SmallestAgentHeight;
+			recordedTile.CoverPointGroundOffset = CoverPointGroundOffset;
+			recordedTile.Probes.Reserve(Probes.Num());
+			for (const FNavmeshCoverProbe& probe : Probes)
+			{
+				FCoverRecordedProbe& recordedProbe = recordedTile.Probes.AddDefaulted_GetRef();
+				recordedProbe.Location = probe.Location;
+				recordedProbe.Direction = probe.Direction;
+				recordedProbe.bRunStart = probe.bRunStart;
+			}
+		}
+
+		if (CoverSystem.bUseCollisionSnapshots)
+		{
+			// capture the collision within reach of the tile's traces once, then do every wave right here without touching the physics scene
+			// the snapshot is kept for the next tile along with its buffers
+			const float traceReach = NavmeshHoleCheckReach + CliffEdgeDistance + StraightCliffErrorTolerance;
+			if (!CollisionSnapshot.IsValid())
+				CollisionSnapshot = MakeUnique<FCoverCollisionSnapshot>(World, ECollisionChannel::ECC_GameTraceChannel1, CoverSystem.bVerifyCollisionSnapshots);
+
+			CollisionSnapshot->SetVerify(CoverSystem.bVerifyCollisionSnapshots);
+			CollisionSnapshot->Capture(NavmeshTileArea.ExpandBy(FVector(traceReach, traceReach, SmallestAgentHeight + NavMeshMaxZDistanceFromGround)));
+
+			FCoverSnapshotQueries snapshotQueries(World, *CollisionSnapshot);
+			if (QueryRecording.IsValid())
+			{
+				TCoverRecordingQueries<FCoverSnapshotQueries> recordingQueries(snapshotQueries, *QueryRecording);
+				TraceWaves(recordingQueries);
+			}
+			else
+			{
+				TraceWaves(snapshotQueries);
+			}
+		}
+		else if (QueryRecording.IsValid())
+		{
+			// the asynchronous waves would bypass the recording, so the scene gets traced right here instead
+			FCoverSceneQueries sceneQueries(World, ECollisionChannel::ECC_GameTraceChannel1);
+			TCoverRecordingQueries<FCoverSceneQueries> recordingQueries(sceneQueries, *QueryRecording);
+			TraceWaves(recordingQueries);
+		}
+		// otherwise, the probes are gathered here, then the cover system drives the trace waves from the game thread, freeing up this thread in the meantime
 	}
-	else
+
+	if (Stage == ENavmeshCoverGenerationStage::ResolveCoverPoints)
 	{
-		return;
+		// generate cover points
+		{
+			FScopedScratchGrowth scratchGrowth(ScratchGrowth, FNavmeshCoverGenerationScratch::Get());
+			ResolveCoverPoints(Commit.CoverPoints);
+		}
+		Stage = ENavmeshCoverGenerationStage::Done;
+
+		if (QueryRecording.IsValid())
+		{
+			const FString filePath = FPaths::Combine(CoverSystem.CoverQueryRecordingDirectory, FString::Printf(TEXT("Tile_%d_%u.coverqueries"), NavmeshTileIndex, JobId));
+			if (!QueryRecording->SaveToFile(filePath))
+				COVER_LOG(Warning, TEXT("Couldn't save the cover queries of navmesh tile %d to %s."), NavmeshTileIndex, *filePath);
+		}
+
+#if DEBUG_RENDERING
+		for (const FDTOCoverData& coverPoint : Commit.CoverPoints)
+			if (bDebugDraw)
+				DebugDraw.AddSphere(coverPoint.Location, 20.0f, FColor::Blue, true);
+#endif
+
+		// level-derived cover goes into the static layer shared with the other worlds of the map, if enabled
+		// otherwise, only what has changed since the tile was last generated is applied, so that unchanged cover points keep their ids and taken flags
+		// also removes any cover points that don't fall on the navmesh anymore, which happens when a newly placed cover object is placed on top of previously generated cover points
+		// the commit is batched with the other tiles that finish around the same time
+		bCommitPending = !CoverSystem.ShareStaticCover(NavmeshTileIndex, Commit.CoverPoints);
+		if (bCommitPending)
+		{
+			Commit.TileIdx = NavmeshTileIndex;
+			Commit.JobId = JobId;
+			Commit.TileArea = NavmeshTileArea;
+			Commit.DirtyAreas.Append(DirtyAreas);
+		}
 	}
 
 #if DEBUG_RENDERING
-	for (FDTOCoverData coverPoint : coverPoints)
-		if (bDebugDraw)
-			DrawDebugSphere(World, coverPoint.Location, 20.0f, 4, FColor::Blue, true);
+	CoverSystem.QueueDebugDraw(MoveTemp(DebugDraw));
 #endif
 
 	DEC_DWORD_STAT(STAT_TaskCount);
 }
+
+void FNavmeshCoverPointGeneratorTask::DoThreadedWork()
+{
+	// the counter belongs to the cover system, which waits for it before it lets go of its generators, see UCoverSubsystem::Deinitialize()
+	FThreadSafeCounter& runningStages = RunningStages;
+	FEvent* stagesDoneEvent = StagesDoneEvent;
+	if (UCoverSubsystem* coverSystem = World->GetSubsystem<UCoverSubsystem>())
+	{
+		{
+			FCoverAllocationScope allocationScope(AllocationCount);
+			DoWork(*coverSystem);
+		}
+
+		if (Stage == ENavmeshCoverGenerationStage::WallTraces)
+			coverSystem->SubmitCoverTraces(*this);
+		else if (bCommitPending)
+			coverSystem->QueueCoverTileCommit(*this);
+		else
+			coverSystem->OnCoverTileGenerated(*this);
+	}
+
+	if (runningStages.Decrement() == 0)
+		stagesDoneEvent->Trigger();
+}
+
+void FNavmeshCoverPointGeneratorTask::Abandon()
+{
+	DoThreadedWork();
+}
+
+void FNavmeshCoverPointGeneratorTask::ReportAllocations()
+{
+	// once the scratch of the threads involved and the generator's own buffers have grown to fit, a tile shouldn't allocate anymore
+	const int64 scratchGrowth = ScratchGrowth + (int64)GetAllocatedSize();
+	if (scratchGrowth > 0)
+	{
+		INC_DWORD_STAT(STAT_CoverAllocatingTaskCount);
+		INC_MEMORY_STAT_BY(STAT_CoverScratchMemory, scratchGrowth);
+	}
+
+	// everything else that the tile has allocated on the heap, by any thread, if counted
+	const int32 nAllocations = AllocationCount.GetValue();
+	if (nAllocations > 0)
+	{
+		INC_DWORD_STAT(STAT_CoverAllocatingTileCount);
+		INC_DWORD_STAT_BY(STAT_CoverTileAllocationCount, nAllocations);
+	}
+
+	COVER_LOG(Verbose, TEXT("Cover generation of navmesh tile %d: %d probes, %d cover points, scratch grown by %lld bytes, %s heap allocations."),
+		NavmeshTileIndex, ProbeCount, Commit.CoverPoints.Num(), scratchGrowth, FCoverAllocationCounter::IsInstalled() ? *FString::FromInt(nAllocations) : TEXT("uncounted"));
+}
@@ -21,16 +21,21 @@ private:
 	// Expand the bounding box of the object by this amount * ScanGridUnit, it's for when the navmesh around the object would exceed the object's bounds by too much.
 	const float BoundingBoxExpansion = 0.5f;
 
-#if DEBUG_RENDERING
-	bool bDebugDraw = false;
-#endif
-
 	// Cached here for easy access on BeginDestroy()
 	FBox OwnerBounds;
 
 	// Stores whether the navmesh has already been generated at least once.
 	bool bFirstNavmeshGeneration = true;
 
+	// Whether GenerateCoverPoints() has been called yet. The owner's cover isn't followed around before that.
+	bool bCoverGenerated = false;
+
+	// Transform of the owner when its cover points were last generated or moved.
+	FTransform LastCoverTransform;
+
+	// World time of the last regeneration started by UpdateCoverPoints().
+	float LastCoverRescanTime = -FLT_MAX;
+
 	// Called when the game starts
 	virtual void BeginPlay() override;
 
@@ -43,6 +48,28 @@ public:
 	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite)
 	bool bGeneratePerStaticMesh = false;
 
+	// Whether to find the ground with one top-down trace per column of the scan grid, which returns every surface of the column at once, rather than with one trace per grid point.
+	// Far fewer traces for tall actors; also finds surfaces that are closer together than ScanGridUnit vertically, which the per-point traces may step over.
+	// A column only gets one hit per collision shape, though, so columns through meshes that use their complex collision as simple are still scanned a grid point at a time.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite)
+	bool bScanColumns = false;
+
+	// Whether to keep the cover points in place relative to the owner while it moves, e.g. for vehicles and physics-driven props. See UpdateCoverPoints().
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite)
+	bool bFollowOwnerMovement = false;
+
+	// Distance, in units, that the owner may move away from where it was scanned before its cover is regenerated rather than moved along with it.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite)
+	float MaxCoverMoveDistance = 500.0f;
+
+	// Distance, in units, that the owner has to move before its cover points follow it.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite)
+	float CoverMoveTolerance = 10.0f;
+
+	// Minimum time between two regenerations of the owner's cover by UpdateCoverPoints(), in seconds. The cover points stay where they are in between.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite)
+	float MinCoverRescanInterval = 1.0f;
+
 	// Density of the scan grid (lower number -> more traces); Guideline: should be a bit less than the capsule radius of the smallest unit capable of getting into cover, which is normally == smallest radius used for navigation by the navmesh.
 	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite)
 	float ScanGridUnit = 75.0f;
@@ -62,4 +89,10 @@ public:
 	// Generates cover points around (and inside) the owner via an asynchronous CoverPointGeneratorTask, which automatically stores the results in the game mode's octree.
 	UFUNCTION(BlueprintCallable)
 	void GenerateCoverPoints();
+
+	// Moves the cover points along with the owner in a single batch, see UCoverSubsystem::MoveCoverPointsOfObject().
+	// Regenerates them instead if the owner has moved too far from where it was scanned, tilted or landed on something else, at most every MinCoverRescanInterval seconds.
+	// Called by TickComponent() when bFollowOwnerMovement is set.
+	UFUNCTION(BlueprintCallable)
+	void UpdateCoverPoints();
 };
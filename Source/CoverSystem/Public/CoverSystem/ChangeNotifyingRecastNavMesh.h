@@ -13,11 +13,12 @@
 
 // Fired every X seconds.
 // ChangedTiles contains tiles that have been updated since the last timer.
-DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FNavmeshTilesUpdatedBufferedDelegate, const TSet<uint32>&, ChangedTiles);
+// DirtyAreas contains the bounds of the modified geometry that overlap ChangedTiles. Tiles that don't overlap any of them have been rebuilt for some other reason, e.g. a full rebuild.
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FNavmeshTilesUpdatedBufferedDelegate, const TSet<uint32>&, ChangedTiles, const TArray<FBox>&, DirtyAreas);
 
-// Fired as tiles are updated.
-// ChangedTiles contains the same tiles as what get passed around inside Recast.
-DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FNavmeshTilesUpdatedImmediateDelegate, const TSet<uint32>&, ChangedTiles);
+// Fired as tiles are updated, right after Recast has added them to the navmesh.
+// ChangedTiles contains the same tiles as what get passed around inside Recast. DirtyAreas is the same as for FNavmeshTilesUpdatedBufferedDelegate.
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FNavmeshTilesUpdatedImmediateDelegate, const TSet<uint32>&, ChangedTiles, const TArray<FBox>&, DirtyAreas);
 
 // Fires once navigation generation is finished, i.e. there are no dirty tiles left.
 // ChangedTiles contains all the tiles that have been updated since the last time nav was finished.
@@ -36,6 +37,12 @@ protected:
 
 	TSet<uint32> UpdatedTilesUntilFinishedBuffer;
 
+	// Dirty areas whose tiles have been updated since the last timer.
+	TArray<FBox> DirtyAreasIntervalBuffer;
+
+	// Dirty areas that have been passed to Recast since navigation generation last finished. Their tiles may be rebuilt any time until then.
+	TArray<FBox> PendingDirtyAreas;
+
 	// Lock used for interval-buffered tile updates.
 	FCriticalSection TileUpdateLockObject;
 
@@ -65,6 +72,9 @@ public:
 	// This is worked around by buffering tile updates (see delegates).
 	virtual void OnNavMeshTilesUpdated(const TArray<uint32>& ChangedTiles) override;
 
+	// Called with the areas that Recast is about to rebuild. Remembers their bounds so that the tile updates can be narrowed down to them.
+	virtual void RebuildDirtyAreas(const TArray<FNavigationDirtyArea>& DirtyAreas) override;
+
 	// Broadcasts buffered tile updates every TileBufferInterval seconds via NavmeshTilesUpdatedDelegate. Thread-safe.
 	UFUNCTION()
 	void ProcessQueuedTiles();
@@ -0,0 +1,139 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/World.h"
+#include "WorldCollision.h"
+#include "Components/PrimitiveComponent.h"
+
+// Kinds of simple collision shapes held by FCoverCollisionSnapshot. Boxes are stored as convexes.
+enum class ECoverCollisionShapeType : uint8
+{
+	Convex,
+	Sphere,
+	Capsule
+};
+
+// A simple collision shape in world space.
+struct FCoverCollisionShape
+{
+	ECoverCollisionShapeType Type = ECoverCollisionShapeType::Convex;
+
+	// Range of the normalized, outward-facing planes of a convex among the planes of the snapshot, see FCoverCollisionSnapshot::Planes.
+	int32 PlaneStart = 0;
+	int32 PlaneCount = 0;
+
+	// Center of a sphere, or the two ends of the segment of a capsule.
+	FVector Start = FVector::ZeroVector;
+	FVector End = FVector::ZeroVector;
+
+	float Radius = 0.0f;
+
+	FBox Bounds = FBox(ForceInit);
+
+	TWeakObjectPtr<UPrimitiveComponent> Component;
+
+	// Unique id of the component's owner, for matching against FCollisionQueryParams::GetIgnoredActors().
+	uint32 ActorId = 0;
+
+	// Instance of an instanced static mesh that the shape belongs to, INDEX_NONE for other components. See FHitResult::Item.
+	int32 Item = INDEX_NONE;
+};
+
+// Node of the bounding volume hierarchy of FCoverCollisionSnapshot.
+struct FCoverCollisionNode
+{
+	FBox Bounds = FBox(ForceInit);
+
+	// Leaves: index of their first shape. Inner nodes: index of their first child, the second one comes right after it.
+	int32 Start = 0;
+
+	// Number of shapes of a leaf, 0 for inner nodes.
+	int32 Count = 0;
+};
+
+/**
+ * Snapshot of the simple collision inside an area, for tracing against without touching the physics scene.
+ * Captured once per tile or actor by the cover generators, then traced on their worker thread through a compact bounding volume hierarchy,
+ * so that they don't contend on the scene locks with the game thread's own physics.
+ * A snapshot may be captured again for another area, which keeps the allocations of its buffers, see FNavmeshCoverPointGeneratorTask.
+ * Only static meshes, shapes and brushes are captured. The rest, e.g. skeletal meshes, and components without simple collision, e.g. landscapes or meshes
+ * that use their complex collision as simple, can't be: traces that come near them go to the physics scene instead.
+ */
+class COVERSYSTEM_API FCoverCollisionSnapshot
+{
+public:
+	FCoverCollisionSnapshot(UWorld* _World, ECollisionChannel _Channel, bool _bVerify);
+
+	// Captures the simple collision of the components inside the area that block the channel, replacing whatever has been captured before. Thread-safe as far as scene queries go.
+	void Capture(const FBox& Area);
+
+	// Captures the simple collision of a single component, or of one of its instances if it's an instanced static mesh, placed with the supplied transform,
+	// along with a flat ground slab across the area whose top is at GroundZ and which belongs to no actor. Nothing else is captured: traces only see the component on the ground.
+	// Returns false, leaving the snapshot empty, if the component doesn't block the channel or its collision can't be captured, e.g. it uses its complex collision as simple.
+	bool CaptureComponent(UPrimitiveComponent* Component, int32 Item, const FTransform& ComponentTransform, const FBox& Area, float GroundZ);
+
+	FORCEINLINE void SetVerify(bool _bVerify) { bVerify = _bVerify; }
+
+	// Same as UWorld::LineTraceSingleByChannel() on the captured area: returns true on a blocking hit, filling out the main fields of OutHit.
+	// Only the ignored actors and bFindInitialOverlaps of QueryParams are taken into account, unless the trace has to go to the physics scene.
+	bool LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams) const;
+
+	// Every shape that the trace enters, nearest first, as non-blocking hits: same as UWorld::LineTraceMultiByChannel() with every response set to overlap.
+	// Returns true if anything was hit.
+	bool LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams) const;
+
+private:
+	// Shapes per leaf of the hierarchy.
+	const int32 ShapesPerLeaf = 4;
+
+	// Thickness of the ground slab of CaptureComponent().
+	const float GroundThickness = 10.0f;
+
+	// Distance, in units, that the hits of the snapshot and the scene may differ by before they're reported as a mismatch. See bVerify.
+	const float VerifyTolerance = 1.0f;
+
+	UWorld* World;
+
+	ECollisionChannel Channel;
+
+	// Whether to repeat every trace against the physics scene and report the differences. For checking the snapshot against the scene-query path.
+	bool bVerify;
+
+	TArray<FCoverCollisionShape> Shapes;
+
+	// Planes of every captured convex, in a single array so that capturing doesn't allocate per shape. See FCoverCollisionShape::PlaneStart.
+	TArray<FPlane> Planes;
+
+	TArray<FCoverCollisionNode> Nodes;
+
+	// Bounds of the components that couldn't be captured.
+	TArray<FBox> FallbackBounds;
+
+	// Working sets of Capture(): the overlapping components, the bodies captured so far and the planes of the convex being captured.
+	TArray<FOverlapResult> Overlaps;
+	TSet<TPair<UPrimitiveComponent*, int32>> CapturedBodies;
+	TArray<FPlane> ConvexPlanes;
+
+	// Empties the snapshot, keeping the allocations of its buffers.
+	void Reset();
+
+	// Builds the bounding volume hierarchy of the captured shapes.
+	void BuildHierarchy();
+
+	// Adds the simple collision shapes of the component, or of one of its instances if it's an instanced static mesh, placed with the supplied transform.
+	// Returns false if the component's collision can't be captured, e.g. it's not a static mesh, shape or brush, in which case nothing is added.
+	bool AddComponentShapes(UPrimitiveComponent* Component, const FTransform& ComponentTransform, int32 Item);
+
+	// Splits the shapes between Start and Start + Count along their longest axis until they fit into a leaf.
+	void BuildNode(int32 NodeIdx, int32 Start, int32 Count);
+
+	// Calls Visitor(Shape, Time, Normal, bStartInside) for every captured shape that the trace hits, in no particular order.
+	// Shapes of ignored actors are skipped, and so are the ones the trace starts inside of unless bFindInitialOverlaps.
+	template<typename VisitorType>
+	void VisitShapeHits(const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams, VisitorType&& Visitor) const;
+
+	// Traces the captured shapes through the hierarchy.
+	bool TraceShapes(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams) const;
+};
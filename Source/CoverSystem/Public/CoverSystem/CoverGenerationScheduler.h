@@ -0,0 +1,93 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Entry of the pending job queue, which is a min-heap on Priority.
+struct FCoverTileQueueEntry
+{
+	uint32 TileIdx;
+
+	// Job the entry has been pushed for. Entries of jobs that have been replaced since are skipped.
+	uint32 JobId;
+
+	// Squared distance of the tile to the closest point of interest. Lower values get generated first.
+	float Priority;
+
+	FCoverTileQueueEntry()
+		: TileIdx(0), JobId(0), Priority(0.0f)
+	{}
+
+	FCoverTileQueueEntry(uint32 _TileIdx, uint32 _JobId, float _Priority)
+		: TileIdx(_TileIdx), JobId(_JobId), Priority(_Priority)
+	{}
+
+	FORCEINLINE bool operator<(const FCoverTileQueueEntry& Other) const
+	{
+		return Priority < Other.Priority;
+	}
+};
+
+// Jobs of a single tile.
+struct FCoverTileJobs
+{
+	// The most recently scheduled job of the tile. Running jobs with any other id have been superseded.
+	uint32 LatestJobId = 0;
+
+	// Whether LatestJobId is waiting in the queue.
+	bool bPending = false;
+
+	// Number of jobs of the tile that have been popped but haven't finished yet, superseded ones included.
+	int32 RunningCount = 0;
+};
+
+/**
+ * Schedules the cover generation jobs of navmesh tiles.
+ * Keeps at most one pending job per tile: scheduling a tile again replaces its pending job and supersedes the running ones, which are expected to poll IsSuperseded() and bail out.
+ * Pending jobs are run closest to the points of interest first, on no more than WorkerLimit workers at a time.
+ * Not thread-safe, UCoverSubsystem guards it with CoverTileLockObject.
+ */
+class COVERSYSTEM_API FCoverGenerationScheduler
+{
+public:
+	// Schedules a job for the tile.
+	void Schedule(uint32 TileIdx, float Priority);
+
+	// Pops the most urgent pending job if there's a free worker. The job takes up a worker until ReleaseWorker() is called, and counts as running until Finish() is called.
+	bool Pop(uint32& OutTileIdx, uint32& OutJobId);
+
+	// Called once a job has finished with the tile, whether it's been superseded or not.
+	void Finish(uint32 TileIdx);
+
+	// Jobs don't need a worker while they're waiting on something else, e.g. on asynchronous traces.
+	void AcquireWorker();
+	void ReleaseWorker();
+
+	// Recomputes the priorities of the pending jobs, e.g. because the points of interest have moved.
+	void Reprioritize(TFunctionRef<float(uint32 TileIdx)> GetPriority);
+
+	// Returns true if the job is no longer the latest one of its tile.
+	bool IsSuperseded(uint32 TileIdx, uint32 JobId) const;
+
+	// Returns true if the tile has a pending or running job.
+	bool IsBusy(uint32 TileIdx) const;
+
+	void SetWorkerLimit(int32 _WorkerLimit);
+
+	int32 GetPendingJobCount() const;
+
+private:
+	TArray<FCoverTileQueueEntry> Queue;
+
+	TMap<uint32, FCoverTileJobs> TileJobs;
+
+	int32 WorkerLimit = 1;
+
+	int32 BusyWorkerCount = 0;
+
+	int32 PendingJobCount = 0;
+
+	// Job ids are unique across tiles and never reused, so a finished tile's jobs can be forgotten.
+	uint32 NextJobId = 1;
+};
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Stable ids of the instances of an instanced static mesh by their current index, so that cover points can be keyed on something that doesn't change when other instances are removed.
+ * Ids are handed out in the order the instances have been added in, which is also their index order until one of them is removed:
+ * - HISMs move their last instance into a removed one's slot, which is a swap of two ids.
+ * - ISMs shift every later instance down by one, which keeps the ids in index order. Their ids are never rewritten: a Fenwick tree counts the ids still alive,
+ *   and the index of an instance is the number of alive ids before its own, so both looking up and removing an instance are O(log n).
+ * Not thread-safe, UCoverSubsystem guards it with CoverDataLockObject.
+ */
+class COVERSYSTEM_API FCoverInstanceIds
+{
+public:
+	// Whether the instances are renumbered the way HISMs renumber them, rather than ISMs.
+	explicit FCoverInstanceIds(bool _bSwapRemove);
+
+	// Returns the id of the instance at the index. Indices past the known instances are taken to be instances added since, and get new ids.
+	int32 GetId(int32 InstanceIndex);
+
+	// Forgets the instance at the index and renumbers the rest the way the component does. InstanceCount is the number of instances before the removal.
+	// Returns the id of the removed instance.
+	int32 Remove(int32 InstanceIndex, int32 InstanceCount);
+
+	// Returns true if the instance with the id hasn't been removed.
+	bool IsAlive(int32 Id) const;
+
+	// Number of ids handed out so far, removed ones included. Ids go from 0 to this.
+	FORCEINLINE int32 GetIdCount() const { return IdCount; }
+
+private:
+	bool bSwapRemove;
+
+	// Id of each instance by index, and whether each id is still alive, if bSwapRemove.
+	TArray<int32> Ids;
+	TBitArray<> AliveIds;
+
+	// Number of ids handed out so far.
+	int32 IdCount = 0;
+
+	// Fenwick tree of the ids that are still alive, unless bSwapRemove. Node i (1-based) counts the alive ids in (i - LowestBit(i), i].
+	TArray<int32> AliveTree;
+
+	// Number of alive ids, i.e. number of known instances.
+	int32 AliveCount = 0;
+
+	// Hands out the id of a newly added instance.
+	void AddId();
+
+	// Number of alive ids below Id.
+	int32 CountAliveBelow(int32 Id) const;
+
+	// Id of the alive instance that has InstanceIndex alive ids below it.
+	int32 FindAlive(int32 InstanceIndex) const;
+};
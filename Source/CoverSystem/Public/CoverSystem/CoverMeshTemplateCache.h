@@ -0,0 +1,79 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectKey.h"
+
+class UStaticMesh;
+
+// What the cover template of a static mesh depends on: the mesh, the scale it's placed with and the parameters of the scan grid.
+struct FCoverMeshTemplateKey
+{
+	FObjectKey Mesh;
+
+	// Snapped to ScaleTolerance, so that instances placed with the same scale share a template despite rounding errors.
+	FVector Scale;
+
+	float ScanGridUnit;
+
+	float SmallestAgentHeight;
+
+	float BoundingBoxExpansion;
+
+	bool bScanColumns;
+
+	FCoverMeshTemplateKey(const UStaticMesh* _Mesh, const FVector& _Scale, float _ScanGridUnit, float _SmallestAgentHeight, float _BoundingBoxExpansion, bool _bScanColumns)
+		: Mesh(_Mesh), Scale(_Scale.GridSnap(ScaleTolerance)), ScanGridUnit(_ScanGridUnit), SmallestAgentHeight(_SmallestAgentHeight), BoundingBoxExpansion(_BoundingBoxExpansion), bScanColumns(_bScanColumns)
+	{}
+
+	bool operator==(const FCoverMeshTemplateKey& Other) const
+	{
+		return Mesh == Other.Mesh && Scale == Other.Scale && ScanGridUnit == Other.ScanGridUnit && SmallestAgentHeight == Other.SmallestAgentHeight
+			&& BoundingBoxExpansion == Other.BoundingBoxExpansion && bScanColumns == Other.bScanColumns;
+	}
+
+	friend uint32 GetTypeHash(const FCoverMeshTemplateKey& Key)
+	{
+		uint32 hash = HashCombine(GetTypeHash(Key.Mesh), GetTypeHash(Key.Scale));
+		hash = HashCombine(hash, GetTypeHash(Key.ScanGridUnit));
+		hash = HashCombine(hash, GetTypeHash(Key.SmallestAgentHeight));
+		hash = HashCombine(hash, GetTypeHash(Key.BoundingBoxExpansion));
+		return HashCombine(hash, GetTypeHash(Key.bScanColumns));
+	}
+
+private:
+	static constexpr float ScaleTolerance = 0.01f;
+};
+
+// Cover candidates of a static mesh in the local space of its component: the free ground points next to it that a scan of the mesh on its own, on flat ground, found, before navmesh projection.
+struct FCoverMeshTemplate
+{
+	TArray<FVector> Candidates;
+};
+
+/**
+ * Cover templates of the static meshes scanned so far, so that every instance of the same mesh only has to validate the candidates of the template
+ * against their own surroundings rather than scan their bounds. See UCoverSubsystem::bUseMeshCoverTemplates. Thread-safe.
+ */
+class COVERSYSTEM_API FCoverMeshTemplateCache
+{
+public:
+	// Returns the template, or null if no instance of the mesh has been scanned with the same key yet.
+	TSharedPtr<const FCoverMeshTemplate, ESPMode::ThreadSafe> Find(const FCoverMeshTemplateKey& Key) const;
+
+	// Adds a template. The first one to be added wins, as instances that are scanned at the same time come up with equivalent ones.
+	void Add(const FCoverMeshTemplateKey& Key, TSharedRef<const FCoverMeshTemplate, ESPMode::ThreadSafe> Template);
+
+	void Empty();
+
+	// Estimated memory used by the templates.
+	int64 GetAllocatedSize() const;
+
+private:
+	mutable FRWLock CacheLockObject;
+
+	TMap<FCoverMeshTemplateKey, TSharedRef<const FCoverMeshTemplate, ESPMode::ThreadSafe>> Templates;
+
+	int64 AllocatedSize = 0;
+};
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Components/InstancedStaticMeshComponent.h"
 #include "DTOCoverData.h"
 
 struct FCoverPointOctreeData : public TSharedFromThis<FCoverPointOctreeData, ESPMode::ThreadSafe>
@@ -19,14 +20,23 @@ public:
 	// Object that generated this cover point
 	const TWeakObjectPtr<AActor> CoverObject;
 
+	// Navmesh tile that generated this cover point, INDEX_NONE for cover points of actors
+	const int32 TileIndex;
+
+	// Instanced static mesh that generated this cover point, if it was generated per instance.
+	const TWeakObjectPtr<UInstancedStaticMeshComponent> InstancedMesh;
+
+	// Stable id of the instance of InstancedMesh that generated this cover point, INDEX_NONE otherwise. See FCoverInstanceIds.
+	const int32 InstanceId;
+
 	// Whether the cover point is taken by a unit
 	bool bTaken = false;
 
 	FCoverPointOctreeData()
-		: Location(), bForceField(false), CoverObject(), bTaken(false)
+		: Location(), bForceField(false), CoverObject(), TileIndex(INDEX_NONE), InstancedMesh(), InstanceId(INDEX_NONE), bTaken(false)
 	{}
 
 	FCoverPointOctreeData(FDTOCoverData CoverData)
-		: Location(CoverData.Location), bForceField(CoverData.bForceField), CoverObject(CoverData.CoverObject), bTaken(false)
+		: Location(CoverData.Location), bForceField(CoverData.bForceField), CoverObject(CoverData.CoverObject), TileIndex(CoverData.TileIndex), InstancedMesh(CoverData.InstancedMesh), InstanceId(CoverData.InstanceIndex), bTaken(false)
 	{}
 };
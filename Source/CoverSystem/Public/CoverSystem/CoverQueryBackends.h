@@ -0,0 +1,410 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/World.h"
+#include "WorldCollision.h"
+#include "NavigationSystem.h"
+#include "CoverSystem/CoverCollisionSnapshot.h"
+
+class ALandscapeProxy;
+
+/**
+ * Query backends of the cover generators, i.e. what their traces and navmesh projections run against.
+ * The generation algorithms are templated on the backend, so each query is a direct, inlinable call rather than a virtual one.
+ * A backend provides:
+ *	bool LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams), see UWorld::LineTraceSingleByChannel().
+ *	bool LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams), every surface that blocks the channel and that the trace enters,
+ *		nearest first, as non-blocking hits; see UWorld::LineTraceMultiByChannel() with every response set to overlap. Returns true if anything was hit.
+ *	bool ProjectPointToNavigation(FVector& OutLocation, const FVector& Point, const FVector& Extent), see UNavigationSystemV1::ProjectPointToNavigation().
+ *	bool HitsComplexAsSimple(const TArray<FHitResult>& Hits), whether any of the hits of the last LineTraceMulti() is of a component that uses its triangle mesh as simple collision,
+ *		of which a multi-hit trace only reports the first surface it enters.
+ */
+
+// Every query goes to the live world.
+class COVERSYSTEM_API FCoverSceneQueries
+{
+public:
+	FCoverSceneQueries(UWorld* _World, ECollisionChannel _Channel)
+		: World(_World), NavSys(UNavigationSystemV1::GetCurrent(_World)), Channel(_Channel)
+	{}
+
+	FORCEINLINE bool LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+	{
+		return World->LineTraceSingleByChannel(OutHit, Start, End, Channel, QueryParams);
+	}
+
+	FORCEINLINE bool LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+	{
+		// a multi-trace stops at the first blocking hit, so every hit is made a touch
+		OutHits.Reset();
+		World->LineTraceMultiByChannel(OutHits, Start, End, Channel, QueryParams, FCollisionResponseParams(ECR_Overlap));
+
+		// which also lets through the components that only overlap the channel, rather than block it
+		const ECollisionChannel channel = Channel;
+		OutHits.RemoveAll([channel](const FHitResult& Hit)
+		{
+			const UPrimitiveComponent* component = Hit.GetComponent();
+			return !component || component->GetCollisionResponseToChannel(channel) != ECR_Block;
+		});
+		return OutHits.Num() > 0;
+	}
+
+	FORCEINLINE bool ProjectPointToNavigation(FVector& OutLocation, const FVector& Point, const FVector& Extent)
+	{
+		FNavLocation navLocation;
+		if (!NavSys || !NavSys->ProjectPointToNavigation(Point, navLocation, Extent))
+			return false;
+
+		OutLocation = navLocation.Location;
+		return true;
+	}
+
+	FORCEINLINE bool HitsComplexAsSimple(const TArray<FHitResult>& Hits)
+	{
+		return AnyHitUsesComplexAsSimple(Hits);
+	}
+
+	// Whether any of the hits is of a component that uses its triangle mesh as simple collision. Shared with FCoverSnapshotQueries.
+	static bool AnyHitUsesComplexAsSimple(const TArray<FHitResult>& Hits);
+
+	// The landscapes that the traces inside the area may hit, for sampling their heightfields instead. Only the game thread may read the heightfields.
+	void GetLandscapes(TArray<ALandscapeProxy*>& OutLandscapes, const FBox& Area);
+
+private:
+	UWorld* World;
+
+	UNavigationSystemV1* NavSys;
+
+	ECollisionChannel Channel;
+};
+
+// Traces go to a collision snapshot, see FCoverCollisionSnapshot. Navmesh projections still go to the live world.
+class COVERSYSTEM_API FCoverSnapshotQueries
+{
+public:
+	FCoverSnapshotQueries(UWorld* _World, const FCoverCollisionSnapshot& _Snapshot)
+		: Snapshot(_Snapshot), NavSys(UNavigationSystemV1::GetCurrent(_World))
+	{}
+
+	FORCEINLINE bool LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+	{
+		return Snapshot.LineTrace(OutHit, Start, End, QueryParams);
+	}
+
+	FORCEINLINE bool LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+	{
+		return Snapshot.LineTraceMulti(OutHits, Start, End, QueryParams);
+	}
+
+	FORCEINLINE bool ProjectPointToNavigation(FVector& OutLocation, const FVector& Point, const FVector& Extent)
+	{
+		FNavLocation navLocation;
+		if (!NavSys || !NavSys->ProjectPointToNavigation(Point, navLocation, Extent))
+			return false;
+
+		OutLocation = navLocation.Location;
+		return true;
+	}
+
+	FORCEINLINE bool HitsComplexAsSimple(const TArray<FHitResult>& Hits)
+	{
+		return FCoverSceneQueries::AnyHitUsesComplexAsSimple(Hits);
+	}
+
+private:
+	const FCoverCollisionSnapshot& Snapshot;
+
+	UNavigationSystemV1* NavSys;
+};
+
+// Kinds of queries of FCoverQueryRecord.
+enum class ECoverQueryType : uint8
+{
+	LineTrace,
+	ProjectPointToNavigation,
+	LineTraceMulti,
+	// A hit of the LineTraceMulti record right before it.
+	LineTraceMultiHit
+};
+
+// A single query of a recorded run, along with its result.
+struct FCoverQueryRecord
+{
+	ECoverQueryType Type = ECoverQueryType::LineTrace;
+
+	// Start and end of a trace, or the point and the extent of a navmesh projection.
+	FVector Start = FVector::ZeroVector;
+	FVector End = FVector::ZeroVector;
+
+	bool bResult = false;
+
+	// Impact point of a trace, or the projected location.
+	FVector Location = FVector::ZeroVector;
+
+	FVector Normal = FVector::ZeroVector;
+
+	float Time = 1.0f;
+
+	bool bStartPenetrating = false;
+
+	// Number of LineTraceMultiHit records that follow a LineTraceMulti one.
+	int32 HitCount = 0;
+
+	// Object hit by a trace, by index into FCoverQueryRecording::Objects, or INDEX_NONE.
+	int32 ObjectId = INDEX_NONE;
+
+	// Whether any of the hits of a LineTraceMulti record is of a complex-as-simple collision, as told by HitsComplexAsSimple().
+	bool bComplexAsSimple = false;
+
+	friend FArchive& operator<<(FArchive& Ar, FCoverQueryRecord& Record);
+};
+
+// An object hit by the recorded traces, which stands in for the actor when the recording is replayed.
+struct FCoverRecordedObject
+{
+	FString Name;
+
+	// Whether it's a force field (shield), see FDTOCoverData::bForceField.
+	bool bForceField = false;
+
+	friend FArchive& operator<<(FArchive& Ar, FCoverRecordedObject& Object);
+};
+
+// A probe of a recorded navmesh tile, before any of its traces. See FNavmeshCoverProbe.
+struct FCoverRecordedProbe
+{
+	FVector Location = FVector::ZeroVector;
+
+	FVector Direction = FVector::ZeroVector;
+
+	bool bRunStart = false;
+
+	friend FArchive& operator<<(FArchive& Ar, FCoverRecordedProbe& Probe);
+};
+
+// What FNavmeshCoverPointGeneratorTask::Replay() needs of a recorded navmesh tile on top of its queries.
+struct FCoverRecordedTile
+{
+	int32 NavmeshTileIndex = INDEX_NONE;
+
+	// See FNavmeshCoverPointGeneratorTask.
+	int32 AdaptiveProbeStride = 1;
+	float SmallestAgentHeight = 0.0f;
+	float CoverPointGroundOffset = 0.0f;
+
+	// Probes of the tile, in edge step order.
+	TArray<FCoverRecordedProbe> Probes;
+
+	friend FArchive& operator<<(FArchive& Ar, FCoverRecordedTile& Tile);
+};
+
+// A scan of a recorded actor: the bounds of a scan grid, already expanded, or the candidates of a cover template, placed in the world.
+struct FCoverRecordedScan
+{
+	FBox Bounds = FBox(ForceInit);
+
+	TArray<FVector> Candidates;
+
+	bool bTemplate = false;
+
+	// Instance of an instanced static mesh that the scan is of, whose cover points are deduplicated on their own, or INDEX_NONE.
+	int32 InstanceIndex = INDEX_NONE;
+
+	friend FArchive& operator<<(FArchive& Ar, FCoverRecordedScan& Scan);
+};
+
+// What FActorCoverPointGeneratorTask::Replay() needs of a recorded actor on top of its queries.
+struct FCoverRecordedActor
+{
+	// The actor itself, by index into FCoverQueryRecording::Objects.
+	int32 OwnerId = INDEX_NONE;
+
+	// See FActorCoverPointGeneratorTask.
+	float ScanGridUnit = 0.0f;
+	float SmallestAgentHeight = 0.0f;
+	bool bScanColumns = false;
+
+	// Scans of the actor, in order.
+	TArray<FCoverRecordedScan> Scans;
+
+	friend FArchive& operator<<(FArchive& Ar, FCoverRecordedActor& Actor);
+};
+
+// A cover point generated by replaying a recording, along with its cover object, by index into FCoverQueryRecording::Objects.
+struct FCoverReplayedPoint
+{
+	FVector Location;
+
+	int32 ObjectId;
+
+	FCoverReplayedPoint(const FVector& _Location, int32 _ObjectId)
+		: Location(_Location), ObjectId(_ObjectId)
+	{}
+};
+
+/**
+ * The queries of a generator run, in order, along with what the generator needs to run again from them without a world: the objects they've hit,
+ * and either the probes of a navmesh tile or the scans of an actor. See TCoverRecordingQueries and FCoverReplayQueries.
+ * Recordings of navmesh tiles are replayed by FNavmeshCoverPointGeneratorTask::Replay(), those of actors by FActorCoverPointGeneratorTask::Replay().
+ */
+struct COVERSYSTEM_API FCoverQueryRecording
+{
+	TArray<FCoverQueryRecord> Records;
+
+	TArray<FCoverRecordedObject> Objects;
+
+	// Set by the navmesh tile generator.
+	FCoverRecordedTile Tile;
+
+	// Set by the actor generator.
+	FCoverRecordedActor Actor;
+
+	// Id of the object in Objects, added if it isn't there yet. INDEX_NONE for null.
+	int32 AddObject(const AActor* Object);
+
+	// Whether the recording is of a navmesh tile rather than of an actor.
+	FORCEINLINE bool IsTileRecording() const { return Tile.NavmeshTileIndex != INDEX_NONE; }
+
+	bool SaveToFile(const FString& FilePath) const;
+
+	bool LoadFromFile(const FString& FilePath);
+
+private:
+	// Ids of the objects added so far, while recording.
+	TMap<const AActor*, int32> ObjectIds;
+};
+
+// Passes every query on to another backend and records it along with its result.
+template<typename QueriesType>
+class TCoverRecordingQueries
+{
+public:
+	TCoverRecordingQueries(QueriesType& _Queries, FCoverQueryRecording& _Recording)
+		: Queries(_Queries), Recording(_Recording)
+	{}
+
+	FORCEINLINE bool LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+	{
+		const bool bResult = Queries.LineTrace(OutHit, Start, End, QueryParams);
+
+		FCoverQueryRecord& record = Recording.Records.AddDefaulted_GetRef();
+		record.Type = ECoverQueryType::LineTrace;
+		record.Start = Start;
+		record.End = End;
+		record.bResult = bResult;
+		record.Location = OutHit.ImpactPoint;
+		record.Normal = OutHit.ImpactNormal;
+		record.Time = OutHit.Time;
+		record.bStartPenetrating = OutHit.bStartPenetrating;
+		record.ObjectId = bResult ? Recording.AddObject(OutHit.GetActor()) : INDEX_NONE;
+		return bResult;
+	}
+
+	FORCEINLINE bool LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams)
+	{
+		const bool bResult = Queries.LineTraceMulti(OutHits, Start, End, QueryParams);
+
+		LastMultiRecordIdx = Recording.Records.Num();
+		FCoverQueryRecord& record = Recording.Records.AddDefaulted_GetRef();
+		record.Type = ECoverQueryType::LineTraceMulti;
+		record.Start = Start;
+		record.End = End;
+		record.bResult = bResult;
+		record.HitCount = OutHits.Num();
+		for (const FHitResult& hit : OutHits)
+		{
+			FCoverQueryRecord& hitRecord = Recording.Records.AddDefaulted_GetRef();
+			hitRecord.Type = ECoverQueryType::LineTraceMultiHit;
+			hitRecord.Start = Start;
+			hitRecord.End = End;
+			hitRecord.bResult = hit.bBlockingHit;
+			hitRecord.Location = hit.ImpactPoint;
+			hitRecord.Normal = hit.ImpactNormal;
+			hitRecord.Time = hit.Time;
+			hitRecord.bStartPenetrating = hit.bStartPenetrating;
+			hitRecord.ObjectId = Recording.AddObject(hit.GetActor());
+		}
+
+		return bResult;
+	}
+
+	FORCEINLINE bool ProjectPointToNavigation(FVector& OutLocation, const FVector& Point, const FVector& Extent)
+	{
+		FCoverQueryRecord& record = Recording.Records.AddDefaulted_GetRef();
+		record.Type = ECoverQueryType::ProjectPointToNavigation;
+		record.Start = Point;
+		record.End = Extent;
+		record.bResult = Queries.ProjectPointToNavigation(OutLocation, Point, Extent);
+		record.Location = OutLocation;
+		return record.bResult;
+	}
+
+	// Goes along with the LineTraceMulti record that it's asked about.
+	FORCEINLINE bool HitsComplexAsSimple(const TArray<FHitResult>& Hits)
+	{
+		const bool bComplexAsSimple = Queries.HitsComplexAsSimple(Hits);
+		if (Recording.Records.IsValidIndex(LastMultiRecordIdx))
+			Recording.Records[LastMultiRecordIdx].bComplexAsSimple = bComplexAsSimple;
+
+		return bComplexAsSimple;
+	}
+
+private:
+	QueriesType& Queries;
+
+	FCoverQueryRecording& Recording;
+
+	// Record of the last LineTraceMulti().
+	int32 LastMultiRecordIdx = INDEX_NONE;
+};
+
+/**
+ * Serves the queries of a recording in order instead of running them, so that a generator that makes the same queries as the recorded run gets the same results,
+ * without a world, e.g. for benchmarking the generation algorithms headless. Hits carry no actor or component; see GetLastHitObjectId() instead.
+ * A query that doesn't match the next record, e.g. because the algorithm has changed since, is counted as a mismatch and doesn't hit anything; the record is kept for the next query.
+ */
+class COVERSYSTEM_API FCoverReplayQueries
+{
+public:
+	FCoverReplayQueries(const FCoverQueryRecording& _Recording)
+		: Recording(_Recording)
+	{}
+
+	bool LineTrace(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams);
+
+	bool LineTraceMulti(TArray<FHitResult>& OutHits, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams);
+
+	bool ProjectPointToNavigation(FVector& OutLocation, const FVector& Point, const FVector& Extent);
+
+	FORCEINLINE bool HitsComplexAsSimple(const TArray<FHitResult>& Hits) const { return bLastComplexAsSimple; }
+
+	// Object hit by the last LineTrace(), by index into FCoverQueryRecording::Objects, or INDEX_NONE.
+	FORCEINLINE int32 GetLastHitObjectId() const { return LastHitObjectId; }
+
+	FORCEINLINE int32 GetMismatchCount() const { return MismatchCount; }
+
+	// Whether every record has been served, i.e. the replayed run has made all of the recorded queries.
+	FORCEINLINE bool IsFinished() const { return NextRecordIdx == Recording.Records.Num(); }
+
+private:
+	const FCoverQueryRecording& Recording;
+
+	int32 NextRecordIdx = 0;
+
+	int32 MismatchCount = 0;
+
+	int32 LastHitObjectId = INDEX_NONE;
+
+	bool bLastComplexAsSimple = false;
+
+	// How far the start and end of a replayed query may be from the recorded ones, for rounding differences between platforms.
+	static constexpr float MatchTolerance = 0.1f;
+
+	// Takes the next record if it's of the query, otherwise counts a mismatch and returns null.
+	const FCoverQueryRecord* TakeRecord(ECoverQueryType Type, const FVector& Start, const FVector& End);
+
+	// Fills in a hit of a trace from its record.
+	static void FillHit(FHitResult& OutHit, const FCoverQueryRecord& Record);
+};
@@ -0,0 +1,69 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// A cover point of the static layer. Refers to its cover object by name, so that every world of the map can resolve it to its own copy of the actor.
+struct FCoverStaticPoint
+{
+	FVector Location;
+
+	// Name of the actor that generated this cover point.
+	FName CoverObjectName;
+
+	// Package name of the level the cover object lives in, without the PIE prefix.
+	FName CoverObjectLevelName;
+
+	bool bForceField;
+
+	FCoverStaticPoint()
+		: Location(), CoverObjectName(), CoverObjectLevelName(), bForceField()
+	{}
+
+	FCoverStaticPoint(FVector _Location, FName _CoverObjectName, FName _CoverObjectLevelName, bool _bForceField)
+		: Location(_Location), CoverObjectName(_CoverObjectName), CoverObjectLevelName(_CoverObjectLevelName), bForceField(_bForceField)
+	{}
+};
+
+// Immutable cover of a single navmesh tile, as generated from the level on the tile's first build.
+struct FCoverStaticTile
+{
+	TArray<FCoverStaticPoint> CoverPoints;
+};
+
+/**
+ * Process-wide, immutable cover shared by reference among every world of the same map, e.g. sessions on a dedicated server or PIE clients.
+ * Tiles are keyed by their navmesh tile coordinates, which are identical across worlds of the same map unlike tile indices. Thread-safe.
+ * Per-world state such as taken flags lives in UCoverSubsystem.
+ */
+class COVERSYSTEM_API FCoverStaticLayer
+{
+public:
+	// Returns the layer of the supplied map, creating it if no other world of the map holds one at the moment.
+	static TSharedRef<FCoverStaticLayer, ESPMode::ThreadSafe> Get(const FString& MapName);
+
+	// Returns the cover of the tile, or null if no world has shared it yet.
+	TSharedPtr<const FCoverStaticTile, ESPMode::ThreadSafe> FindTile(const FIntVector& TileCoord) const;
+
+	bool HasTile(const FIntVector& TileCoord) const;
+
+	// Adds the cover of a tile. The first world to add a tile wins, later additions are ignored as they contain the same cover.
+	void AddTile(const FIntVector& TileCoord, TSharedRef<const FCoverStaticTile, ESPMode::ThreadSafe> Tile);
+
+	// Estimated memory used by the layer.
+	int64 GetAllocatedSize() const;
+
+private:
+	mutable FRWLock LayerLockObject;
+
+	TMap<FIntVector, TSharedRef<const FCoverStaticTile, ESPMode::ThreadSafe>> Tiles;
+
+	int64 AllocatedSize = 0;
+
+	// Lock for Registry.
+	static FCriticalSection RegistryLockObject;
+
+	// Layers by map name. Layers are freed once the last world of their map lets go of them.
+	static TMap<FString, TWeakPtr<FCoverStaticLayer, ESPMode::ThreadSafe>> Registry;
+};
@@ -3,11 +3,18 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Containers/Queue.h"
 #include "CoverSystem/CoverOctree.h"
 #include "CoverSystem/ChangeNotifyingRecastNavMesh.h"
 #include "NavigationSystem.h"
 #include "NavigationOctree.h"
 #include "CoverSystem/DTOCoverData.h"
+#include "CoverSystem/CoverTile.h"
+#include "CoverSystem/CoverGenerationScheduler.h"
+#include "CoverSystem/CoverStaticLayer.h"
+#include "CoverSystem/CoverMeshTemplateCache.h"
+#include "CoverSystem/CoverInstanceIds.h"
+#include "Debug/CoverDebugDrawBuffer.h"
 #include "CoverSubsystem.generated.h"
 
 // PROFILER INTEGRATION //
@@ -19,11 +26,114 @@ DECLARE_CYCLE_STAT_EXTERN(TEXT("Generate Cover / GenerateCoverInBounds"), STAT_G
 DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Historical Count"), STAT_GenerateCoverHistoricalCount, STATGROUP_CoverSystem);
 DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Generate Cover - Total Time Spent"), STAT_GenerateCoverAverageTime, STATGROUP_CoverSystem);
 DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Active Tasks"), STAT_TaskCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Tiles Awaiting Traces"), STAT_CoverTracingTileCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Async Traces"), STAT_CoverAsyncTraceCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Pending Jobs"), STAT_CoverPendingJobCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Superseded Jobs"), STAT_CoverSupersededJobCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Interpolated Probes"), STAT_CoverInterpolatedProbeCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Landscape Cliff Probes"), STAT_CoverLandscapeCliffProbeCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Tasks Growing Scratch"), STAT_CoverAllocatingTaskCount, STATGROUP_CoverSystem);
+DECLARE_MEMORY_STAT(TEXT("Generate Cover - Scratch"), STAT_CoverScratchMemory, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Tiles Allocating"), STAT_CoverAllocatingTileCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Generate Cover - Heap Allocations"), STAT_CoverTileAllocationCount, STATGROUP_CoverSystem);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Collision Snapshot / Capture"), STAT_CaptureCollisionSnapshot, STATGROUP_CoverSystem, COVERSYSTEM_API);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Collision Snapshot - Captured Shapes"), STAT_CoverSnapshotShapeCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Collision Snapshot - Scene Traces"), STAT_CoverSnapshotSceneTraceCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Collision Snapshot - Mismatches"), STAT_CoverSnapshotMismatchCount, STATGROUP_CoverSystem);
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tile Commit - Added Cover Points"), STAT_CoverCommitAddedCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tile Commit - Removed Cover Points"), STAT_CoverCommitRemovedCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tile Commit - Kept Cover Points"), STAT_CoverCommitKeptCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tile Commit - Committed Tiles"), STAT_CoverCommittedTileCount, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tile Commit - Re-diffed Tiles"), STAT_CoverRediffedTileCount, STATGROUP_CoverSystem);
 
 DECLARE_CYCLE_STAT_EXTERN(TEXT("Find Cover"), STAT_FindCover, STATGROUP_CoverSystem, COVERSYSTEM_API);
 DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Find Cover - Historical Count"), STAT_FindCoverHistoricalCount, STATGROUP_CoverSystem);
 DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Find Cover - Total Time Spent"), STAT_FindCoverTotalTimeSpent, STATGROUP_CoverSystem);
 
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Lazy Generation - Pending Tiles"), STAT_PendingCoverTiles, STATGROUP_CoverSystem);
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Memory Budget - Evicted Tiles"), STAT_CoverTileEvictions, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Memory Budget - Restored Tiles"), STAT_CoverTileRestores, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Memory Budget - Dropped Tiles"), STAT_CoverTileDrops, STATGROUP_CoverSystem);
+DECLARE_MEMORY_STAT(TEXT("Memory Budget - Resident Cover"), STAT_CoverResidentMemory, STATGROUP_CoverSystem);
+
+DECLARE_MEMORY_STAT(TEXT("Static Layer - Shared Cover"), STAT_CoverStaticLayerMemory, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Static Layer - Shared Tiles Reused"), STAT_CoverStaticTilesReused, STATGROUP_CoverSystem);
+
+DECLARE_MEMORY_STAT(TEXT("Mesh Templates - Cached Candidates"), STAT_CoverMeshTemplateMemory, STATGROUP_CoverSystem);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Mesh Templates - Reused"), STAT_CoverMeshTemplatesReused, STATGROUP_CoverSystem);
+
+class FNavmeshCoverPointGeneratorTask;
+
+// An instance of an instanced static mesh, by its stable id. See FCoverInstanceIds.
+using FCoverInstanceKey = TPair<TWeakObjectPtr<const UInstancedStaticMeshComponent>, int32>;
+
+// A cover point of an actor as it was scanned, relative to the actor.
+struct FCoverObjectFramePoint
+{
+	FVector LocalLocation;
+
+	// Where the cover point currently is, i.e. where it's been scanned or last moved to.
+	FVector Location;
+
+	// Location that the unit in cover has taken the cover point at, if it's been moved since. See UCoverSubsystem::MovedCoverLocations.
+	FVector ClaimLocation;
+
+	bool bForceField;
+
+	// Instanced static mesh and stable id of the instance that generated the cover point, if it was generated per instance.
+	TWeakObjectPtr<UInstancedStaticMeshComponent> InstancedMesh;
+	int32 InstanceId;
+};
+
+// Where the cover points of an actor have been generated, see UCoverSubsystem::MoveCoverPointsOfObject().
+struct FCoverObjectFrame
+{
+	// Transform of the actor when its cover was scanned.
+	FTransform ScanTransform;
+
+	// What the actor was standing on when its cover was scanned, if anything.
+	TWeakObjectPtr<const UPrimitiveComponent> Ground;
+
+	// Every cover point found by the scan, including the ones that didn't make it into the octree, which may fit wherever the actor is moved to.
+	TArray<FCoverObjectFramePoint> Points;
+};
+
+// Counters of the memory budget, see UCoverSubsystem::CoverMemoryBudgetKB.
+struct FCoverMemoryStats
+{
+	// Number of tiles evicted into compact form since the start of the session.
+	int32 Evictions = 0;
+
+	// Number of evicted tiles put back into the octree since the start of the session.
+	int32 Restores = 0;
+
+	// Number of evicted tiles whose compact form has been dropped since the start of the session.
+	int32 Drops = 0;
+
+	// Estimated memory used by cover points, both in the octree and in compact form.
+	int64 ResidentBytes = 0;
+};
+
+// Fired once cover is ready around the location passed to UCoverSubsystem::WaitForCoverReady().
+DECLARE_DYNAMIC_DELEGATE(FCoverReadyDelegate);
+
+// A pending UCoverSubsystem::WaitForCoverReady() call.
+struct FCoverReadyRequest
+{
+	FVector Origin;
+
+	float Radius;
+
+	FCoverReadyDelegate Delegate;
+
+	FCoverReadyRequest(FVector _Origin, float _Radius, FCoverReadyDelegate _Delegate)
+		: Origin(_Origin), Radius(_Radius), Delegate(_Delegate)
+	{}
+};
+
 /**
  * Singleton. The cover system contains the cover points octree and is also responsible for hooking into navmesh events to trigger the real-time dynamic (re)generation of cover.
  */
@@ -52,6 +162,13 @@ private:
 	// A small Z-axis offset applied to each cover point. This is to prevent small irregularities in the navmesh from registering as cover.
 	const float CoverPointGroundOffset = 10.0f;
 
+	// Largest change of the Z of an actor's up vector that its cover points are still moved along with, rather than regenerated. See MoveCoverPointsOfObject().
+	const float CoverObjectTiltTolerance = 0.01f;
+
+	// Regenerated cover points that are closer than this to an existing cover point of the same tile and object are considered unchanged.
+	// Used by DiffCoverTile().
+	const float CoverPointDiffTolerance = 15.0f;
+
 	// Thread lock for CoverOctree and ElementToIDLockObject
 	mutable FRWLock CoverDataLockObject;
 
@@ -63,11 +180,226 @@ private:
 	// NOT THREAD-SAFE! Use the corresponding thread-safe functions instead.
 	TMap<const FVector, FOctreeElementId2> ElementToID;
 
-	// Maps cover objects to their cover point locations
+	// Maps cover objects to their cover point locations, except for the cover points of tiles and the ones generated per instance, see CoverInstanceToID.
 	TMultiMap<TWeakObjectPtr<const AActor>, FVector> CoverObjectToID;
 
+	// Maps the instances of instanced static meshes to their cover point locations, see RemoveCoverPointsOfInstance().
+	TMultiMap<FCoverInstanceKey, FVector> CoverInstanceToID;
+
+	// Stable ids of the instances of the instanced static meshes in CoverInstanceToID, by their current index.
+	TMap<TWeakObjectPtr<const UInstancedStaticMeshComponent>, FCoverInstanceIds> CoverInstanceIds;
+
+	// Frames of the actors whose cover has been added by AddCoverPointsOfObject(), for moving their cover points along with them.
+	TMap<TWeakObjectPtr<const AActor>, FCoverObjectFrame> CoverObjectFrames;
+
+	// Taken cover points that have moved along with their actor, from the location they've been taken at to where they are now. Resolved by ReleaseCover().
+	TMap<FVector, FVector> MovedCoverLocations;
+
 	// Our custom navmesh
-	AChangeNotifyingRecastNavMesh* Navmesh;
+	AChangeNotifyingRecastNavMesh* Navmesh = nullptr;
+
+	// Lock for CoverTiles, CoverTileGrid, DemandedCoverTiles, EvictedCoverTiles, PendingCoverTileCount, CoverAgents, MemoryStats, GenerationScheduler, bDeinitialized, the generator pool and the generators handed over by the workers.
+	mutable FCriticalSection CoverTileLockObject;
+
+	// Every navmesh tile known to the cover system, by tile index.
+	// Mutable because cover queries flag pending tiles as demanded.
+	mutable TMap<uint32, FCoverTile> CoverTiles;
+
+	// Indices of CoverTiles by the X and Y of their navmesh tile, one per layer, for finding the tiles around an area without going through all of them.
+	TMap<FIntPoint, TArray<uint32, TInlineAllocator<4>>> CoverTileGrid;
+
+	// Indices of the CoverTiles that have been demanded and not been taken care of yet, and of the evicted ones, so that UpdateCoverTiles() and EnforceMemoryBudget()
+	// don't have to go through all of the tiles. Mutable because cover queries demand tiles.
+	mutable TSet<uint32> DemandedCoverTiles;
+	TSet<uint32> EvictedCoverTiles;
+
+	// Number of CoverTiles that are pending, see STAT_PendingCoverTiles.
+	int32 PendingCoverTileCount = 0;
+
+	// Origin of the navmesh tile grid, in Recast coordinates, and the size of its tiles. See dtNavMeshParams; zero size until the navmesh has been built.
+	FVector CoverTileGridOrigin = FVector::ZeroVector;
+	FVector2D CoverTileGridSize = FVector2D::ZeroVector;
+
+	// Agents whose surroundings should have cover, see RegisterCoverAgent().
+	TArray<TWeakObjectPtr<const AActor>> CoverAgents;
+
+	// How often the tiles are checked for demand, in seconds.
+	const float CoverTileUpdateInterval = 0.2f;
+
+	FTimerHandle CoverTileUpdateTimerHandle;
+
+	// Binding of TickCoverTraces() to FWorldDelegates::OnWorldPostActorTick.
+	FDelegateHandle CoverTracesTickHandle;
+
+	// Set once the world is being torn down: running generators give up on their tiles and no new ones are started. See Deinitialize().
+	bool bDeinitialized = false;
+
+	// Number of generator stages queued or running on the thread pool, which Deinitialize() waits for since they use the world.
+	FThreadSafeCounter RunningGeneratorStages;
+
+	// Triggered by a generator stage that brings RunningGeneratorStages down to zero. Returned to the pool along with the cover system.
+	FEvent* GeneratorStagesDoneEvent = nullptr;
+
+	// Generation jobs of the tiles, closest to the points of interest first. Tiles whose traces are in flight don't take up a worker.
+	FCoverGenerationScheduler GenerationScheduler;
+
+	// Every generator created so far, see AcquireCoverGenerator(). The rest of the lists below point into it.
+	TArray<TSharedRef<FNavmeshCoverPointGeneratorTask, ESPMode::ThreadSafe>> CoverGenerators;
+
+	// Generators that aren't running a job, for the next ones to reuse along with their buffers.
+	TArray<FNavmeshCoverPointGeneratorTask*> IdleCoverGenerators;
+
+	// Generators that have gathered their probes on a worker thread and wait to be picked up by TickCoverTraces().
+	// Plain arrays rather than queues, which would allocate a node per generator.
+	TArray<FNavmeshCoverPointGeneratorTask*> SubmittedTraceGenerators;
+
+	// Generators whose trace waves are in flight. Game thread only.
+	TArray<FNavmeshCoverPointGeneratorTask*> TracingGenerators;
+
+	// Generators of the tiles that have finished generating, whose commits wait to be written into the octree by CommitQueuedCoverTiles().
+	TArray<FNavmeshCoverPointGeneratorTask*> QueuedCoverTileCommits;
+
+	// Batch of generators being committed by CommitQueuedCoverTiles(), and the latest of them per tile. Kept along with their allocations. Game thread only.
+	TArray<FNavmeshCoverPointGeneratorTask*> CommittingGenerators;
+	TMap<uint32, int32> LatestCoverTileCommits;
+
+#if DEBUG_RENDERING
+	// Debug shapes of the generator tasks, waiting to be drawn by TickCoverTraces().
+	TQueue<FCoverDebugDrawBuffer, EQueueMode::Mpsc> QueuedDebugDraws;
+#endif
+
+	// Incremented by every batch of tile commits, eviction and RemoveAll(), under the write lock of CoverDataLockObject. Orders the diffs of the tile commits against the writes.
+	uint64 CoverDataSequence = 0;
+
+	// CoverDataSequence when the octree was last reset by RemoveAll(), and when the cover of each tile was last written. Guarded by CoverDataLockObject.
+	uint64 CoverResetSequence = 0;
+	TMap<uint32, uint64> CoverTileSequences;
+
+	// Earliest time (FPlatformTime::Seconds()) of the next batch of commits, see CoverCommitInterval. Game thread only.
+	double NextCoverCommitTime = 0.0;
+
+	// Points of interest that tile generation is ordered by: player starts, pawns and registered agents. Refreshed every CoverTileUpdateInterval seconds.
+	TArray<FVector> GenerationFocusLocations;
+
+	// Bounds of the actors tagged with CoverSystemHotspot. Tiles inside them are generated first.
+	TArray<FBox> GenerationHotspots;
+
+	// Locations of the player starts, gathered once on begin play.
+	TArray<FVector> PlayerStartLocations;
+
+	// Whether the navmesh has finished building at least once. Cover can't be considered ready before that.
+	bool bInitialNavmeshBuildFinished = false;
+
+	// Pending WaitForCoverReady() calls.
+	TArray<FCoverReadyRequest> CoverReadyRequests;
+
+	// Cover shared with the other worlds of the same map, valid if bShareStaticCover is set.
+	TSharedPtr<FCoverStaticLayer, ESPMode::ThreadSafe> StaticLayer;
+
+	// Cover templates of the static meshes scanned by the actor generators, see bUseMeshCoverTemplates.
+	FCoverMeshTemplateCache MeshTemplates;
+
+	// Lock for StaticCoverViews and StaticCoverViewsByTile.
+	mutable FCriticalSection StaticCoverViewLockObject;
+
+	// This world's view of the static cover points it has queried so far, by location. Holds the resolved cover object and the taken flag.
+	// Mutable because views are created by cover queries.
+	mutable TMap<FVector, FCoverPointOctreeElement> StaticCoverViews;
+
+	// Locations of StaticCoverViews by the tile they belong to, so that unsharing a tile only goes through its own views.
+	mutable TMultiMap<uint32, FVector> StaticCoverViewsByTile;
+
+	// Name of the map that the static layer is shared by.
+	FString GetStaticLayerMapName() const;
+
+	// Finds this world's copy of the cover object of a static cover point. Returns null if it doesn't exist (anymore).
+	AActor* ResolveStaticCoverObject(const FCoverStaticPoint& StaticCoverPoint) const;
+
+	// Appends the static cover points of this world's static tiles that intersect QueryBox, and QuerySphere if supplied. Thread-safe.
+	void FindStaticCoverPoints(TArray<FCoverPointOctreeElement>& OutCoverPoints, const FBox& QueryBox, const FSphere* QuerySphere) const;
+
+	// Adds the tile to CoverTiles and CoverTileGrid unless it's there already, and refreshes its bounds and coordinates from the navmesh. Call with CoverTileLockObject held.
+	FCoverTile& FindOrAddCoverTile(uint32 TileIdx);
+
+	// Calls Func for the tiles whose cell of the navmesh tile grid overlaps the area, which are a superset of the ones whose bounds intersect it. Call with CoverTileLockObject held.
+	void ForEachCoverTileInArea(const FBox& Area, TFunctionRef<void(uint32 TileIdx, FCoverTile& Tile)> Func) const;
+
+	// Stops serving the tile from the static layer, e.g. because it's been rebuilt. Call with CoverTileLockObject held.
+	void UnshareCoverTile(uint32 TileIdx, FCoverTile& Tile);
+
+	// Takes an idle generator from the pool, or creates one if they're all busy. Call with CoverTileLockObject held.
+	FNavmeshCoverPointGeneratorTask* AcquireCoverGenerator();
+
+	// Reports what the generator has allocated for its tile and puts it back into the pool. Call with CoverTileLockObject held, once nothing else refers to the generator.
+	void RecycleCoverGenerator(FNavmeshCoverPointGeneratorTask& Generator);
+
+	// Runs the current CPU-bound stage of the generator on the thread pool, or right away if there's none.
+	void RunGeneratorStage(FNavmeshCoverPointGeneratorTask& Generator);
+
+	// Computes the changes that a tile commit makes to the octree, see QueueCoverTileCommit(). Call with CoverDataLockObject held, for reading or writing.
+	// Cover points that haven't moved by more than CoverPointDiffTolerance stay in the octree untouched, along with their taken flags.
+	// Also removes the stale cover points of others around the tile, see RemoveStaleCoverPoints().
+	// If the commit has dirty areas then its cover points only replace the cover points inside them, the rest of the tile is left alone.
+	void DiffCoverTile(TArray<FCoverPointOctreeElement>& OutRemovals, TArray<FDTOCoverData>& OutAdditions, const FCoverTileCommit& Commit) const;
+
+	// Removes and adds the cover points of a diff. Removals that another cover point has taken the place of since the diff are skipped. Call with the write lock held.
+	void ApplyCoverDiff(const TArray<FCoverPointOctreeElement>& Removals, TArray<FDTOCoverData>& Additions);
+
+	// Writes the queued tile commits into the octree in a single batch, then marks their tiles as generated. Game thread only.
+	// The diffs have been computed by the workers already; only the ones of tiles whose cover has been written since are computed again, under the write lock.
+	void CommitQueuedCoverTiles();
+
+	// Finishes the tile's job with the scheduler and marks the tile ready unless it has another job. Call with CoverTileLockObject held.
+	void FinishCoverTile(uint32 TileIdx);
+
+	// Advances the trace waves of the generators and hands the ones whose traces have all come back over to the thread pool.
+	// Also commits the finished tiles every CoverCommitInterval. Called every frame.
+	void TickCoverTraces(UWorld* World, ELevelTick TickType, float DeltaSeconds);
+
+	// Squared distance of the tile to the closest point of interest, or a negative value if the tile has been demanded by a query. Call with CoverTileLockObject held.
+	float GetGenerationPriority(const FCoverTile& Tile) const;
+
+	// Changes the state of the tile, keeping EvictedCoverTiles and PendingCoverTileCount up-to-date. Call with CoverTileLockObject held.
+	void SetCoverTileState(uint32 TileIdx, FCoverTile& Tile, ECoverTileState State);
+
+	// Schedules a generation job for the tile, replacing its pending job and superseding its running one, if any. Call with CoverTileLockObject held.
+	void EnqueueCoverTile(uint32 TileIdx, FCoverTile& Tile);
+
+	// Starts generator tasks for the pending jobs, highest priority first, as long as there are free workers. Thread-safe.
+	void DispatchCoverGeneration();
+
+	// Fires the WaitForCoverReady() delegates whose areas have become ready.
+	void ProcessCoverReadyRequests();
+
+	// Handler of AChangeNotifyingRecastNavMesh::NavmeshTilesUpdatedUntilFinishedDelegate.
+	UFUNCTION()
+	void OnNavMeshGenerationFinished(const TSet<uint32>& UpdatedTiles);
+
+	// Refreshes the LRU time of the tiles overlapping Area and flags the pending and evicted ones among them as demanded. Thread-safe.
+	void DemandCoverTiles(const FBox& Area) const;
+
+	FCoverMemoryStats MemoryStats;
+
+	// Number of cover points held in the compact form of evicted tiles.
+	int32 CompactCoverPointCount = 0;
+
+	// Estimated memory held by a single cover point inside the octree, including its element-to-id mapping.
+	static int64 GetResidentBytesPerCoverPoint();
+
+	// Starts generating the pending tiles that have been demanded or that are near a registered agent, restores evicted tiles the same way and enforces the memory budget.
+	// Also reorders the generation queue by the current points of interest. Called every CoverTileUpdateInterval seconds.
+	void UpdateCoverTiles();
+
+	// Moves the cover points of the tile from the octree into the tile's compact form. Holds both the cover data and the tile lock throughout.
+	// Returns false if the tile couldn't be evicted, e.g. because it's no longer ready or some of its cover is taken. Otherwise, OutFreedBytes is how much the resident size has shrunk by.
+	bool EvictCoverTile(uint32 TileIdx, const FBox& TileBounds, int64& OutFreedBytes);
+
+	// Puts the compact cover points of an evicted tile back into the octree.
+	void RestoreCoverTile(uint32 TileIdx);
+
+	// Evicts the least recently queried tiles that are far from every agent until the resident cover fits into CoverMemoryBudgetKB.
+	// In lazy mode, the compact form of evicted tiles is dropped as well if that's still not enough, as they can be regenerated on demand.
+	void EnforceMemoryBudget(const TArray<FVector>& AgentLocations);
 
 	// Finds the element id of the supplied vector. Thread-safe.
 	// Returns false if the id wasn't found or is no longer valid.
@@ -77,6 +409,23 @@ private:
 	// Returns true if any elements were removed, false if none.
 	bool RemoveIDToElementMapping(const FVector ElementLocation);
 
+	// Removes the cover point from CoverObjectToID, or from CoverInstanceToID if it was generated per instance. Not thread-safe.
+	void RemoveObjectMapping(const FCoverPointOctreeData& CoverPoint);
+
+	// Returns the stable id of an instance by its current index, see FCoverInstanceIds. Not thread-safe.
+	int32 GetCoverInstanceId(const UInstancedStaticMeshComponent* InstancedMesh, int32 InstanceIndex);
+
+	// Adds the cover point to the octree, and to CoverObjectToID and CoverInstanceToID unless it belongs to a tile. Not thread-safe.
+	// The cover point must already carry the stable id of its instance rather than its index, if it was generated per instance. See GetCoverInstanceId().
+	// Returns false if the cover point is a duplicate of an existing one.
+	bool AddMappedCoverPoint(FDTOCoverData& CoverPointDTO);
+
+	// Removes every cover point of the object, without compacting the octree. Not thread-safe.
+	void RemoveObjectCoverPoints(const AActor* CoverObject);
+
+	// Traces down from the bottom of the object for the component that it stands on.
+	const UPrimitiveComponent* FindCoverObjectGround(const AActor* CoverObject) const;
+
 	// Enlarges the supplied box to x1.5 its size
 	FBox EnlargeAABB(FBox Box);
 
@@ -89,14 +438,90 @@ public:
 	// AABB used to filter out cover points on the edges of the map.
 	FBox MapBounds;
 
+	// Lazy mode: navmesh tiles are only marked as pending when they're built, and their cover is generated on first demand,
+	// i.e. when a cover query overlaps them or a registered agent comes within LazyGenerationAgentRadius.
+	// Tiles that already have cover are still regenerated immediately when the navmesh changes.
+	UPROPERTY(BlueprintReadWrite)
+	bool bLazyGeneration = false;
+
+	// Lazy mode: pending tiles closer than this to a registered agent get their cover generated.
+	UPROPERTY(BlueprintReadWrite)
+	float LazyGenerationAgentRadius = 4000.0f;
+
+	// Upper limit for the memory used by cover points, in kilobytes. 0 means unlimited.
+	// When exceeded, the least recently queried tiles that are far from all registered agents are evicted into a compact form and restored on demand.
+	UPROPERTY(BlueprintReadWrite)
+	int32 CoverMemoryBudgetKB = 0;
+
+	// Tiles that have been queried within this many seconds are never evicted.
+	UPROPERTY(BlueprintReadWrite)
+	float CoverEvictionMinIdleTime = 30.0f;
+
+	// Tiles closer than this to a registered agent are never evicted, and evicted tiles are restored once an agent gets this close.
+	UPROPERTY(BlueprintReadWrite)
+	float CoverEvictionAgentRadius = 8000.0f;
+
+	// Maximum number of tiles whose cover is generated at the same time. 0 means one per worker thread of the thread pool.
+	// Lower it to leave more of the thread pool to e.g. streaming during heavy destruction.
+	UPROPERTY(BlueprintReadWrite)
+	int32 MaxCoverGenerationWorkers = 0;
+
+	// Adaptive probe spacing for navmesh cover generation: along straight navmesh edges, only every Nth probe is traced at first.
+	// Where two of them disagree, e.g. at the end of a wall, the probes between them are bisected until the change is found; the rest are filled in without tracing.
+	// Cuts the traces along long walls, but features shorter than N times CoverPointMinDistance may be missed if the probes around them agree, e.g. a doorway in a single wall mesh.
+	// 1 traces every probe.
+	UPROPERTY(BlueprintReadWrite)
+	int32 AdaptiveProbeStride = 1;
+
+	// Share the level-derived cover with every other world of the same map in this process, e.g. sessions on a dedicated server or multi-client PIE.
+	// The cover of tiles that haven't been rebuilt since their first build is generated once and then read from a process-wide, immutable layer.
+	// Taken flags and the cover of rebuilt tiles and actors stay in this world, and so do tiles with cover of any actor that hasn't been loaded with the level.
+	// Must be set before the navmesh is built.
+	UPROPERTY(BlueprintReadWrite)
+	bool bShareStaticCover = false;
+
+	// Generate the cover of navmesh tiles as soon as Recast adds them to the navmesh, rather than with the tile updates buffered by AChangeNotifyingRecastNavMesh.
+	// The tile is copied right then, on the game thread, while it's fresh and can't be swapped out from under the worker; the copy is cheap compared to extracting
+	// the tile's boundary edges, which its job does from the copy on the worker.
+	// Repeated updates of the same tile are coalesced by FCoverGenerationScheduler instead. Must be set before BeginPlay.
+	UPROPERTY(BlueprintReadWrite)
+	bool bGenerateCoverWithTileBuild = false;
+
+	// Minimum time between two batches of tile commits, in seconds. 0 commits every frame. See QueueCoverTileCommit().
+	UPROPERTY(BlueprintReadWrite)
+	float CoverCommitInterval = 0.0f;
+
+	// Have the cover generators trace against a snapshot of the simple collision of each tile or actor, captured once, instead of the physics scene.
+	// Traces near components without simple collision, e.g. landscapes, still go to the scene. See FCoverCollisionSnapshot.
+	UPROPERTY(BlueprintReadWrite)
+	bool bUseCollisionSnapshots = false;
+
+	// Repeat every collision snapshot trace against the physics scene and log the ones that differ. Slow, for verifying the snapshots only.
+	UPROPERTY(BlueprintReadWrite)
+	bool bVerifyCollisionSnapshots = false;
+
+	// If set, the cover generators record every query they make, along with its result, into a file per tile or actor in this directory.
+	// Navmesh tiles are then traced synchronously on their worker rather than in asynchronous waves. The recordings can be replayed without a world, e.g. for benchmarking, see FCoverQueryRecording.
+	UPROPERTY(BlueprintReadWrite)
+	FString CoverQueryRecordingDirectory;
+
+	// Have the actor cover generators scan each static mesh only once per scale and generator parameters, then reuse the cover candidates found around it for all of its instances.
+	// The mesh is scanned on its own, against nothing but its collision and a flat ground, so none of its candidates is missing for being blocked by the neighbours of an instance.
+	// Every instance, the first one included, then validates the candidates against its own surroundings: a ground trace, a clearance trace and a navmesh projection per candidate.
+	// Tilted instances, and meshes whose collision can't be captured on its own, e.g. complex collision used as simple, are always scanned in full. See FCoverMeshTemplateCache.
+	UPROPERTY(BlueprintReadWrite)
+	bool bUseMeshCoverTemplates = false;
+
 	virtual ~UCoverSubsystem();
 
 	// Callback for navmesh tile updates.
+	// Tiles that already have cover and overlap any of the dirty areas only get their cover regenerated in those areas.
 	UFUNCTION()
-	void OnNavMeshTilesUpdated(const TSet<uint32>& UpdatedTiles);
+	void OnNavMeshTilesUpdated(const TSet<uint32>& UpdatedTiles, const TArray<FBox>& DirtyAreas);
 
 	// Thread-safe wrapper for TCoverOctree::FindCoverPoints()
-	// Finds cover points that intersect the supplied box. 
+	// Finds cover points that intersect the supplied box, including the ones of the shared static layer.
+	// In lazy mode, only returns what has already been generated and raises the priority of the pending tiles inside the box.
 	void FindCoverPoints(TArray<FCoverPointOctreeElement>& OutCoverPoints, const FBox& QueryBox) const;
 
 	// Thread-safe wrapper for TCoverOctree::FindCoverPoints()
@@ -106,6 +531,22 @@ public:
 	// Adds a set of cover points to the octree in a single, thread-safe batch.
 	void AddCoverPoints(const TArray<FDTOCoverData>& CoverPointDTOs);
 
+	// Adds the cover points generated for an actor in a single, thread-safe batch, along with the transform that the actor had when it was scanned.
+	// Also traces for the ground under the actor, outside of the lock. See MoveCoverPointsOfObject().
+	void AddCoverPointsOfObject(const AActor* CoverObject, const FTransform& ScanTransform, const TArray<FDTOCoverData>& CoverPointDTOs);
+
+	// Queues the regenerated cover points of a navmesh tile to replace its current ones. Thread-safe.
+	// Computes the diff against the octree right away, under the read lock on the calling worker, so that the game thread only has to apply it. See DiffCoverTile().
+	// The commits of the tiles that finish around the same time are merged into a single write to the octree, once per frame or every CoverCommitInterval seconds.
+	// Called by the generator tasks instead of OnCoverTileGenerated(): the tile counts as generated once its commit has been written.
+	// The commit stays with its generator, which goes back to the pool once the commit has been written.
+	void QueueCoverTileCommit(FNavmeshCoverPointGeneratorTask& Generator);
+
+#if DEBUG_RENDERING
+	// Queues the debug shapes recorded by a generator task to be drawn by the game thread, at the end of the frame. Thread-safe.
+	void QueueDebugDraw(FCoverDebugDrawBuffer&& DebugDraw);
+#endif
+
 	// Removes cover points within the specified area that don't fall on the navmesh or don't have an owner anymore.
 	// Useful for trimming areas around deleted objects and dynamically placed ones.
 	void RemoveStaleCoverPoints(FBox Area);
@@ -118,6 +559,20 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void RemoveCoverPointsOfObject(const AActor* CoverObject);
 
+	// Moves the cover points of an actor along with it, rather than regenerating them: the points keep the place relative to the actor that they were scanned at,
+	// and are projected back onto the navmesh. Points that don't project onto the navmesh at the new place are left out until the actor moves again.
+	// Taken cover points stay taken when they move: the unit holding one keeps its claim, and may still release it by the location that it has taken it at.
+	// Returns false without changing anything if the actor's cover has to be regenerated instead: if it has moved further than MaxDistance from where it was scanned,
+	// has been tilted or stands on something else since then, or its cover hasn't been added by AddCoverPointsOfObject().
+	UFUNCTION(BlueprintCallable)
+	bool MoveCoverPointsOfObject(AActor* CoverObject, float MaxDistance);
+
+	// Removes the cover points generated by a single instance of an instanced static mesh, without touching those of the other instances.
+	// Call right after removing the instance from the component: the remaining instances are renumbered the same way the component renumbers them,
+	// i.e. HISMs move their last instance into the removed one's slot while ISMs shift every later instance down by one. Their cover points are keyed on stable ids, which don't change.
+	UFUNCTION(BlueprintCallable)
+	void RemoveCoverPointsOfInstance(UInstancedStaticMeshComponent* InstancedMesh, int32 InstanceIndex);
+
 	// Resets the octree, erasing all its data.
 	UFUNCTION(BlueprintCallable)
 	void RemoveAll();
@@ -132,12 +587,50 @@ public:
 	UFUNCTION(BlueprintCallable)
 	bool HoldCover(FVector ElementLocation);
 
-	// Releases a cover that was taken.
+	// Releases a cover that was taken. Cover that has been moved along with its actor since, see MoveCoverPointsOfObject(), is found by the location it was taken at.
 	// Returns true if the cover was taken before, false if it wasn't or an error has occurred, e.g. the cover no longer exists.
 	UFUNCTION(BlueprintCallable)
 	bool ReleaseCover(FVector ElementLocation);
+
+	// Registers an agent, e.g. an AI-controlled pawn. In lazy mode, cover is generated around registered agents ahead of their queries.
+	UFUNCTION(BlueprintCallable)
+	void RegisterCoverAgent(AActor* Agent);
+
+	UFUNCTION(BlueprintCallable)
+	void UnregisterCoverAgent(AActor* Agent);
+
+	// Called by the generator tasks once they've gathered the probes of a tile, to have their traces submitted from the game thread. Thread-safe.
+	void SubmitCoverTraces(FNavmeshCoverPointGeneratorTask& Generator);
+
+	// Called by the generator tasks once they've finished with a tile without anything to commit, e.g. because they've been superseded. Puts the generator back into the pool. Thread-safe.
+	void OnCoverTileGenerated(FNavmeshCoverPointGeneratorTask& Generator);
+
+	// Returns true if the tile has been scheduled again since the job was started, meaning that the job's results are outdated. Thread-safe.
+	bool IsCoverGenerationSuperseded(uint32 TileIdx, uint32 JobId) const;
+
+	// Hands the freshly generated cover of a tile over to the static layer if the tile only contains level-derived cover, i.e. of actors loaded with the level. Thread-safe.
+	// Returns true if the static layer has taken the cover, false if it has to be added to this world's octree instead.
+	bool ShareStaticCover(uint32 TileIdx, const TArray<FDTOCoverData>& CoverPoints);
+
+	// Thread-safe.
+	FCoverMemoryStats GetCoverMemoryStats() const;
+
+	// Cover templates of the static meshes scanned so far. Thread-safe.
+	FORCEINLINE FCoverMeshTemplateCache& GetMeshTemplates() { return MeshTemplates; }
+
+	// Returns true if the cover of every navmesh tile within Radius of Origin has been generated, e.g. to hold off spawning AI until then.
+	// Raises the priority of the tiles that aren't ready yet.
+	UFUNCTION(BlueprintCallable)
+	bool IsCoverReady(FVector Origin, float Radius) const;
+
+	// Calls OnCoverReady once IsCoverReady(Origin, Radius) becomes true, right away if it already is.
+	UFUNCTION(BlueprintCallable)
+	void WaitForCoverReady(FVector Origin, float Radius, FCoverReadyDelegate OnCoverReady);
 	
 	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
 
+	// Unbinds from the world and the navmesh, then waits for the generator stages on the thread pool and drops whatever they haven't traced or committed yet.
+	virtual void Deinitialize() override;
+
 	float GetCoverPointGroundOffset();
 };
@@ -0,0 +1,106 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "CoverSystem/NavmeshEdgeExtractor.h"
+#include "CoverSystem/DTOCoverData.h"
+#include "CoverSystem/CoverPointOctreeElement.h"
+
+// Generation state of the cover inside a navmesh tile.
+enum class ECoverTileState : uint8
+{
+	// Cover hasn't been generated for the tile yet, or it has been dropped to stay within the memory budget. Only happens in lazy mode.
+	Pending,
+
+	// The tile has a job in FCoverGenerationScheduler, pending or running.
+	Generating,
+
+	// The tile's cover is in the octree.
+	Ready,
+
+	// The tile's cover has been moved out of the octree into CompactCoverPoints to stay within the memory budget.
+	Evicted
+};
+
+// Compact form of an evicted cover point. Holds just enough to put the cover point back into the octree without regenerating it.
+struct FCompactCoverPoint
+{
+	FVector Location;
+
+	TWeakObjectPtr<AActor> CoverObject;
+
+	bool bForceField;
+
+	FCompactCoverPoint()
+		: Location(), CoverObject(), bForceField()
+	{}
+
+	FCompactCoverPoint(FVector _Location, TWeakObjectPtr<AActor> _CoverObject, bool _bForceField)
+		: Location(_Location), CoverObject(_CoverObject), bForceField(_bForceField)
+	{}
+};
+
+// Regenerated cover of a navmesh tile, waiting to be written into the octree. See UCoverSubsystem::QueueCoverTileCommit().
+struct FCoverTileCommit
+{
+	uint32 TileIdx = 0;
+
+	// Job that has generated the cover. The latest job of a tile wins if it has several commits in the same batch.
+	uint32 JobId = 0;
+
+	// AABB of the navmesh tile, expanded by half the tile height on the Z-axis.
+	FBox TileArea = FBox(ForceInit);
+
+	// Areas that the cover points replace the tile's cover in, or empty to replace all of it. See FCoverTile::DirtyAreas.
+	TArray<FBox> DirtyAreas;
+
+	TArray<FDTOCoverData> CoverPoints;
+
+	// Changes that CoverPoints make to the octree, computed on the generator's worker. See UCoverSubsystem::DiffCoverTile().
+	TArray<FCoverPointOctreeElement> Removals;
+	TArray<FDTOCoverData> Additions;
+
+	// UCoverSubsystem::CoverDataSequence when the changes were computed. They're computed again if the tile's cover has been written since.
+	uint64 DiffSequence = 0;
+};
+
+// Bookkeeping of a single navmesh tile's cover.
+struct FCoverTile
+{
+	// AABB of the navmesh tile.
+	FBox Bounds;
+
+	// X, Y and layer of the navmesh tile. Unlike the tile index, these are the same in every world of the map.
+	FIntVector Coord = FIntVector::NoneValue;
+
+	// Number of times the navmesh tile has been built. Tiles that haven't been rebuilt since their first build only contain level-derived cover.
+	int32 BuildCount = 0;
+
+	// Whether the tile's cover is served by the shared static layer instead of this world's octree.
+	bool bStatic = false;
+
+	ECoverTileState State = ECoverTileState::Pending;
+
+	// Set when a cover query overlapped the tile before its cover was ready. Demanded tiles are generated or restored ahead of the rest.
+	bool bDemanded = false;
+
+	// Last time (FPlatformTime::Seconds()) a cover query overlapped the tile or its cover was generated. Drives LRU eviction.
+	double LastDemandTime = 0.0;
+
+	// Cover points of the tile while it's evicted.
+	TArray<FCompactCoverPoint> CompactCoverPoints;
+
+	// Areas of the tile whose cover needs to be regenerated, accumulated until a job of the tile finishes without being superseded.
+	// Empty if the whole tile needs to be (re)generated, or if it's not generating at all.
+	TArray<FBox> DirtyAreas;
+
+	// Copy of the navmesh tile taken as soon as it has been added to the navmesh, handed over to the tile's jobs to extract its boundary edges from.
+	// See UCoverSubsystem::bGenerateCoverWithTileBuild. Null if the jobs are to extract the edges from the navmesh itself.
+	TSharedPtr<const FNavmeshTileSnapshot, ESPMode::ThreadSafe> TileSnapshot;
+
+	FCoverTile()
+		: Bounds(ForceInit)
+	{}
+};
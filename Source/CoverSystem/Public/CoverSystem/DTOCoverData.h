@@ -4,6 +4,8 @@
 
 #include "CoreMinimal.h"
 
+class UInstancedStaticMeshComponent;
+
 /**
  * DTO for FCoverPointOctreeData
  */
@@ -14,11 +16,19 @@ public:
 	FVector Location;
 	bool bForceField;
 
+	// Index of the navmesh tile that generated this cover point, INDEX_NONE if it was generated by scanning an actor.
+	int32 TileIndex;
+
+	// Instanced static mesh of CoverObject and index of its instance that generated this cover point, if it was generated per instance.
+	// UCoverSubsystem replaces the index with the stable id of the instance when it adds the cover point, see FCoverInstanceIds.
+	UInstancedStaticMeshComponent* InstancedMesh;
+	int32 InstanceIndex;
+
 	FDTOCoverData()
-		: CoverObject(), Location(), bForceField()
+		: CoverObject(), Location(), bForceField(), TileIndex(INDEX_NONE), InstancedMesh(), InstanceIndex(INDEX_NONE)
 	{}
 
-	FDTOCoverData(AActor* _CoverObject, FVector _Location, bool _bForceField)
-		: CoverObject(_CoverObject), Location(_Location), bForceField(_bForceField)
+	FDTOCoverData(AActor* _CoverObject, FVector _Location, bool _bForceField, int32 _TileIndex = INDEX_NONE)
+		: CoverObject(_CoverObject), Location(_Location), bForceField(_bForceField), TileIndex(_TileIndex), InstancedMesh(), InstanceIndex(INDEX_NONE)
 	{}
 };
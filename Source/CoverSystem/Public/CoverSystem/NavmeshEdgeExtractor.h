@@ -0,0 +1,105 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "NavMesh/RecastNavMesh.h"
+
+// A navmesh edge that has no neighbouring polygon on one of its sides, i.e. one that borders on a navmesh hole.
+struct FNavmeshBoundaryEdge
+{
+	FVector Start;
+
+	FVector End;
+
+	// Horizontal unit vector perpendicular to the edge, pointing away from the navmesh, towards the hole.
+	FVector Normal;
+
+	FNavmeshBoundaryEdge(FVector _Start, FVector _End, FVector _Normal)
+		: Start(_Start), End(_End), Normal(_Normal)
+	{}
+};
+
+// Boundary edges welded together at their shared vertices.
+struct FNavmeshBoundaryChain
+{
+	TArray<FVector> Vertices;
+
+	// Normal of each segment, i.e. of the edge between Vertices[i] and Vertices[i + 1], see FNavmeshBoundaryEdge::Normal.
+	TArray<FVector> Normals;
+
+	// Whether the chain loops around, in which case its last vertex is the same as the first one.
+	bool bClosed = false;
+
+	// Whether the first/last vertex lies on a tile seam owned by the neighbouring tile. The chain continues in that tile, which probes the shared vertex instead.
+	// See FNavmeshEdgeExtractor::MarkForeignSeams().
+	bool bStartOnForeignSeam = false;
+	bool bEndOnForeignSeam = false;
+};
+
+// Copy of what FNavmeshEdgeExtractor::ExtractBoundaryEdges() reads of a navmesh tile, so that its edges can be extracted off the game thread
+// without reading the live navmesh, which Recast may swap the tile out of at any time. See FNavmeshEdgeExtractor::CaptureTile().
+struct FNavmeshTileSnapshot
+{
+	// Copy of the Detour tile's data, which holds its header, polygons, vertices and detail mesh.
+	TArray<uint8> Data;
+
+	// Where the polygons, vertices and detail mesh of the tile are within Data.
+	int32 PolysOffset = 0;
+	int32 VertsOffset = 0;
+	int32 DetailMeshesOffset = 0;
+	int32 DetailVertsOffset = 0;
+	int32 DetailTrisOffset = 0;
+
+	// Per polygon, bit i is set if the polygon's edge i is a boundary edge. Portals are checked against the links of the tile when it's captured,
+	// since the links aren't part of its data.
+	TArray<uint8> BoundaryEdgeMasks;
+};
+
+// Working set of FNavmeshEdgeExtractor::WeldBoundaryEdges(), kept between calls so that welding doesn't allocate once it has grown to fit the largest tile.
+struct FNavmeshWeldScratch
+{
+	TMap<FIntVector, int32> VertexIndices;
+
+	TArray<FVector> Vertices;
+
+	TArray<TArray<int32, TInlineAllocator<2>>> VertexEdges;
+
+	TArray<TPair<int32, int32>> EdgeVertices;
+
+	TBitArray<> VisitedEdges;
+
+	// Chains of earlier calls, recycled along with the allocations of their vertices and normals.
+	TArray<FNavmeshBoundaryChain> SpareChains;
+
+	SIZE_T GetAllocatedSize() const;
+};
+
+/**
+ * Reads the boundary edges of a navmesh tile straight from its Detour polygons.
+ * Cheaper than ARecastNavMesh::GetDebugGeometry(), which builds the vertices, indices and edges of the whole tile, and the side of the hole comes for free.
+ */
+class COVERSYSTEM_API FNavmeshEdgeExtractor
+{
+public:
+	// Appends the boundary edges of the tile to OutEdges. The edges follow the detail mesh, so they hug the ground just like the debug-drawn navmesh edges.
+	// Portals to neighbouring tiles are left out, unless they're unlinked, e.g. there's an actual step on the seam or no tile behind the portal at all.
+	// Returns false if the tile doesn't exist (anymore).
+	static bool ExtractBoundaryEdges(TArray<FNavmeshBoundaryEdge>& OutEdges, const ARecastNavMesh* NavData, int32 TileIdx);
+
+	// Same as above, from a snapshot of the tile. Doesn't touch the navmesh, so it's safe to call on any thread.
+	static void ExtractBoundaryEdges(TArray<FNavmeshBoundaryEdge>& OutEdges, const FNavmeshTileSnapshot& TileSnapshot);
+
+	// Copies the tile for ExtractBoundaryEdges(), which is a copy of its data and a check of its portals' links, rather than a walk of its detail mesh.
+	// Call on the game thread, where Recast adds and removes the tiles. Returns null if the tile doesn't exist (anymore).
+	static TSharedPtr<const FNavmeshTileSnapshot, ESPMode::ThreadSafe> CaptureTile(const ARecastNavMesh* NavData, int32 TileIdx);
+
+	// Welds the edges into chains wherever exactly two of them meet at a vertex. Chains also break where more than two edges meet, e.g. where two holes touch.
+	static void WeldBoundaryEdges(TArray<FNavmeshBoundaryChain>& OutChains, const TArray<FNavmeshBoundaryEdge>& Edges);
+
+	// Same as above, with the working set kept in Scratch. Replaces the chains of OutChains, recycling their allocations along with those of Scratch.
+	static void WeldBoundaryEdges(TArray<FNavmeshBoundaryChain>& OutChains, const TArray<FNavmeshBoundaryEdge>& Edges, FNavmeshWeldScratch& Scratch);
+
+	// Flags the chain ends that lie on a seam owned by a neighbouring tile. Holes that span tiles are split into a chain per tile, which would otherwise both probe the vertex they share.
+	static void MarkForeignSeams(TArray<FNavmeshBoundaryChain>& Chains, const ARecastNavMesh* NavData, int32 TileIdx);
+};
@@ -0,0 +1,61 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/MemoryBase.h"
+#include "HAL/ThreadSafeCounter.h"
+
+/**
+ * Proxy in front of GMalloc that counts the heap allocations made inside an FCoverAllocationScope, for telling what the cover generators still allocate per tile.
+ * Off by default: installed by the module at startup when the command line has -CoverAllocationCounter. Has no effect on platforms that call their allocator directly.
+ * Never uninstalled, as allocations made through it may be freed at any time.
+ */
+class COVERSYSTEM_API FCoverAllocationCounter : public FMalloc
+{
+public:
+	explicit FCoverAllocationCounter(FMalloc* _InnerMalloc);
+
+	// Puts a counter in front of GMalloc, once.
+	static void Install();
+
+	static bool IsInstalled();
+
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override;
+	virtual void* TryMalloc(SIZE_T Count, uint32 Alignment) override;
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override;
+	virtual void* TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) override;
+	virtual void Free(void* Original) override;
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override;
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override;
+	virtual void Trim(bool bTrimThreadCaches) override;
+	virtual void SetupTLSCachesOnCurrentThread() override;
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override;
+	virtual void InitializeStatsMetadata() override;
+	virtual void UpdateStats() override;
+	virtual void GetAllocatorStats(FGenericMemoryStats& OutStats) override;
+	virtual void DumpAllocatorStats(FOutputDevice& Ar) override;
+	virtual bool IsInternallyThreadSafe() const override;
+	virtual bool ValidateHeap() override;
+	virtual const TCHAR* GetDescriptiveName() override;
+
+private:
+	FMalloc* InnerMalloc;
+
+	// Counts an allocation against the scope of the calling thread, if any. Reallocs count as well, except for the ones to zero bytes, which free.
+	static void CountAllocation();
+};
+
+/**
+ * Counts the heap allocations of the calling thread into the counter for as long as it's in scope. Nested scopes count into the innermost one only.
+ * Counts nothing unless FCoverAllocationCounter is installed.
+ */
+class COVERSYSTEM_API FCoverAllocationScope
+{
+public:
+	explicit FCoverAllocationScope(FThreadSafeCounter& _Count);
+	~FCoverAllocationScope();
+
+private:
+	FThreadSafeCounter* PreviousCount;
+};
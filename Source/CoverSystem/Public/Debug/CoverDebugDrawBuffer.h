@@ -0,0 +1,80 @@
+// Copyright (c) 2018 David Nadaski. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/World.h"
+
+// Kinds of shapes of FCoverDebugDrawCommand.
+enum class ECoverDebugDrawType : uint8
+{
+	Sphere,
+	Box,
+	DirectionalArrow
+};
+
+// A debug shape recorded by a cover generator, along with the parameters of its DrawDebugXXX call.
+struct FCoverDebugDrawCommand
+{
+	ECoverDebugDrawType Type;
+
+	// Center of a sphere or a box, or the start of an arrow.
+	FVector Start;
+
+	// Extent of a box, or the end of an arrow.
+	FVector End;
+
+	// Radius of a sphere, or the arrow size of an arrow.
+	float Size;
+
+	FColor Color;
+
+	bool bPersistentLines;
+
+	float LifeTime;
+
+	float Thickness;
+};
+
+/**
+ * Debug shapes recorded by a cover generator task, to be drawn by the game thread.
+ * DrawDebugXXX calls may crash UE4 when not called from the game thread, so the tasks record them here instead and hand the buffer over to UCoverSubsystem::QueueDebugDraw(),
+ * which keeps them running in the background with debug drawing on. Recording is thread-safe, e.g. from the chunks of a ParallelFor.
+ */
+class COVERSYSTEM_API FCoverDebugDrawBuffer
+{
+public:
+	FCoverDebugDrawBuffer() = default;
+
+	// The lock isn't moved along with the commands, buffers are only moved once their task is done recording.
+	FCoverDebugDrawBuffer(FCoverDebugDrawBuffer&& Other)
+		: Commands(MoveTemp(Other.Commands))
+	{}
+
+	FCoverDebugDrawBuffer& operator=(FCoverDebugDrawBuffer&& Other)
+	{
+		Commands = MoveTemp(Other.Commands);
+		return *this;
+	}
+
+	// See DrawDebugSphere().
+	void AddSphere(const FVector& Center, float Radius, const FColor& Color, bool bPersistentLines, float LifeTime = -1.0f, float Thickness = 0.0f);
+
+	// See DrawDebugBox().
+	void AddBox(const FVector& Center, const FVector& Extent, const FColor& Color, bool bPersistentLines, float LifeTime = -1.0f, float Thickness = 0.0f);
+
+	// See DrawDebugDirectionalArrow().
+	void AddDirectionalArrow(const FVector& Start, const FVector& End, float ArrowSize, const FColor& Color, bool bPersistentLines, float LifeTime = -1.0f, float Thickness = 0.0f);
+
+	FORCEINLINE bool IsEmpty() const { return Commands.Num() == 0; }
+
+	// Draws the recorded shapes. Game thread only.
+	void Draw(UWorld* World) const;
+
+private:
+	TArray<FCoverDebugDrawCommand> Commands;
+
+	FCriticalSection CommandsLockObject;
+
+	void AddCommand(const FCoverDebugDrawCommand& Command);
+};
@@ -10,6 +10,52 @@
 #include "NavigationSystem.h"
 #include "CoverSystem/CoverSubsystem.h"
 #include "CoverSystem/DTOCoverData.h"
+#include "CoverSystem/CoverCollisionSnapshot.h"
+#include "CoverSystem/CoverQueryBackends.h"
+#include "Debug/CoverDebugDrawBuffer.h"
+
+/**
+ * Working sets of FActorCoverPointGeneratorTask, one per thread, so that scanning an actor doesn't allocate once they've grown to fit the largest one.
+ * Arrays are only ever Reset(), which keeps their allocations.
+ */
+struct FActorCoverGenerationScratch
+{
+	TArray<UStaticMeshComponent*> StaticMeshes;
+
+	TArray<FBox> BoundingBoxes;
+
+	// Static mesh of each of BoundingBoxes whose cover template may be used for it, or null.
+	TArray<UStaticMeshComponent*> BoundingBoxMeshes;
+
+	// Instanced static meshes whose instances are scanned one by one.
+	TArray<UInstancedStaticMeshComponent*> InstancedMeshes;
+
+	// Surfaces of the column being scanned by GenerateCoverInBounds(), see bScanColumns.
+	TArray<FHitResult> ColumnHits;
+
+	// Grid points of GenerateCoverInBounds().
+	TArray<FVector> FreeGridPoints;
+	TArray<FVector> FinalGridPoints;
+
+	// Voxel grid of GenerateCoverInBounds(): index of the free grid point of each voxel, or INDEX_NONE, whether each voxel has a blocked grid point,
+	// and whether the free grid point of each voxel has already been gathered.
+	TArray<int32> FreeVoxels;
+	TBitArray<> BlockedVoxels;
+	TBitArray<> GatheredVoxels;
+
+	// Spatial hash of the cover points of GenerateCoverInBounds(), for filtering out near-duplicates.
+	TMultiMap<FIntVector, int32> CoverPointCells;
+
+	TArray<FDTOCoverData> CoverPoints;
+
+	SIZE_T GetAllocatedSize() const;
+
+	// Scratch of the calling thread.
+	static FActorCoverGenerationScratch& Get();
+
+	// Scratch of the calling thread for scanning the instances of an instanced static mesh, which may run on the thread of the task itself while it holds on to its own scratch.
+	static FActorCoverGenerationScratch& GetForInstances();
+};
 
 /**
  * Asynchronous, non-abandonable task for generating cover points and inserting them into an octree via UCoverSystem.
@@ -37,18 +83,79 @@ protected:
 	// Whether to generate cover points per UStaticMeshComponent found in Owner or around all the colliding components inside the owner's bounding box. Set to true if owner's bounding box would likely intersect with other actors in-game.
 	bool bGeneratePerStaticMesh;
 
+	// Whether to find the ground of the scan grid with a single multi-hit trace per column rather than a grid unit long trace per grid point. See UCoverGeneratorComponent::bScanColumns.
+	bool bScanColumns;
+
 #if DEBUG_RENDERING
 	bool bDebugDraw = false;
+
+	// Debug shapes of the task, handed over to UCoverSubsystem::QueueDebugDraw() once it's done.
+	FCoverDebugDrawBuffer DebugDraw;
 #endif
 
+	// See UCoverSubsystem::bUseCollisionSnapshots and bVerifyCollisionSnapshots.
+	bool bUseCollisionSnapshot = false;
+	bool bVerifyCollisionSnapshot = false;
+
+	// See UCoverSubsystem::bUseMeshCoverTemplates.
+	bool bUseMeshTemplates = false;
+
+	// Cover templates of the cover system.
+	FCoverMeshTemplateCache* MeshTemplates = nullptr;
+
+	// How far the up vector of a static mesh may be from vertical, in terms of its Z, for it to use a cover template. Tilted ones are scanned in full.
+	const float UprightTolerance = 0.001f;
+
+	// Whether Owner is a force field (shield), see FDTOCoverData::bForceField.
+	bool bOwnerIsForceField = false;
+
+	// Queries of the task, if they're being recorded. See UCoverSubsystem::CoverQueryRecordingDirectory.
+	TUniquePtr<FCoverQueryRecording> QueryRecording;
+
+	// World transforms of the instances of Owner's instanced static meshes, by instance index. Taken on the game thread when the task is created,
+	// since the instances may be added, removed or moved while it runs. Only filled when bGeneratePerStaticMesh.
+	TMap<const UInstancedStaticMeshComponent*, TArray<FTransform>> InstanceTransforms;
+
+	// Query params of the ground traces and of the cover traces, set up once.
+	FCollisionQueryParams GroundQueryParams;
+	FCollisionQueryParams CoverQueryParams;
+
 	// Gets the nearest ground point to Location that's in one grid unit's range or less. Returns false if ground point was too far, i.e. more than a grid unit away. Does not use the navmesh.
-	const bool FindGroundPoint(FVector& OutGroundPoint, const FVector Location) const;
+	template<typename QueriesType>
+	const bool FindGroundPoint(FVector& OutGroundPoint, const FVector Location, QueriesType& Queries) const;
 
-	// Gathers all the free grid points around an blocked grid point and adds them to OutGridPoints. Checks in 8 directions.
-	void GatherFreeGridPoints(TArray<FVector>& OutGridPoints, const FVector BlockedGridPoint, const TArray<FVector>& FreeGridPoints, const float NavPointEqualityTolerance);
+	// Returns true if nothing is in the way between half of SmallestAgentHeight and SmallestAgentHeight above the ground point. OutHit is what's in the way otherwise.
+	template<typename QueriesType>
+	bool IsGroundPointFree(FHitResult& OutHit, const FVector& GroundPoint, QueriesType& Queries) const;
 
-	// Generates cover points inside the specified bounding box. This method does the work.
-	void GenerateCoverInBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors, FBox& Bounds);
+	// Projects the grid points gathered around the blocked ones onto the navmesh and adds the ones that aren't near-duplicates of the cover points found so far.
+	template<typename QueriesType>
+	void ProjectGridPoints(TArray<FDTOCoverData>& OutCoverPointsOfActors, const TArray<FVector>& GridPoints, FActorCoverGenerationScratch& Scratch, QueriesType& Queries);
+
+	// Generates the cover points of a static mesh instance from the template of its mesh, placed with the instance's transform, instead of scanning its bounds.
+	template<typename QueriesType>
+	void GenerateCoverFromTemplate(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FCoverMeshTemplate& Template, const FTransform& Transform, FActorCoverGenerationScratch& Scratch, QueriesType& Queries);
+
+	// Scans the mesh, or the instance, on its own: against a snapshot of nothing but its collision and a flat ground at the height of the ground under it in place,
+	// so that whatever else is around it doesn't block any of the template's candidates. Adds the template to MeshTemplates and returns the one that's there, which
+	// may be another thread's. Returns null if the mesh's collision can't be captured on its own.
+	TSharedPtr<const FCoverMeshTemplate, ESPMode::ThreadSafe> BuildMeshTemplate(const FCoverMeshTemplateKey& TemplateKey, const FBox& Bounds, UStaticMeshComponent* StaticMesh, int32 InstanceIndex, const FTransform& Transform, FActorCoverGenerationScratch& Scratch);
+
+	// Generates the cover points of a bounding box, not yet expanded by BoundingBoxExpansion: from the template of StaticMesh, built first if need be, or by scanning it.
+	// StaticMesh is the static mesh, or the instance of an instanced one, that the bounds belong to, placed with Transform. Null if the bounds are those of the whole actor. Thread-safe.
+	void GenerateMeshCover(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FBox& Bounds, UStaticMeshComponent* StaticMesh, int32 InstanceIndex, const FTransform& Transform, FActorCoverGenerationScratch& Scratch);
+
+	// Generates the cover points of every instance of an instanced static mesh in its own bounds, in parallel, placed with the transforms in InstanceTransforms.
+	// The cover points are tagged with their instance.
+	void GenerateInstancedMeshCover(TArray<FDTOCoverData>& OutCoverPointsOfActors, UInstancedStaticMeshComponent* InstancedMesh);
+
+	// Scans the bounds for the free grid points next to the blocked ones, into the FinalGridPoints of the scratch. See GenerateCoverInBounds().
+	template<typename QueriesType>
+	void GatherGridPoints(const FBox& Bounds, FActorCoverGenerationScratch& Scratch, QueriesType& Queries);
+
+	// Scans the bounds against the live world: the physics scene or a snapshot of it, recording the queries if enabled.
+	template<typename QueriesType>
+	void ScanBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FBox& Bounds, FActorCoverGenerationScratch& Scratch, QueriesType& Queries);
 
 	// Find & store cover points in the game state. Calls GenerateCoverInBounds() either once when bGeneratePerStaticMesh == false or multiple times when bGeneratePerStaticMesh == true
 	void DoWork();
@@ -59,12 +166,23 @@ protected:
 	}
 
 public:
+	// Generates cover points inside the specified bounding box, already expanded by BoundingBoxExpansion. This method does the work.
+	// Templated on the query backend, see CoverQueryBackends.h; instantiated for the scene, the collision snapshot and the replay of a recording.
+	template<typename QueriesType>
+	void GenerateCoverInBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FBox& Bounds, FActorCoverGenerationScratch& Scratch, QueriesType& Queries);
+
+	// Generates the cover points of a recorded actor from its recording alone, without a world, by serving the recorded queries to the same scans, see FCoverReplayQueries.
+	// The cover object of every cover point is the recorded actor. Returns false if the scans haven't made exactly the recorded queries,
+	// e.g. because the algorithm has changed since, in which case the cover points may differ from the recorded run's.
+	static bool Replay(const FCoverQueryRecording& Recording, TArray<FCoverReplayedPoint>& OutCoverPoints);
+
 	FActorCoverPointGeneratorTask(
 		AActor* _Owner,
 		UWorld* _World,
 		float _BoundingBoxExpansion,
 		float _ScanGridUnit,
 		float _SmallestAgentHeight,
-		bool _bGeneratePerStaticMesh
+		bool _bGeneratePerStaticMesh,
+		bool _bScanColumns
 	);
 };
@@ -3,24 +3,161 @@
 #pragma once
 
 #include "CoreMinimal.h"
-#include "Async/AsyncWork.h"
+#include "Misc/IQueuedWork.h"
 #include "GameFramework/Actor.h"
 #include "Engine/World.h"
+#include "WorldCollision.h"
 #include "NavigationSystem.h"
 #include "NavMesh/RecastNavMesh.h"
 #include "CoverSystem/CoverSubsystem.h"
+#include "CoverSystem/CoverTile.h"
 #include "CoverSystem/DTOCoverData.h"
+#include "CoverSystem/NavmeshEdgeExtractor.h"
+#include "CoverSystem/CoverCollisionSnapshot.h"
+#include "CoverSystem/CoverQueryBackends.h"
+#include "Debug/CoverDebugDrawBuffer.h"
+#include "Debug/CoverAllocationCounter.h"
+
+class ALandscapeProxy;
+
+// Stages of the cover generation of a navmesh tile, in order.
+enum class ENavmeshCoverGenerationStage : uint8
+{
+	// Walks the navmesh edges of the tile and gathers the probes. Runs on a worker thread.
+	EnumerateProbes,
+
+	// First wave of asynchronous traces: one per probe, towards the navmesh hole at SmallestAgentHeight. Submitted from the game thread.
+	WallTraces,
+
+	// Second wave: the ledge/cliff follow-up traces of the probes whose wall trace hasn't hit anything. Submitted from the game thread.
+	CliffTraces,
+
+	// Third wave: the ground traces of the cliff edges, i.e. of the probes whose cliff traces haven't both hit, for finding the cliff object. Submitted from the game thread.
+	// In adaptive mode, the three waves repeat for the probes picked by each round of refinement.
+	GroundTraces,
+
+	// Turns the trace results into cover points and hands them over to the cover system. Runs on a worker thread.
+	ResolveCoverPoints,
+
+	Done
+};
+
+// Traces of a single probe.
+enum class ENavmeshCoverTrace : uint8
+{
+	// Towards the navmesh hole at SmallestAgentHeight, for finding walls.
+	Wall,
+
+	// Down along the Z-axis from beyond the edge, for finding cliff edges.
+	CliffStraight,
+
+	// Same as CliffStraight but slightly slanted, for non-perfectly straight cliff walls e.g. that of landscapes.
+	CliffSlanted,
+
+	// Into the ground below the probe, for finding the cliff object.
+	Ground,
+
+	Num
+};
+
+// A navmesh edge step that borders on a navmesh hole, along with the results of its traces.
+struct FNavmeshCoverProbe
+{
+	// Location of the edge step, i.e. of the would-be cover point.
+	FVector Location;
+
+	// Direction towards the navmesh hole.
+	FVector Direction;
+
+	// Object hit by the wall trace, or by the ground trace in case of a cliff edge.
+	TWeakObjectPtr<AActor> WallObject;
+	TWeakObjectPtr<AActor> GroundObject;
+
+	// Same as above, by index into FCoverQueryRecording::Objects, when the traces are replayed rather than run. See FNavmeshCoverPointGeneratorTask::Replay().
+	int32 WallObjectId = INDEX_NONE;
+	int32 GroundObjectId = INDEX_NONE;
+
+	bool bWallHit = false;
+	bool bCliffStraightHit = false;
+	bool bCliffSlantedHit = false;
+	bool bGroundHit = false;
+
+	// Whether the probe starts a new straight run of probes, i.e. its direction differs from that of the previous probe, or the edge step before it has been skipped.
+	bool bRunStart = false;
+
+	// Whether the heightfield of a landscape is enough to tell that both cliff traces would hit, in which case they aren't traced. See ResolveLandscapeCliffs().
+	bool bLandscapeCliffHit = false;
+
+	// Round of the trace waves that the probe gets traced in, or INDEX_NONE if its results are filled in from its neighbours instead.
+	int32 TraceRound = INDEX_NONE;
+
+	FNavmeshCoverProbe(FVector _Location, FVector _Direction, bool _bRunStart)
+		: Location(_Location), Direction(_Direction), bRunStart(_bRunStart)
+	{}
+
+	bool HasSameTraceResults(const FNavmeshCoverProbe& Other) const
+	{
+		return bWallHit == Other.bWallHit && WallObject == Other.WallObject && WallObjectId == Other.WallObjectId
+			&& bCliffStraightHit == Other.bCliffStraightHit && bCliffSlantedHit == Other.bCliffSlantedHit
+			&& bGroundHit == Other.bGroundHit && GroundObject == Other.GroundObject && GroundObjectId == Other.GroundObjectId;
+	}
+
+	void CopyTraceResults(const FNavmeshCoverProbe& Other)
+	{
+		WallObject = Other.WallObject;
+		GroundObject = Other.GroundObject;
+		WallObjectId = Other.WallObjectId;
+		GroundObjectId = Other.GroundObjectId;
+		bWallHit = Other.bWallHit;
+		bCliffStraightHit = Other.bCliffStraightHit;
+		bCliffSlantedHit = Other.bCliffSlantedHit;
+		bGroundHit = Other.bGroundHit;
+	}
+
+	// Whether the cover object is the one hit by the wall trace, or else the one in the ground below a cliff's edge, i.e. below a probe whose cliff traces haven't both hit.
+	FORCEINLINE bool IsWallCover() const { return bWallHit; }
+	FORCEINLINE bool IsCliffCover() const { return !bWallHit && !(bCliffStraightHit && bCliffSlantedHit) && bGroundHit; }
+};
 
 /**
- * Asynchronous, non-abandonable task for generating cover points and inserting them into an octree via UCoverSystem.
+ * Working sets of FNavmeshCoverPointGeneratorTask, one per thread, so that generating a tile doesn't allocate once they've grown to fit the largest tile.
+ * Arrays are only ever Reset(), which keeps their allocations.
+ * What has to outlive a stage, e.g. the probes, belongs to the generator instead, which is pooled by UCoverSubsystem along with its buffers.
  */
-class COVERSYSTEM_API FNavmeshCoverPointGeneratorTask : public FNonAbandonableTask
+struct FNavmeshCoverGenerationScratch
 {
-	friend class FAutoDeleteAsyncTask<FNavmeshCoverPointGeneratorTask>;
+	TArray<FNavmeshBoundaryEdge> Edges;
 
-private:
-	static FVector GetPerpendicularVector(const FVector& Vector);
+	TArray<FNavmeshBoundaryChain> Chains;
+
+	FNavmeshWeldScratch Weld;
+
+	// Output buffers of the chunks of EnumerateProbes() and ResolveCoverPoints(), see FNavmeshCoverPointGeneratorTask::ForEachChunk().
+	TArray<TArray<FNavmeshCoverProbe>> ChunkProbes;
+	TArray<TArray<FDTOCoverData>> ChunkCoverPoints;
+
+	// Landscapes that the cliff traces of the tile may hit.
+	TArray<ALandscapeProxy*> Landscapes;
+
+	// Gaps of the round being refined.
+	TArray<TPair<int32, int32>> ProbeGaps;
+
+	SIZE_T GetAllocatedSize() const;
 
+	// Scratch of the calling thread.
+	static FNavmeshCoverGenerationScratch& Get();
+};
+
+/**
+ * Pipelined cover generation of a single navmesh tile.
+ * Rather than tracing probe by probe, all the probes of the tile are gathered first, then their physics traces are submitted as asynchronous batches in three waves.
+ * No thread is blocked while the traces are in flight: the CPU-bound stages are queued on the thread pool as the generator itself,
+ * while the waves are driven by UCoverSubsystem from the game thread. See ENavmeshCoverGenerationStage.
+ * Generators are pooled by UCoverSubsystem and Reset() for every job, so that their buffers, their tile commit and their collision snapshot keep their allocations from tile to tile.
+ */
+class COVERSYSTEM_API FNavmeshCoverPointGeneratorTask : public IQueuedWork, public TSharedFromThis<FNavmeshCoverPointGeneratorTask, ESPMode::ThreadSafe>
+{
+private:
 	// Minimum distance between cover points.
 	float CoverPointMinDistance;
 
@@ -33,9 +170,31 @@ private:
 	// Offset that gets added to the cliff edge trace. Useful for detecting not perfectly straight cliffs e.g. that of landscapes.
 	const float StraightCliffErrorTolerance = 100.0f;
 
-	// Length of the raycast for checking if there's a navmesh hole to one of the sides of a navmesh edge.
+	// Distance between a navmesh edge and the navmesh hole next to it. Cliff traces start this far plus CliffEdgeDistance away from the edge.
 	const float NavmeshHoleCheckReach = 5.0f;
 
+	// Distance between the heightfield samples taken along a cliff trace, see IsBlockedByLandscape().
+	const float LandscapeSampleSpacing = 25.0f;
+
+	// Dirty areas are expanded by this much plus the agent radius: the navmesh edges move by up to the agent radius around the modified geometry,
+	// and the traces of an edge reach about this far.
+	const float DirtyAreaMargin = 200.0f;
+
+	// Boundary chains that turn by more than this many degrees at a vertex get a corner probe there.
+	const float CornerAngleThreshold = 30.0f;
+
+	// Consecutive probes whose directions differ by no more than this many degrees belong to the same straight run, see AdaptiveProbeStride.
+	const float StraightRunAngleThreshold = 1.0f;
+
+	// Only every Nth probe of a straight run is traced at first. See UCoverSubsystem::AdaptiveProbeStride.
+	int32 AdaptiveProbeStride = 1;
+
+	// Number of boundary chains that a worker processes at a time. Tiles with no more chains than this are processed serially, heavier ones in parallel.
+	const int32 ChainsPerChunk = 16;
+
+	// Number of probes that a worker resolves at a time, same as above.
+	const int32 ProbesPerChunk = 512;
+
 	// Height of the smallest actor that will ever fit under an overhanging cover. Should normally be the CROUCHED height of the smallest actor in the game. Not counting bunnies. Bunnies are useless.
 	const float SmallestAgentHeight;
 
@@ -47,47 +206,203 @@ private:
 	const float NavMeshMaxZDistanceFromGround;
 
 	// AABB used to filter out cover points on the edges of the map.
-	const FBox MapBounds;
+	FBox MapBounds = FBox(ForceInit);
+
+	// Copy of the tile taken when it was added to the navmesh, see FCoverTile::TileSnapshot. EnumerateProbes() extracts the edges from it, or from the navmesh if null.
+	TSharedPtr<const FNavmeshTileSnapshot, ESPMode::ThreadSafe> TileSnapshot;
+
+	// Areas of the tile to regenerate the cover of, see FCoverTile::DirtyAreas. Empty if the whole tile is to be generated.
+	// Expanded by DirtyAreaMargin once the probes are enumerated.
+	TArray<FBox> DirtyAreas;
 
 	// The bounding box to generate cover points in.
-	const int32 NavmeshTileIndex;
+	int32 NavmeshTileIndex = INDEX_NONE;
+
+	// Scheduler job this generator runs for, see FCoverGenerationScheduler.
+	uint32 JobId = 0;
 
 	// The active world.
 	UWorld* World;
 
+	// See UCoverSubsystem::RunningGeneratorStages and UCoverSubsystem::GeneratorStagesDoneEvent.
+	FThreadSafeCounter& RunningStages;
+	FEvent* StagesDoneEvent;
+
 #if DEBUG_RENDERING
 	bool bDebugDraw = false;
+
+	// Debug shapes of the current stage, handed over to UCoverSubsystem::QueueDebugDraw() at the end of it. Recorded by const methods as well.
+	mutable FCoverDebugDrawBuffer DebugDraw;
 #endif
 
-	const FVector GetEdgeDir(const FVector& EdgeStartVertex, const FVector& EdgeEndVertex) const;
+	ENavmeshCoverGenerationStage Stage = ENavmeshCoverGenerationStage::EnumerateProbes;
+
+	// Probes of the tile, in edge step order.
+	TArray<FNavmeshCoverProbe> Probes;
+
+	// AABB of the navmesh tile, expanded by half the tile height on the Z-axis.
+	FBox NavmeshTileArea;
+
+	// Number of traces of the current wave that haven't come back yet. Game thread only.
+	int32 PendingTraceCount = 0;
+
+	// Whether the traces of the current wave have been submitted. Game thread only.
+	bool bWaveSubmitted = false;
+
+	// Probes get traced in rounds of a wall, a cliff and a ground wave each: the first round traces the coarse probes, later ones bisect the gaps between them.
+	int32 TraceRound = 0;
+
+	// Pairs of traced probes of the same straight run with untraced probes between them, to be resolved after the current round.
+	TArray<TPair<int32, int32>> ProbeGaps;
+
+	FTraceDelegate TraceDelegate;
+
+	// Query params of every trace of the tile, set up once.
+	FCollisionQueryParams TraceQueryParams;
+
+	// Bytes that the scratch of the threads running the task and the generator's own buffers have grown by, see FNavmeshCoverGenerationScratch. Reported once the tile is done.
+	int64 ScratchGrowth = 0;
+
+	// Heap allocations made for the tile by any thread, see FCoverAllocationCounter. Reported once the tile is done. Counted by const methods as well.
+	mutable FThreadSafeCounter AllocationCount;
+
+	// Number of probes of the tile, for the report.
+	int32 ProbeCount = 0;
+
+	// Cover of the tile, handed over to UCoverSubsystem::QueueCoverTileCommit() by the last stage.
+	FCoverTileCommit Commit;
+
+	// Whether the last stage has left Commit to be written into the octree, rather than having given up on the tile or having shared its cover.
+	bool bCommitPending = false;
+
+	// Collision of the tile, if the traces are done against a snapshot rather than the physics scene. See UCoverSubsystem::bUseCollisionSnapshots.
+	// Captured again by every tile that uses it.
+	TUniquePtr<FCoverCollisionSnapshot> CollisionSnapshot;
+
+	// Queries of the tile, if they're being recorded. See UCoverSubsystem::CoverQueryRecordingDirectory.
+	TUniquePtr<FCoverQueryRecording> QueryRecording;
+
+	// Adds a probe for the edge step unless it's outside of the map or of the dirty areas. Returns true if the probe has been added.
+	bool AddEdgeStepProbe(TArray<FNavmeshCoverProbe>& OutProbes, const FVector& EdgeStepVertex, const FVector& HoleDirection, bool bRunStart) const;
+
+	// Adds the probes of a boundary chain: evenly spaced along its arc length, plus a diagonal one at each of its corners. Thread-safe.
+	void AddChainProbes(TArray<FNavmeshCoverProbe>& OutProbes, const FNavmeshBoundaryChain& Chain) const;
+
+	// Splits Num items into chunks of ItemsPerChunk and runs Body on each chunk, in parallel if there are several chunks.
+	// Body receives the index of the chunk and its range of items; chunks map to separate output buffers, so the results can be merged in order.
+	void ForEachChunk(int32 Num, int32 ItemsPerChunk, TFunctionRef<void(int32 ChunkIdx, int32 Start, int32 End)> Body) const;
+
+	// Returns true if the location is inside any of the dirty areas, or if the whole tile is dirty.
+	bool IsInsideDirtyAreas(const FVector& Location) const;
+
+	// Gathers the probes of the tile by walking its welded boundary edges, see FNavmeshEdgeExtractor. Only the edges that touch the dirty areas are walked.
+	void EnumerateProbes();
+
+	// Picks the probes of the first round: both ends of each straight run and every AdaptiveProbeStride-th probe in between.
+	void SelectCoarseProbes();
 
-	// Uses navmesh raycasts to scan for cover from TraceStart to TraceEnd.
+	// Remembers the gap between two traced probes of a straight run, unless they're next to each other.
+	void AddProbeGap(int32 FirstProbeIdx, int32 LastProbeIdx);
+
+	// Resolves the gaps of the round that has just come back: gaps whose ends agree are filled in without tracing, the others are bisected.
+	// Returns true if there are probes to trace in another round.
+	bool RefineProbes();
+
+	// Submits an asynchronous trace for the probe. The result is stored by OnTraceCompleted().
+	void SubmitTrace(int32 ProbeIdx, ENavmeshCoverTrace TraceType, const FVector& TraceStart, const FVector& TraceEnd, const FCollisionQueryParams& CollQueryParams);
+
+	// Returns true if a trace from Start to End is certain to hit one of the landscapes, going by their heightfields alone.
+	// That's the case if Start is above the terrain and any of the samples along the trace is below it; everything else is left to the actual traces.
+	bool IsBlockedByLandscape(const TArray<ALandscapeProxy*>& Landscapes, const FVector& Start, const FVector& End) const;
+
+	// Start and ends of the straight and the slanted cliff trace of the probe.
+	void GetCliffTraces(const FNavmeshCoverProbe& Probe, FVector& OutStart, FVector& OutStraightEnd, FVector& OutSlantedEnd) const;
+
+	// Flags the probes whose cliff traces are certain to hit a landscape, which is most of them on landscapes, so that no wave has to trace them.
+	// Done on the game thread, where the heightfields may be read, for every probe before the first wave, as the refined rounds may trace any of them.
+	// Tiles traced on their worker, see TraceWaves(), trace the landscapes instead.
+	void ResolveLandscapeCliffs(FCoverSceneQueries& Queries);
+
+	// Submits the traces of the current stage in a single batch, each through Trace(ProbeIdx, TraceType, Start, End). Probes resolved by ResolveLandscapeCliffs() get no cliff traces.
+	template<typename TraceFuncType>
+	void SubmitWave(TraceFuncType&& Trace);
+
+	// Moves on to the next wave, and submits it, for as long as there are no traces in flight. See TickTraces().
+	template<typename TraceFuncType>
+	bool AdvanceWaves(TraceFuncType&& Trace);
+
+	void OnTraceCompleted(const FTraceHandle& TraceHandle, FTraceDatum& TraceData);
+
+	// Stores the result of a trace of the probe. Hit is null if the trace hasn't hit anything.
+	// HitObjectId is the recorded object that it has hit instead of an actor, when replaying.
+	void StoreTraceResult(int32 ProbeIdx, ENavmeshCoverTrace TraceType, const FHitResult* Hit, int32 HitObjectId = INDEX_NONE);
+
+	// Decides whether the probe has found cover, based on the results of its traces.
 	// Builds an FDTOCoverData for transferring the results over to the cover octree.
 	// Returns true if cover was found, false if not.
-	bool ScanForCoverNavMeshProjection(FDTOCoverData& OutCoverData, const FVector& TraceStart, const FVector& TraceDirection);
+	bool ResolveProbe(FDTOCoverData& OutCoverData, const FNavmeshCoverProbe& Probe) const;
 
-	void ProcessEdgeStep(TArray<FDTOCoverData>& OutCoverPointsOfActors, const FVector& EdgeStepVertex, const FVector& EdgeDir);
+	// Generates the cover points of the tile out of the probes.
+	void ResolveCoverPoints(TArray<FDTOCoverData>& OutCoverPointsOfActors) const;
 
-	// Generates cover points inside the specified bounding box via navmesh edge-walking.
-	// Returns the AABB of the navmesh tile that corresponds to NavmeshTileIndex.
-	const FBox GenerateCoverInBounds(TArray<FDTOCoverData>& OutCoverPointsOfActors);
+	// Bytes allocated by the buffers that the generator keeps from tile to tile.
+	SIZE_T GetAllocatedSize() const;
 
-	// Find cover points in the supplied bounding box and store them in the cover system.
-	// Remove any cover points within the supplied bounding box, first.
-	void DoWork();
-
-	FORCEINLINE TStatId GetStatId() const
-	{
-		RETURN_QUICK_DECLARE_CYCLE_STAT(FNavmeshCoverPointGeneratorTask, STATGROUP_ThreadPoolAsyncTasks);
-	}
+	// Runs the current CPU-bound stage: gathers the probes and readies them for tracing, or resolves the cover points once the traces are done.
+	// Gives up on the tile instead if the job has been superseded in the meantime.
+	void DoWork(UCoverSubsystem& CoverSystem);
 
 public:
 	FNavmeshCoverPointGeneratorTask(
 		float _CoverPointMinDistance,
 		float _SmallestAgentHeight,
 		float _CoverPointGroundOffset,
+		UWorld* _World,
+		FThreadSafeCounter& _RunningStages,
+		FEvent* _StagesDoneEvent
+	);
+
+	// Readies the generator for a job of a navmesh tile, keeping the allocations of its buffers. Call only while the generator is idle, see UCoverSubsystem::AcquireCoverGenerator().
+	void Reset(
 		FBox _MapBounds,
+		int32 _AdaptiveProbeStride,
+		const TArray<FBox>& _DirtyAreas,
+		TSharedPtr<const FNavmeshTileSnapshot, ESPMode::ThreadSafe> _TileSnapshot,
 		int32 _NavmeshTileIndex,
-		UWorld* _World
+		uint32 _JobId
 	);
+
+	FORCEINLINE int32 GetNavmeshTileIndex() const { return NavmeshTileIndex; }
+
+	FORCEINLINE uint32 GetJobId() const { return JobId; }
+
+	FORCEINLINE FCoverTileCommit& GetCommit() { return Commit; }
+
+	FORCEINLINE FThreadSafeCounter& GetAllocationCount() { return AllocationCount; }
+
+	// Whether traces of the current wave are still in flight. Game thread only.
+	FORCEINLINE bool HasPendingTraces() const { return PendingTraceCount > 0; }
+
+	// Runs the current stage via DoWork(), then hands the generator over to the cover system for what comes next: tracing, committing its cover or going back to the pool.
+	// The hand-over is the last thing that touches the generator, as the cover system may pass it on to another thread right away.
+	virtual void DoThreadedWork() override;
+
+	// Stages can't be abandoned, so the stage is run right away instead, same as FAutoDeleteAsyncTask does for non-abandonable tasks.
+	virtual void Abandon() override;
+
+	// Logs how much the tile has allocated and adds it to the stats. Called by the cover system once it's done with the generator.
+	void ReportAllocations();
+
+	// Advances the trace waves. Game thread only; called every frame by UCoverSubsystem.
+	// Returns true once every wave has come back and the cover points are ready to be resolved by DoWork().
+	bool TickTraces();
+
+	// Does every trace wave right away against the query backend, see CoverQueryBackends.h. Called by DoWork() on the worker with a collision snapshot or while recording.
+	template<typename QueriesType>
+	void TraceWaves(QueriesType& Queries);
+
+	// Generates the cover points of a recorded navmesh tile from its recording alone, without a world, by serving the recorded traces to the same waves, see FCoverReplayQueries.
+	// The cover objects are the recorded ones; force fields are left out, same as live. Returns false if the waves haven't made exactly the recorded traces,
+	// e.g. because the algorithm has changed since, in which case the cover points may differ from the recorded run's.
+	static bool Replay(const FCoverQueryRecording& Recording, TArray<FCoverReplayedPoint>& OutCoverPoints);
 };